@@ -26,6 +26,33 @@
 #include "quotearg.h"
 
 #include <error.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* C23 thread_local, which is a keyword only in C23 and later.  */
+#if !defined thread_local && (!defined __STDC_VERSION__ \
+                              || __STDC_VERSION__ < 202311)
+# define thread_local _Thread_local
+#endif
+
+/* The strings returned by squote_style, indexed by slot.  Each thread
+   has its own, so that threads comparing files in parallel can quote
+   names without interfering with one another.  */
+static thread_local char *squote_slot[SQUOTE_SLOTS];
+
+/* In slot N return NAME, quoted in STYLE.  The result is valid until
+   the next call with the same N in the same thread.  */
+char *
+squote_style (int n, enum quoting_style style, char const *name)
+{
+  struct quoting_options *o = clone_quoting_options (nullptr);
+  set_quoting_style (o, style);
+  char *quoted = quotearg_alloc (name, SIZE_MAX, o);
+  free (o);
+  free (squote_slot[n]);
+  squote_slot[n] = quoted;
+  return quoted;
+}
 
 /* In slot N return NAME, quoted for the shell if NAME has unusual characters.
    This is for messages that historically did not quote names,
@@ -36,7 +63,7 @@
 char *
 squote (int n, char const *name)
 {
-  return quotearg_n_style (n, shell_escape_quoting_style, name);
+  return squote_style (n, shell_escape_quoting_style, name);
 }
 
 /* Issue help for the program.  If REASON_MSGID, first issue a
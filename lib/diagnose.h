@@ -1,3 +1,11 @@
+#include "quotearg.h"
+
 enum { EXIT_TROUBLE = 2 };
+
+/* The number of slots for quoted names, which is one more than the
+   greatest slot number that squote and squote_style accept.  */
+enum { SQUOTE_SLOTS = 2 };
+
+char *squote_style (int, enum quoting_style, char const *);
 char *squote (int, char const *);
 _Noreturn void try_help (char const *, char const *);
@@ -24,8 +24,13 @@
 #include <diagnose.h>
 #include <error.h>
 #include <file-type.h>
+#include <hard-locale.h>
+#include <mcel.h>
 #include <xalloc.h>
 
+#include <ctype.h>
+#include <uchar.h>
+
 /* The core of the Diff algorithm.  */
 #define ELEMENT lin
 #define EQUAL(x,y) ((x) == (y))
@@ -39,6 +44,22 @@
 #define USE_HEURISTIC
 #include <diffseq.h>
 
+/* Set up EQUIV_COUNT[F][I] as the number of buffered lines in
+   FILEVEC[F] that fall in equivalence class I.  The caller should
+   free EQUIV_COUNT[0] when done.  */
+
+static void
+count_equivs (struct file_data const filevec[], lin *equiv_count[2])
+{
+  lin *p = xicalloc (filevec[0].equiv_max, 2 * sizeof *p);
+  equiv_count[0] = p;
+  equiv_count[1] = p + filevec[0].equiv_max;
+
+  for (int f = 0; f < 2; f++)
+    for (lin i = 0; i < filevec[f].buffered_lines; i++)
+      ++equiv_count[f][filevec[f].equivs[i]];
+}
+
 /* Discard lines from one file that have no matches in the other file.
 
    A line which is discarded will not be considered by the actual
@@ -63,18 +84,8 @@ discard_confusing_lines (struct file_data filevec[])
       filevec[f].realindexes = p;  p += filevec[f].buffered_lines;
     }
 
-  /* Set up equiv_count[F][I] as the number of lines in file F
-     that fall in equivalence class I.  */
-
-  p = xicalloc (filevec[0].equiv_max, 2 * sizeof *p);
   lin *equiv_count[2];
-  equiv_count[0] = p;
-  equiv_count[1] = p + filevec[0].equiv_max;
-
-  for (lin i = 0; i < filevec[0].buffered_lines; i++)
-    ++equiv_count[0][filevec[0].equivs[i]];
-  for (lin i = 0; i < filevec[1].buffered_lines; i++)
-    ++equiv_count[1][filevec[1].equivs[i]];
+  count_equivs (filevec, equiv_count);
 
   /* Set up tables of which lines are going to be discarded.  */
 
@@ -436,23 +447,610 @@ build_script (struct file_data const filevec[])
   return script;
 }
 
-/* If CHANGES, briefly report that two files differed.  */
+/* If CHANGES, briefly report to the current printer that two files
+   differed.  */
+static void
+briefly_report_here (int changes, struct file_data const filevec[])
+{
+  if (changes && !current_printer->brief && stat_output_style (output_style))
+    print_binary_stat (filevec);
+  else if (changes)
+    message_here ((current_printer->brief
+		   ? N_("Files %s and %s differ\n")
+		   : N_("Binary files %s and %s differ\n")),
+		  file_label[0] ? file_label[0] : squote (0, filevec[0].name),
+		  file_label[1] ? file_label[1] : squote (1, filevec[1].name));
+}
+
+/* If CHANGES, briefly report to every printer that two files differed.  */
 static void
 briefly_report (int changes, struct file_data const filevec[])
 {
-  if (changes)
-    message ((brief
-              ? N_("Files %s and %s differ\n")
-              : N_("Binary files %s and %s differ\n")),
-	     file_label[0] ? file_label[0] : squote (0, filevec[0].name),
-	     file_label[1] ? file_label[1] : squote (1, filevec[1].name));
+  for (idx_t i = 0; i < printers; i++)
+    {
+      select_printer (&printer[i]);
+      briefly_report_here (changes, filevec);
+    }
+  select_printer (nullptr);
+}
+
+/* Reverse the edit script SCRIPT in place, and return the result.  */
+static struct change *
+reverse_script (struct change *script)
+{
+  struct change *reversed = nullptr;
+  while (script)
+    {
+      struct change *next = script->link;
+      script->link = reversed;
+      reversed = script;
+      script = next;
+    }
+  return reversed;
+}
+
+/* Output the edit script *SCRIPT for the comparison CMP in the style
+   of the current printer.  CHANGES is as for diff_2_files.  *SCRIPT is
+   in reverse order if *REVERSED, and is reversed first if the style
+   needs the other order.  */
+static void
+print_changes (struct comparison const *cmp, struct change **script,
+	       bool *reversed, int changes)
+{
+  if (current_printer->brief)
+    {
+      briefly_report_here (changes, cmp->file);
+      return;
+    }
+
+  if (stat_output_style (output_style))
+    {
+      if (changes)
+	print_stat_script (*script, cmp->file);
+      return;
+    }
+
+  if (! (changes || !no_diff_means_no_output))
+    return;
+
+  if (*reversed != (output_style == OUTPUT_ED))
+    {
+      *script = reverse_script (*script);
+      *reversed = !*reversed;
+    }
+
+  /* Record info for starting up output,
+     to be used if and when we have some output to print.  */
+  setup_output (file_label[0] ? file_label[0] : cmp->file[0].name,
+		file_label[1] ? file_label[1] : cmp->file[1].name,
+		cmp->parent != &noparent);
+
+  switch (output_style)
+    {
+    case OUTPUT_CONTEXT:
+      print_context_script (*script, false);
+      break;
+
+    case OUTPUT_UNIFIED:
+      print_context_script (*script, true);
+      break;
+
+    case OUTPUT_ED:
+      print_ed_script (*script);
+      break;
+
+    case OUTPUT_FORWARD_ED:
+      pr_forward_ed_script (*script);
+      break;
+
+    case OUTPUT_RCS:
+      print_rcs_script (*script);
+      break;
+
+    case OUTPUT_NORMAL:
+      print_normal_script (*script);
+      break;
+
+    case OUTPUT_IFDEF:
+      print_ifdef_script (*script);
+      break;
+
+    case OUTPUT_SDIFF:
+      print_sdiff_script (*script);
+      break;
+
+    default:
+      unreachable ();
+    }
+
+  finish_output ();
+}
+
+/* Buffers for a line in the form that collate_lines compares.  */
+struct collation_buffer
+{
+  char *buf;
+  idx_t size;
+  char *folded;
+  idx_t folded_size;
+};
+
+/* Make room for SIZE bytes in the buffer *BUF of size *BUFSIZE,
+   discarding its contents.  */
+static void
+reserve_buffer (char **buf, idx_t *bufsize, idx_t size)
+{
+  if (*bufsize < size)
+    {
+      free (*buf);
+      *buf = xpalloc (nullptr, bufsize, size - *bufsize, -1, 1);
+    }
+}
+
+/* Return the character at P, which is before LIM, as lines_differ
+   sees it: a byte in a single-byte locale, a possibly multibyte
+   character or encoding error otherwise.  */
+static mcel_t
+scan_line_char (char const *p, char const *lim)
+{
+  if (MB_CUR_MAX == 1)
+    return (mcel_t) { .ch = (unsigned char) *p, .len = 1 };
+  return mcel_scan (p, lim);
+}
+
+/* Return true if G is white space, as lines_differ decides.  */
+static bool
+line_char_isspace (mcel_t g)
+{
+  return MB_CUR_MAX == 1 ? isspace (g.ch) : !g.err && c32isspace (g.ch);
+}
+
+/* Return line I of FILE, not counting any trailing newline, and store
+   its length into *LEN.  If options like -b and -i that put lines
+   into equivalence classes are in effect, return instead a form of
+   the line that is the same for all lines of its class: white space
+   that is ignored is removed, a change in the amount of white space
+   becomes a single space, a run of white space with -E becomes the
+   tab stops and columns it advances, and case is folded.  The result
+   is null-terminated if TERMINATED or if it is not the line itself.  */
+static char const *
+comparable_line (struct collation_buffer *b, bool terminated,
+		 struct file_data const *file, lin i, idx_t *len)
+{
+  char const *line = file->linbuf[i];
+  char const *lastbyte = file->linbuf[i + 1] - 1;
+  char const *lim = lastbyte + (*lastbyte != '\n');
+
+  if (! (ignore_white_space || ignore_case || terminated))
+    {
+      *len = lim - line;
+      return line;
+    }
+
+  /* No form is longer than the line itself.  */
+  reserve_buffer (&b->buf, &b->size, lim - line + 1);
+  char *p = b->buf;
+
+  /* The end of the form before any trailing white space.  */
+  char *nonspace_end = p;
+
+  bool expand_tabs = (ignore_white_space == IGNORE_TAB_EXPANSION
+		      || (ignore_white_space
+			  == IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE));
+  intmax_t column = 0;
+
+  for (char const *q = line; q < lim; )
+    {
+      mcel_t g = scan_line_char (q, lim);
+      bool space = line_char_isspace (g);
+
+      if (space && ignore_white_space == IGNORE_ALL_SPACE)
+	q += g.len;
+      else if (space && ignore_white_space == IGNORE_SPACE_CHANGE)
+	{
+	  do
+	    q += g.len;
+	  while (q < lim && line_char_isspace (g = scan_line_char (q, lim)));
+	  *p++ = ' ';
+	}
+      else if ((g.ch == ' ' || g.ch == '\t') && !g.err && expand_tabs)
+	{
+	  /* Output a tab for each tab stop that the run of blanks
+	     reaches, then a space for each column after the last.
+	     This is what lines_differ compares.  */
+	  intmax_t start = column;
+	  bool crossed = false;
+	  for (; q < lim && (*q == ' ' || *q == '\t'); q++)
+	    if (*q == '\t' || column == tabsize - 1)
+	      {
+		*p++ = '\t';
+		column = 0;
+		crossed = true;
+	      }
+	    else
+	      column++;
+	  for (intmax_t col = crossed ? 0 : start; col < column; col++)
+	    *p++ = ' ';
+	}
+      else
+	{
+	  p = mempcpy (p, q, g.len);
+	  q += g.len;
+	  switch (g.err ? 0 : g.ch)
+	    {
+	    case '\r':
+	      column = 0;
+	      break;
+	    case '\b':
+	      column -= 0 < column;
+	      break;
+	    case '\a': case '\f': case '\v':
+	      break;
+	    default:
+	      column += (MB_CUR_MAX == 1 ? !!isprint (g.ch)
+			 : g.err ? 1 : c32width (g.ch));
+	      if (tabsize <= column)
+		column = 0;
+	      break;
+	    }
+	  if (!space)
+	    nonspace_end = p;
+	}
+    }
+
+  if (ignore_white_space != IGNORE_NO_WHITE_SPACE
+      && ignore_white_space != IGNORE_TAB_EXPANSION)
+    p = nonspace_end;
+  *p = '\0';
+  *len = p - b->buf;
+  if (!ignore_case)
+    return b->buf;
+
+  /* Fold to upper case as 'sort -f' does, so that files sorted by it
+     are in order.  In multibyte locales fold characters to lower case
+     with c32tolower as lines_differ does, which can make a character
+     longer.  */
+  if (MB_CUR_MAX == 1)
+    {
+      for (idx_t j = 0; j < *len; j++)
+	b->buf[j] = toupper ((unsigned char) b->buf[j]);
+      return b->buf;
+    }
+  reserve_buffer (&b->folded, &b->folded_size, 4 * *len + 1);
+  *len = fold_file_name (b->folded, b->buf, *len) - b->folded;
+  return b->folded;
+}
+
+/* Compare line I of FILE_I with line J of FILE_J by their bytes.  */
+static int
+compare_line_bytes (struct file_data const *file_i, lin i,
+		    struct file_data const *file_j, lin j)
+{
+  idx_t len_i = file_i->linbuf[i + 1] - file_i->linbuf[i];
+  idx_t len_j = file_j->linbuf[j + 1] - file_j->linbuf[j];
+  int r = memcmp (file_i->linbuf[i], file_j->linbuf[j], MIN (len_i, len_j));
+  return r ? r : (len_i > len_j) - (len_i < len_j);
+}
+
+/* Compare line I of FILE_I with line J of FILE_J by collating
+   sequence if BY_LOCALE, otherwise by byte values, as they compare
+   after options like -b and -i apply.
+   Return a negative, zero, or positive value
+   as the first line sorts before, with, or after the second.  */
+static int
+collate_lines (struct collation_buffer b[2], bool by_locale,
+	       struct file_data const *file_i, lin i,
+	       struct file_data const *file_j, lin j)
+{
+  idx_t len_i, len_j;
+  char const *line_i = comparable_line (&b[0], by_locale, file_i, i, &len_i);
+  char const *line_j = comparable_line (&b[1], by_locale, file_j, j, &len_j);
+
+  if (by_locale)
+    {
+      int r = strcoll (line_i, line_j);
+      if (r)
+	return r;
+    }
+
+  int r = memcmp (line_i, line_j, MIN (len_i, len_j));
+  return r ? r : (len_i > len_j) - (len_i < len_j);
+}
+
+/* Pair up the buffered lines of FILEVEC, which are both sorted,
+   by merging them in a single pass, and mark the lines that are
+   not paired as changed.  This replaces only the search for a
+   minimal edit script; the files are read, and the script built
+   from the flags, as for other comparisons.  Lines are paired if
+   they are in the same equivalence class, and are in order if they
+   are as collate_lines compares them.  Return true if successful,
+   false (after diagnosing the problem) if a file turns out to be out
+   of order.  */
+
+static bool
+merge_sorted_lines (struct file_data const filevec[])
+{
+  bool by_locale = hard_locale (LC_COLLATE);
+  struct collation_buffer b[2] = {{nullptr, 0, nullptr, 0},
+				  {nullptr, 0, nullptr, 0}};
+  lin n[2] = { filevec[0].buffered_lines, filevec[1].buffered_lines };
+  lin next[2] = { 0, 0 };
+  bool sorted = true;
+
+  while (next[0] < n[0] || next[1] < n[1])
+    {
+      /* Consume the line from file 0, from file 1, or from both,
+         depending on which sorts first.  */
+      int order = (next[1] == n[1] ? -1
+		   : next[0] == n[0] ? 1
+		   : (filevec[0].equivs[next[0]]
+		      == filevec[1].equivs[next[1]]) ? 0
+		   : collate_lines (b, by_locale,
+				    &filevec[0], next[0],
+				    &filevec[1], next[1]));
+
+      /* Lines that are not paired must not be consumed together.  */
+      if (order == 0 && next[0] < n[0] && next[1] < n[1]
+	  && filevec[0].equivs[next[0]] != filevec[1].equivs[next[1]])
+	order = compare_line_bytes (&filevec[0], next[0],
+				    &filevec[1], next[1]);
+
+      for (int f = 0; f < 2; f++)
+	if (f ? 0 <= order : order <= 0)
+	  {
+	    lin i = next[f]++;
+	    if (0 < i
+		&& 0 < collate_lines (b, by_locale,
+				      &filevec[f], i - 1, &filevec[f], i))
+	      {
+		error (0, 0, _("%s:%"pI"d: input is not sorted"),
+		       (file_label[f] ? file_label[f]
+			: squote (f, filevec[f].name)),
+		       translate_line_number (&filevec[f], i));
+		/* Keep the flags consistent for build_script, which
+		   assumes paired lines come in equal numbers.  */
+		for (int g = 0; g < 2; g++)
+		  for (lin j = 0; j < n[g]; j++)
+		    filevec[g].changed[j] = true;
+		sorted = false;
+		goto done;
+	      }
+	    filevec[f].changed[i] = order != 0;
+	  }
+    }
+
+ done:
+  for (int f = 0; f < 2; f++)
+    {
+      free (b[f].buf);
+      free (b[f].folded);
+    }
+  return sorted;
+}
+
+/* Pair up the buffered lines of FILEVEC regardless of their order,
+   and mark the lines that are not paired as changed.  If an
+   equivalence class has N lines in one file and M in the other,
+   the first MIN (N, M) lines of the class in each file are paired,
+   and the rest are surplus.  */
+
+static void
+pair_unordered_lines (struct file_data const filevec[])
+{
+  lin *equiv_count[2];
+  count_equivs (filevec, equiv_count);
+
+  /* Replace each count by the number of lines of the class that
+     can be paired.  */
+  for (lin e = 0; e < filevec[0].equiv_max; e++)
+    equiv_count[0][e] = equiv_count[1][e]
+      = MIN (equiv_count[0][e], equiv_count[1][e]);
+
+  for (int f = 0; f < 2; f++)
+    for (lin i = 0; i < filevec[f].buffered_lines; i++)
+      {
+	lin *unpaired = &equiv_count[f][filevec[f].equivs[i]];
+	filevec[f].changed[i] = *unpaired == 0;
+	*unpaired -= *unpaired != 0;
+      }
+
+  free (equiv_count[0]);
+}
+
+/* A scan through the key fields of a record.  */
+struct key_scan
+{
+  char const *p;	/* Start of the next field.  */
+  char const *lim;	/* End of the record, not counting its newline.  */
+  idx_t field;		/* 1-origin number of the next field.  */
+  idx_t range;		/* Index of the next key field range.  */
+};
+
+/* Start scanning the key fields of line I of FILE.  */
+static struct key_scan
+key_scan_start (struct file_data const *file, lin i)
+{
+  char const *lastbyte = file->linbuf[i + 1] - 1;
+  return (struct key_scan) { .p = file->linbuf[i],
+			     .lim = lastbyte + (*lastbyte != '\n'),
+			     .field = 1, .range = 0 };
+}
+
+/* Find the next key field of the scan S.  If there is one, store its
+   start and length into *FIELD and *LEN and return true;
+   otherwise return false.  */
+static bool
+next_key_field (struct key_scan *s, char const **field, idx_t *len)
+{
+  while (s->p <= s->lim && s->range < key_field_ranges)
+    {
+      char const *start = s->p;
+      char const *end = memchr (start, field_separator, s->lim - start);
+      if (!end)
+	end = s->lim;
+      s->p = end + 1;
+      idx_t f = s->field++;
+
+      while (key_fields[s->range].hi < f)
+	if (++s->range == key_field_ranges)
+	  return false;
+      if (key_fields[s->range].lo <= f)
+	{
+	  *field = start;
+	  *len = end - start;
+	  return true;
+	}
+    }
+  return false;
+}
+
+/* Return a hash of the key of line I of FILE.  */
+static size_t
+hash_key (struct file_data const *file, lin i)
+{
+  struct key_scan s = key_scan_start (file, i);
+  size_t h = 0;
+  char const *field;
+  idx_t len;
+  while (next_key_field (&s, &field, &len))
+    {
+      for (idx_t j = 0; j < len; j++)
+	h = (h << 7 | h >> (SIZE_WIDTH - 7)) + (unsigned char) field[j];
+      h = (h << 7 | h >> (SIZE_WIDTH - 7)) + UCHAR_MAX + 1;
+    }
+  return h;
+}
+
+/* Return true if line I of FILE_I and line J of FILE_J have equal keys.  */
+static bool
+same_key (struct file_data const *file_i, lin i,
+	  struct file_data const *file_j, lin j)
+{
+  struct key_scan s = key_scan_start (file_i, i);
+  struct key_scan t = key_scan_start (file_j, j);
+  for (;;)
+    {
+      char const *field_i, *field_j;
+      idx_t len_i, len_j;
+      bool more_i = next_key_field (&s, &field_i, &len_i);
+      bool more_j = next_key_field (&t, &field_j, &len_j);
+      if (! (more_i & more_j))
+	return more_i == more_j;
+      if (len_i != len_j || memcmp (field_i, field_j, len_i) != 0)
+	return false;
+    }
+}
+
+/* Pair up the buffered lines of FILEVEC as records that have the same
+   key, regardless of their order, and mark as changed the records
+   that are not paired or whose contents differ.  If several records
+   in a file have the same key, they are paired in the order they
+   appear.  */
+
+static void
+pair_keyed_lines (struct file_data const filevec[])
+{
+  lin n0 = filevec[0].buffered_lines;
+  lin n1 = filevec[1].buffered_lines;
+
+  /* Hash the records of file 1 into a table whose buckets are chains
+     of records, linked in file order.  */
+  int nbits = 1;
+  while (((lin) 1 << nbits) < n1)
+    nbits++;
+  lin nbuckets = (lin) 1 << nbits;
+  lin *bucket = xinmalloc (nbuckets + n1, sizeof *bucket);
+  lin *next = bucket + nbuckets;
+  size_t *hash1 = xinmalloc (n1, sizeof *hash1);
+  for (lin b = 0; b < nbuckets; b++)
+    bucket[b] = -1;
+  for (lin j = n1; 0 <= --j; )
+    {
+      hash1[j] = hash_key (&filevec[1], j);
+      lin *head = &bucket[hash1[j] & (nbuckets - 1)];
+      next[j] = *head;
+      *head = j;
+    }
+
+  for (lin j = 0; j < n1; j++)
+    filevec[1].changed[j] = true;
+
+  /* Look up each record of file 0, and unlink the first record of
+     file 1 that has the same key.  */
+  for (lin i = 0; i < n0; i++)
+    {
+      size_t h = hash_key (&filevec[0], i);
+      lin *link = &bucket[h & (nbuckets - 1)];
+      lin j;
+      while (0 <= (j = *link)
+	     && ! (hash1[j] == h
+		   && same_key (&filevec[0], i, &filevec[1], j)))
+	link = &next[j];
+
+      if (j < 0)
+	filevec[0].changed[i] = true;
+      else
+	{
+	  *link = next[j];
+	  bool modified = filevec[0].equivs[i] != filevec[1].equivs[j];
+	  filevec[0].changed[i] = filevec[1].changed[j] = modified;
+	}
+    }
+
+  free (hash1);
+  free (bucket);
+}
+
+/* In brief mode, try to decide whether the buffered lines of
+   FILEVEC differ without computing an edit script.
+   Return 1 if they certainly differ, 0 if they certainly do not,
+   and -1 if only the full comparison can tell.  */
+
+static int
+briefly_compare_lines (struct file_data const filevec[])
+{
+  lin n0 = filevec[0].buffered_lines;
+  lin n1 = filevec[1].buffered_lines;
+  lin const *equivs0 = filevec[0].equivs;
+  lin const *equivs1 = filevec[1].equivs;
+  bool same = n0 == n1 && memcmp (equivs0, equivs1, n0 * sizeof *equivs0) == 0;
+
+  /* Without -B or -I every change counts, and the files differ
+     exactly when their sequences of equivalence classes differ.  */
+  if (same || ! (ignore_blank_lines || ignore_regexp))
+    return !same;
+
+  /* A line whose equivalence class does not occur in the other file
+     is inserted or deleted by any edit script.  If such a line is
+     not ignorable, its hunk is not ignorable either.  */
+  char *occurs = xizalloc (filevec[0].equiv_max);
+  for (lin i = 0; i < n0; i++)
+    occurs[equivs0[i]] |= 1;
+  for (lin i = 0; i < n1; i++)
+    occurs[equivs1[i]] |= 2;
+
+  int changes = -1;
+  for (int f = 0; f < 2 && changes < 0; f++)
+    for (lin i = 0; i < filevec[f].buffered_lines; i++)
+      if (occurs[filevec[f].equivs[i]] != 3
+	  && ! ignorable_line (&filevec[f], i))
+	{
+	  changes = 1;
+	  break;
+	}
+
+  free (occurs);
+  return changes;
 }
 
 /* Report the differences of two files.  */
 int
 diff_2_files (struct comparison *cmp)
 {
-  int changes;
+  /* A file compared to a nonexistent one need not be read into memory.  */
+  int changes = stream_one_side (cmp);
+  if (0 <= changes)
+    return changes;
 
   /* If we have detected that either file is binary,
      compare the two files as binary.  This can happen
@@ -490,6 +1088,10 @@ diff_2_files (struct comparison *cmp)
           for (int f = 0; f < 2; f++)
             cmp->file[f].buffer = xirealloc (cmp->file[f].buffer, buffer_size);
 
+          /* Compute the digest of the contents for the digest cache,
+             which are those of both files if they turn out the same.  */
+          struct sha256_ctx *digest = digest_cache_start (cmp->file);
+
           for (;; cmp->file[0].buffered = cmp->file[1].buffered = 0)
             {
               /* Read a buffer's worth from both files.  */
@@ -508,6 +1110,10 @@ diff_2_files (struct comparison *cmp)
                   break;
                 }
 
+              if (digest)
+                digest_cache_add (digest, cmp->file[0].buffer,
+                                  cmp->file[0].buffered);
+
               /* If we reach end of file, the files are the same.  */
               if (cmp->file[0].buffered != buffer_size)
                 {
@@ -515,10 +1121,26 @@ diff_2_files (struct comparison *cmp)
                   break;
                 }
             }
+
+          digest_cache_finish (digest, cmp->file, changes == 0);
         }
 
       briefly_report (changes, cmp->file);
     }
+  else if (brief && robust_output_style (output_style)
+	   && ordered_pairing (line_pairing)
+	   && 0 <= (changes = briefly_compare_lines (cmp->file)))
+    {
+      briefly_report (changes, cmp->file);
+
+      free (cmp->file[0].ignorable);
+      free_function_index (cmp->file[0].function_index);
+      for (int f = 0; f < 2; f++)
+        {
+          free (cmp->file[f].equivs);
+          free (cmp->file[f].linbuf + cmp->file[f].linbuf_base);
+        }
+    }
   else
     {
       /* Allocate vectors for the results of comparison:
@@ -531,39 +1153,62 @@ diff_2_files (struct comparison *cmp)
       cmp->file[0].changed = flag_space + 1;
       cmp->file[1].changed = flag_space + cmp->file[0].buffered_lines + 3;
 
-      /* Some lines are obviously insertions or deletions
-         because they don't match anything.  Detect them now, and
-         avoid even thinking about them in the main comparison algorithm.  */
+      bool sorted = true;
+      cmp->file[0].undiscarded = nullptr;
+
+      if (line_pairing == PAIR_SORTED)
+	{
+	  /* Sorted files need no search for a common subsequence.  */
+	  curr = *cmp;
+	  sorted = merge_sorted_lines (cmp->file);
+	}
+      else if (line_pairing == PAIR_UNORDERED)
+	{
+	  curr = *cmp;
+	  pair_unordered_lines (cmp->file);
+	}
+      else if (line_pairing == PAIR_KEYED)
+	{
+	  curr = *cmp;
+	  pair_keyed_lines (cmp->file);
+	}
+      else
+	{
+	  /* Some lines are obviously insertions or deletions
+	     because they don't match anything.  Detect them now, and
+	     avoid even thinking about them in the main comparison
+	     algorithm.  */
 
-      discard_confusing_lines (cmp->file);
+	  discard_confusing_lines (cmp->file);
 
-      /* Now do the main comparison algorithm, considering just the
-         undiscarded lines.  */
+	  /* Now do the main comparison algorithm, considering just the
+	     undiscarded lines.  */
 
-      struct context ctxt;
-      ctxt.xvec = cmp->file[0].undiscarded;
-      ctxt.yvec = cmp->file[1].undiscarded;
-      lin diags = (cmp->file[0].nondiscarded_lines
-		   + cmp->file[1].nondiscarded_lines + 3);
-      ctxt.fdiag = xinmalloc (diags, 2 * sizeof *ctxt.fdiag);
-      ctxt.bdiag = ctxt.fdiag + diags;
-      ctxt.fdiag += cmp->file[1].nondiscarded_lines + 1;
-      ctxt.bdiag += cmp->file[1].nondiscarded_lines + 1;
+	  struct context ctxt;
+	  ctxt.xvec = cmp->file[0].undiscarded;
+	  ctxt.yvec = cmp->file[1].undiscarded;
+	  lin diags = (cmp->file[0].nondiscarded_lines
+		       + cmp->file[1].nondiscarded_lines + 3);
+	  ctxt.fdiag = xinmalloc (diags, 2 * sizeof *ctxt.fdiag);
+	  ctxt.bdiag = ctxt.fdiag + diags;
+	  ctxt.fdiag += cmp->file[1].nondiscarded_lines + 1;
+	  ctxt.bdiag += cmp->file[1].nondiscarded_lines + 1;
 
-      ctxt.heuristic = speed_large_files;
+	  ctxt.heuristic = speed_large_files;
 
-      /* Set TOO_EXPENSIVE to be the approximate square root of the
-         input size, bounded below by 4096.  4096 seems to be good for
-         circa-2016 CPUs; see Bug#16848 and Bug#24715.  */
-      lin too_expensive = (lin) 1 << ((floor_log2 (diags) >> 1) + 1);
-      ctxt.too_expensive = MAX (4096, too_expensive);
+	  /* Set TOO_EXPENSIVE to be the approximate square root of the
+	     input size, bounded below by 4096.  4096 seems to be good for
+	     circa-2016 CPUs; see Bug#16848 and Bug#24715.  */
+	  lin too_expensive = (lin) 1 << ((floor_log2 (diags) >> 1) + 1);
+	  ctxt.too_expensive = MAX (4096, too_expensive);
 
-      curr = *cmp;
+	  curr = *cmp;
 
-      compareseq (0, cmp->file[0].nondiscarded_lines,
-                  0, cmp->file[1].nondiscarded_lines, minimal, &ctxt);
+	  compareseq (0, cmp->file[0].nondiscarded_lines,
+		      0, cmp->file[1].nondiscarded_lines, minimal, &ctxt);
 
-      free (ctxt.fdiag - (cmp->file[1].nondiscarded_lines + 1));
+	  free (ctxt.fdiag - (cmp->file[1].nondiscarded_lines + 1));
+	}
 
       /* Modify the results slightly to make them prettier
          in cases where that can validly be done.  */
@@ -579,7 +1224,9 @@ diff_2_files (struct comparison *cmp)
 
       /* Set CHANGES if we had any diffs.
          If some changes are ignored, we must scan the script to decide.  */
-      if (ignore_blank_lines || ignore_regexp.fastmap)
+      if (! sorted)
+	changes = 2;
+      else if (ignore_blank_lines || ignore_regexp)
         {
           changes = 0;
 
@@ -606,64 +1253,23 @@ diff_2_files (struct comparison *cmp)
       else
         changes = (script != 0);
 
-      if (brief)
-        briefly_report (changes, cmp->file);
-      else
-        {
-          if (changes || !no_diff_means_no_output)
-            {
-              /* Record info for starting up output,
-                 to be used if and when we have some output to print.  */
-              setup_output (file_label[0] ? file_label[0] : cmp->file[0].name,
-                            file_label[1] ? file_label[1] : cmp->file[1].name,
-			    cmp->parent != &noparent);
-
-              switch (output_style)
-                {
-                case OUTPUT_CONTEXT:
-                  print_context_script (script, false);
-                  break;
-
-                case OUTPUT_UNIFIED:
-                  print_context_script (script, true);
-                  break;
-
-                case OUTPUT_ED:
-                  print_ed_script (script);
-                  break;
-
-                case OUTPUT_FORWARD_ED:
-                  pr_forward_ed_script (script);
-                  break;
-
-                case OUTPUT_RCS:
-                  print_rcs_script (script);
-                  break;
-
-                case OUTPUT_NORMAL:
-                  print_normal_script (script);
-                  break;
-
-                case OUTPUT_IFDEF:
-                  print_ifdef_script (script);
-                  break;
-
-                case OUTPUT_SDIFF:
-                  print_sdiff_script (script);
-                  break;
-
-                default:
-                  unreachable ();
-                }
-
-              finish_output ();
-            }
-        }
+      if (sorted)
+	{
+	  bool reversed = output_style == OUTPUT_ED;
+	  for (idx_t i = 0; i < printers; i++)
+	    {
+	      select_printer (&printer[i]);
+	      print_changes (cmp, &script, &reversed, changes);
+	    }
+	  select_printer (nullptr);
+	}
 
       free (cmp->file[0].undiscarded);
 
       free (flag_space);
 
+      free (cmp->file[0].ignorable);
+      free_function_index (cmp->file[0].function_index);
       for (int f = 0; f < 2; f++)
         {
           free (cmp->file[f].equivs);
@@ -22,26 +22,24 @@
 #include <c-ctype.h>
 #include <stat-time.h>
 #include <strftime.h>
+#include <xalloc.h>
 
-static char const *find_function (char const *const *, lin);
+static char const *find_function (struct file_data const *, lin);
 static struct change *find_hunk (struct change *);
 static void mark_ignorable (struct change *);
 static void pr_context_hunk (struct change *);
 static void pr_unidiff_hunk (struct change *);
 
-/* Last place find_function started searching from.  */
-static lin find_function_last_search;
-
-/* The value find_function returned when it started searching there.  */
-static lin find_function_last_match;
 
-/* Print a label for a context diff, with a file name and date or a label.  */
+/* Print a label for a context diff, with a file name and a date
+   formatted by FORMAT, or a label.  */
 
 static void
 print_context_label (char const *mark,
                      struct file_data *inf,
                      char const *name,
-                     char const *label)
+                     char const *label,
+                     char const *format)
 {
   set_color_context (HEADER_CONTEXT);
   if (label)
@@ -61,7 +59,7 @@ print_context_label (char const *mark,
 	ts = get_stat_mtime (&inf->stat);
 
       /* Buffer for nstftime output, big enough to handle any
-	 timestamp formatted according to time_format.
+	 timestamp formatted according to FORMAT.
 	 Its size is an upper bound for the format "%Y-%m-%d %H:%M:%S.%N %z",
 	 with an int for year and a time_t for time zone hour.
 	 The format "%Y-%m-%d %H:%M:%S %z" generates fewer bytes,
@@ -70,9 +68,10 @@ print_context_label (char const *mark,
       char buf[INT_STRLEN_BOUND (int) + INT_STRLEN_BOUND (time_t)
 	       + sizeof "-%m-%d %H:%M:%S.000000000 +00"];
 
-      struct tm const *tm = localtime (&ts.tv_sec);
+      struct tm tmbuf;
+      struct tm const *tm = localtime_r (&ts.tv_sec, &tmbuf);
       int nsec = ts.tv_nsec;
-      if (tm && nstrftime (buf, sizeof buf, time_format, tm, localtz, nsec))
+      if (tm && nstrftime (buf, sizeof buf, format, tm, localtz, nsec))
 	fprintf (outfile, "%s %s\t%s", mark, name, buf);
       else if (TYPE_SIGNED (time_t))
         {
@@ -96,13 +95,17 @@ print_context_header (struct file_data inf[], char const *const *names, bool uni
 {
   if (unidiff)
     {
-      print_context_label ("---", &inf[0], names[0], file_label[0]);
-      print_context_label ("+++", &inf[1], names[1], file_label[1]);
+      print_context_label ("---", &inf[0], names[0], file_label[0],
+			   time_format);
+      print_context_label ("+++", &inf[1], names[1], file_label[1],
+			   time_format);
     }
   else
     {
-      print_context_label ("***", &inf[0], names[0], file_label[0]);
-      print_context_label ("---", &inf[1], names[1], file_label[1]);
+      print_context_label ("***", &inf[0], names[0], file_label[0],
+			   context_time_format);
+      print_context_label ("---", &inf[1], names[1], file_label[1],
+			   context_time_format);
     }
 }
 
@@ -111,15 +114,12 @@ print_context_header (struct file_data inf[], char const *const *names, bool uni
 void
 print_context_script (struct change *script, bool unidiff)
 {
-  if (ignore_blank_lines || ignore_regexp.fastmap)
+  if (ignore_blank_lines || ignore_regexp)
     mark_ignorable (script);
   else
     for (struct change *e = script; e; e = e->link)
       e->ignore = false;
 
-  find_function_last_search = - curr.file[0].prefix_lines;
-  find_function_last_match = LIN_MAX;
-
   if (unidiff)
     print_script (script, find_hunk, pr_unidiff_hunk);
   else
@@ -168,6 +168,18 @@ print_context_function (FILE *out, char const *function)
   fwrite (function + i, sizeof (char), j - i, out);
 }
 
+/* Print the N lines starting at LINE of a context diff, all flagged
+   with LINE_FLAG, in one run if possible.  Return the number of lines
+   printed.  */
+
+static lin
+print_context_run (char const *line_flag, char const *const *line, lin n)
+{
+  char prefix[] = { line_flag[0], initial_tab ? '\t' : ' ', '\0' };
+  char const *empty_prefix = line_flag[0] == ' ' ? "" : line_flag;
+  return print_line_run (prefix, empty_prefix, line, n);
+}
+
 /* Print a portion of an edit script in context format.
    HUNK is the beginning of the portion to be printed.
    The end is marked by a 'link' that has been nulled out.
@@ -200,8 +212,8 @@ pr_context_hunk (struct change *hunk)
 
   /* If desired, find the preceding function definition line in file 0.  */
   char const *function = nullptr;
-  if (function_regexp.fastmap)
-    function = find_function (curr.file[0].linbuf, first0);
+  if (function_regexp)
+    function = find_function (&curr.file[0], first0);
 
   begin_output ();
   FILE *out = outfile;
@@ -223,30 +235,39 @@ pr_context_hunk (struct change *hunk)
     {
       struct change *next = hunk;
 
-      for (lin i = first0; i <= last0; i++)
+      for (lin i = first0; i <= last0; )
         {
-          set_color_context (DELETE_CONTEXT);
-
           /* Skip past changes that apply (in file 0)
              only to lines before line I.  */
 
           while (next && next->line0 + next->deleted <= i)
             next = next->link;
 
-          /* Compute the marking for line I.  */
+          /* Compute the marking for line I, and find the end of the run
+             of lines with the same marking.  */
 
           char const *prefix = " ";
+          lin end = last0 + 1;
           if (next && next->line0 <= i)
             {
               /* The change NEXT covers this line.
                  If lines were inserted here in file 1, this is "changed".
                  Otherwise it is "deleted".  */
               prefix = (next->inserted > 0 ? "!" : "-");
+              end = MIN (end, next->line0 + next->deleted);
+            }
+          else if (next)
+            end = MIN (end, next->line0);
+
+          i += print_context_run (prefix, &curr.file[0].linbuf[i], end - i);
+          for (; i < end; i++)
+            {
+              set_color_context (DELETE_CONTEXT);
+	      print_1_line_nl (prefix, &curr.file[0].linbuf[i], true);
+              set_color_context (RESET_CONTEXT);
+	      if (curr.file[0].linbuf[i + 1][-1] == '\n')
+                putc ('\n', out);
             }
-	  print_1_line_nl (prefix, &curr.file[0].linbuf[i], true);
-          set_color_context (RESET_CONTEXT);
-	  if (curr.file[0].linbuf[i + 1][-1] == '\n')
-            putc ('\n', out);
         }
     }
 
@@ -261,30 +282,39 @@ pr_context_hunk (struct change *hunk)
     {
       struct change *next = hunk;
 
-      for (lin i = first1; i <= last1; i++)
+      for (lin i = first1; i <= last1; )
         {
-          set_color_context (ADD_CONTEXT);
-
           /* Skip past changes that apply (in file 1)
              only to lines before line I.  */
 
           while (next && next->line1 + next->inserted <= i)
             next = next->link;
 
-          /* Compute the marking for line I.  */
+          /* Compute the marking for line I, and find the end of the run
+             of lines with the same marking.  */
 
           char const *prefix = " ";
+          lin end = last1 + 1;
           if (next && next->line1 <= i)
             {
               /* The change NEXT covers this line.
                  If lines were deleted here in file 0, this is "changed".
                  Otherwise it is "inserted".  */
               prefix = (next->deleted > 0 ? "!" : "+");
+              end = MIN (end, next->line1 + next->inserted);
+            }
+          else if (next)
+            end = MIN (end, next->line1);
+
+          i += print_context_run (prefix, &curr.file[1].linbuf[i], end - i);
+          for (; i < end; i++)
+            {
+              set_color_context (ADD_CONTEXT);
+	      print_1_line_nl (prefix, &curr.file[1].linbuf[i], true);
+              set_color_context (RESET_CONTEXT);
+	      if (curr.file[1].linbuf[i + 1][-1] == '\n')
+                putc ('\n', out);
             }
-	  print_1_line_nl (prefix, &curr.file[1].linbuf[i], true);
-          set_color_context (RESET_CONTEXT);
-	  if (curr.file[1].linbuf[i + 1][-1] == '\n')
-            putc ('\n', out);
         }
     }
 }
@@ -343,8 +373,8 @@ pr_unidiff_hunk (struct change *hunk)
 
   /* If desired, find the preceding function definition line in file 0.  */
   char const *function = nullptr;
-  if (function_regexp.fastmap)
-    function = find_function (curr.file[0].linbuf, first0);
+  if (function_regexp)
+    function = find_function (&curr.file[0], first0);
 
   begin_output ();
   FILE *out = outfile;
@@ -373,6 +403,16 @@ pr_unidiff_hunk (struct change *hunk)
 
       if (!next || i < next->line0)
         {
+          lin n = print_line_run (initial_tab ? "\t" : " ", "",
+                                  &curr.file[0].linbuf[i],
+                                  (next ? next->line0 : last0 + 1) - i);
+          if (n)
+            {
+              i += n;
+              j += n;
+              continue;
+            }
+
 	  char const *const *line = &curr.file[0].linbuf[i++];
           if (! (suppress_blank_empty && **line == '\n'))
             putc (initial_tab ? '\t' : ' ', out);
@@ -383,7 +423,10 @@ pr_unidiff_hunk (struct change *hunk)
         {
           /* For each difference, first output the deleted part. */
 
-          lin k = next->deleted;
+          lin n = print_line_run (initial_tab ? "-\t" : "-", "-",
+                                  &curr.file[0].linbuf[i], next->deleted);
+          i += n;
+          lin k = next->deleted - n;
 
           while (k--)
             {
@@ -402,7 +445,10 @@ pr_unidiff_hunk (struct change *hunk)
 
           /* Then output the inserted part. */
 
-          k = next->inserted;
+          n = print_line_run (initial_tab ? "+\t" : "+", "+",
+                              &curr.file[1].linbuf[j], next->inserted);
+          j += n;
+          k = next->inserted - n;
 
           while (k--)
             {
@@ -486,18 +532,16 @@ mark_ignorable (struct change *script)
     }
 }
 
-/* Find the last function-header line in LINBUF prior to line number LINENUM.
-   This is a line containing a match for the regexp in 'function_regexp'.
-   Return the address of the text, or null if no function-header is found.  */
+/* Record in FILE's function index the function-header lines before
+   line number LINENUM that have not yet been looked for.  */
 
-static char const *
-find_function (char const *const *linbuf, lin linenum)
+static void
+scan_function_headings (struct file_data const *file, lin linenum)
 {
-  lin i = linenum;
-  lin last = find_function_last_search;
-  find_function_last_search = i;
+  struct function_index *fi = file->function_index;
+  char const *const *linbuf = file->linbuf;
 
-  while (last <= --i)
+  for (lin i = fi->scanned; i < linenum; i++)
     {
       /* See if this line is what we want.  */
       char const *line = linbuf[i];
@@ -507,16 +551,65 @@ find_function (char const *const *linbuf, lin linenum)
 	 to LEN = LINELEN and no machine code is generated.  */
       regoff_t len = MIN (linelen, TYPE_MAXIMUM (regoff_t));
 
-      if (0 <= re_search (&function_regexp, line, len, 0, len, nullptr))
-        {
-          find_function_last_match = i;
-          return line;
-        }
+      if (regexp_set_match (function_regexp, line, len))
+	{
+	  if (fi->count == fi->alloc)
+	    fi->lines = xpalloc (fi->lines, &fi->alloc, 1, -1,
+				 sizeof *fi->lines);
+	  fi->lines[fi->count++] = i;
+	}
+    }
+  fi->scanned = linenum;
+}
+
+/* Complete FILE's function index, so that find_function no longer
+   modifies it and can be called from several threads at once.  */
+
+void
+prepare_function_index (struct file_data const *file)
+{
+  if (file->function_index->scanned < file->valid_lines)
+    scan_function_headings (file, file->valid_lines);
+}
+
+/* Find the last function-header line in FILE prior to line number LINENUM.
+   This is a line containing a match for the regexp in 'function_regexp'.
+   Return the address of the text, or null if no function-header is found.
+
+   Hunks are output in order, so scan forward only as far as LINENUM,
+   recording each header line in FILE's function index.  Lines before
+   the scanned point are then looked up in the index without being
+   matched again, whatever the hunk or output format asking.  */
+
+static char const *
+find_function (struct file_data const *file, lin linenum)
+{
+  struct function_index const *fi = file->function_index;
+  if (fi->scanned < linenum)
+    scan_function_headings (file, linenum);
+
+  /* Find the number of header lines before LINENUM.  */
+  idx_t lo = 0, hi = fi->count;
+  while (lo < hi)
+    {
+      idx_t mid = lo + (hi - lo) / 2;
+      if (fi->lines[mid] < linenum)
+	lo = mid + 1;
+      else
+	hi = mid;
     }
-  /* If we search back to where we started searching the previous time,
-     find the line we found last time.  */
-  if (find_function_last_match != LIN_MAX)
-    return linbuf[find_function_last_match];
 
-  return nullptr;
+  return lo ? file->linbuf[fi->lines[lo - 1]] : nullptr;
+}
+
+/* Free the function index FI, which may be null.  */
+
+void
+free_function_index (struct function_index *fi)
+{
+  if (fi)
+    {
+      free (fi->lines);
+      free (fi);
+    }
 }
@@ -44,6 +44,7 @@
 #include <version-etc.h>
 #include <xalloc.h>
 #include <xstdopen.h>
+#include <xstrtol.h>
 
 #ifdef MAJOR_IN_MKDEV
 # include <sys/mkdev.h>
@@ -68,17 +69,9 @@ static char const PROGRAM_NAME[] = "diff";
 # define GUTTER_WIDTH_MINIMUM 3
 #endif
 
-struct regexp_list
-{
-  char *regexps;	/* chars representing disjunction of the regexps */
-  idx_t len;		/* chars used in 'regexps' */
-  idx_t size;		/* size malloc'ed for 'regexps'; 0 if not malloc'ed */
-  bool multiple_regexps;/* Does 'regexps' represent a disjunction?  */
-  struct re_pattern_buffer *buf;
-};
-
-static void add_regexp (struct regexp_list *, char const *);
-static void summarize_regexp_list (struct regexp_list *);
+static void add_extra_output (char const *);
+static void add_key_fields (char const *);
+static void specify_pairing (enum line_pairing);
 static void specify_style (enum output_style);
 static void specify_value (char const **, char const *, char const *);
 static void specify_colors_style (char const *);
@@ -89,12 +82,6 @@ static void usage (void);
    recursively.  */
 static bool recursive;
 
-/* In context diffs, show previous lines that match these regexps.  */
-static struct regexp_list function_regexp_list;
-
-/* Ignore changes affecting only lines that match these regexps.  */
-static struct regexp_list ignore_regexp_list;
-
 #if O_BINARY
 /* Use binary I/O when reading and writing data (--binary).
    On POSIX hosts, this has no effect.  */
@@ -125,27 +112,71 @@ static bool report_identical_files;
 
 /* Do not treat directories specially.  */
 static bool no_directory;
+
+/* The file that caches digests of file contents (--digest-cache),
+   or null if none.  */
+static char const *digest_cache_name;
+
+/* When to flush standard output after comparing files that differ:
+   after every such comparison if zero, only when its buffer fills if
+   negative, and otherwise when at least this many seconds have passed
+   since the previous flush (--flush).  */
+static intmax_t flush_interval;
+
+/* When standard output should next be flushed, if FLUSH_INTERVAL is
+   positive.  */
+static struct timespec next_flush;
+
+/* The size of the standard output buffer, or zero for the default
+   (--output-buffer).  */
+static idx_t output_buffer_size;
+
+/* Write standard output in a separate thread (--async-output).  */
+static bool async_output;
+
+/* True if some files compared so far differ.  Only the main thread
+   maintains this, as it matters only with --max-output-bytes, which
+   compares files one at a time.  */
+static bool some_files_differ;
 
 /* Values for long options that do not have single-letter equivalents.  */
 enum
 {
   BINARY_OPTION = CHAR_MAX + 1,
+  ASYNC_OUTPUT_OPTION,
+  DIGEST_CACHE_OPTION,
+  EXTRA_OUTPUT_OPTION,
+  FIELD_SEPARATOR_OPTION,
+  FLUSH_OPTION,
   FROM_FILE_OPTION,
+  FROM_MANIFEST_OPTION,
   HELP_OPTION,
   HORIZON_LINES_OPTION,
   IGNORE_FILE_NAME_CASE_OPTION,
+  INCLUDE_OPTION,
   INHIBIT_HUNK_MERGE_OPTION,
+  JOBS_OPTION,
+  KEY_FIELD_OPTION,
   LEFT_COLUMN_OPTION,
   LINE_FORMAT_OPTION,
+  MAX_HUNKS_OPTION,
+  MAX_OUTPUT_BYTES_OPTION,
   NO_DEREFERENCE_OPTION,
   NO_IGNORE_FILE_NAME_CASE_OPTION,
   NORMAL_OPTION,
+  NUMSTAT_OPTION,
+  OUTPUT_BUFFER_OPTION,
+  SAVE_MANIFEST_OPTION,
   SDIFF_MERGE_ASSIST_OPTION,
+  SORTED_OPTION,
+  STAT_OPTION,
   STRIP_TRAILING_CR_OPTION,
   SUPPRESS_BLANK_EMPTY_OPTION,
   SUPPRESS_COMMON_LINES_OPTION,
   TABSIZE_OPTION,
   TO_FILE_OPTION,
+  TO_MANIFEST_OPTION,
+  UNORDERED_OPTION,
 
   /* These options must be in sequence.  */
   UNCHANGED_LINE_FORMAT_OPTION,
@@ -184,17 +215,23 @@ static char const shortopts[] =
   "0123456789abBcC:dD:eEfF:hHiI:lL:nNpPqrsS:tTuU:vwW:x:X:yZ";
 static struct option const longopts[] =
 {
+  {"async-output", 0, 0, ASYNC_OUTPUT_OPTION},
   {"binary", 0, 0, BINARY_OPTION},
   {"brief", 0, 0, 'q'},
   {"changed-group-format", 1, 0, CHANGED_GROUP_FORMAT_OPTION},
   {"color", 2, 0, COLOR_OPTION},
   {"context", 2, 0, 'C'},
+  {"digest-cache", 1, 0, DIGEST_CACHE_OPTION},
   {"ed", 0, 0, 'e'},
   {"exclude", 1, 0, 'x'},
   {"exclude-from", 1, 0, 'X'},
   {"expand-tabs", 0, 0, 't'},
+  {"extra-output", 1, 0, EXTRA_OUTPUT_OPTION},
+  {"field-separator", 1, 0, FIELD_SEPARATOR_OPTION},
+  {"flush", 1, 0, FLUSH_OPTION},
   {"forward-ed", 0, 0, 'f'},
   {"from-file", 1, 0, FROM_FILE_OPTION},
+  {"from-manifest", 1, 0, FROM_MANIFEST_OPTION},
   {"help", 0, 0, HELP_OPTION},
   {"horizon-lines", 1, 0, HORIZON_LINES_OPTION},
   {"ifdef", 1, 0, 'D'},
@@ -206,11 +243,16 @@ static struct option const longopts[] =
   {"ignore-space-change", 0, 0, 'b'},
   {"ignore-tab-expansion", 0, 0, 'E'},
   {"ignore-trailing-space", 0, 0, 'Z'},
+  {"include", 1, 0, INCLUDE_OPTION},
   {"inhibit-hunk-merge", 0, 0, INHIBIT_HUNK_MERGE_OPTION},
   {"initial-tab", 0, 0, 'T'},
+  {"jobs", 1, 0, JOBS_OPTION},
+  {"key-field", 1, 0, KEY_FIELD_OPTION},
   {"label", 1, 0, 'L'},
   {"left-column", 0, 0, LEFT_COLUMN_OPTION},
   {"line-format", 1, 0, LINE_FORMAT_OPTION},
+  {"max-hunks", 1, 0, MAX_HUNKS_OPTION},
+  {"max-output-bytes", 1, 0, MAX_OUTPUT_BYTES_OPTION},
   {"minimal", 0, 0, 'd'},
   {"new-file", 0, 0, 'N'},
   {"new-group-format", 1, 0, NEW_GROUP_FORMAT_OPTION},
@@ -218,29 +260,36 @@ static struct option const longopts[] =
   {"no-dereference", 0, 0, NO_DEREFERENCE_OPTION},
   {"no-ignore-file-name-case", 0, 0, NO_IGNORE_FILE_NAME_CASE_OPTION},
   {"normal", 0, 0, NORMAL_OPTION},
+  {"numstat", 0, 0, NUMSTAT_OPTION},
   {"old-group-format", 1, 0, OLD_GROUP_FORMAT_OPTION},
   {"old-line-format", 1, 0, OLD_LINE_FORMAT_OPTION},
+  {"output-buffer", 1, 0, OUTPUT_BUFFER_OPTION},
   {"paginate", 0, 0, 'l'},
   {"palette", 1, 0, COLOR_PALETTE_OPTION},
   {"rcs", 0, 0, 'n'},
   {"recursive", 0, 0, 'r'},
   {"report-identical-files", 0, 0, 's'},
+  {"save-manifest", 1, 0, SAVE_MANIFEST_OPTION},
   {"sdiff-merge-assist", 0, 0, SDIFF_MERGE_ASSIST_OPTION},
   {"show-c-function", 0, 0, 'p'},
   {"show-function-line", 1, 0, 'F'},
   {"side-by-side", 0, 0, 'y'},
+  {"sorted", 0, 0, SORTED_OPTION},
   {"speed-large-files", 0, 0, 'H'},
   {"starting-file", 1, 0, 'S'},
+  {"stat", 0, 0, STAT_OPTION},
   {"strip-trailing-cr", 0, 0, STRIP_TRAILING_CR_OPTION},
   {"suppress-blank-empty", 0, 0, SUPPRESS_BLANK_EMPTY_OPTION},
   {"suppress-common-lines", 0, 0, SUPPRESS_COMMON_LINES_OPTION},
   {"tabsize", 1, 0, TABSIZE_OPTION},
   {"text", 0, 0, 'a'},
   {"to-file", 1, 0, TO_FILE_OPTION},
+  {"to-manifest", 1, 0, TO_MANIFEST_OPTION},
   {"unchanged-group-format", 1, 0, UNCHANGED_GROUP_FORMAT_OPTION},
   {"unchanged-line-format", 1, 0, UNCHANGED_LINE_FORMAT_OPTION},
   {"unidirectional-new-file", 0, 0, 'P'},
   {"unified", 2, 0, 'U'},
+  {"unordered", 0, 0, UNORDERED_OPTION},
   {"version", 0, 0, 'v'},
   {"width", 1, 0, 'W'},
 
@@ -252,10 +301,30 @@ static struct option const longopts[] =
   {0, 0, 0, 0}
 };
 
+/* Return the number of ARGV-elements, starting with ARG, that make up
+   an --extra-output option, or 0 if ARG does not start one.  */
+
+static int
+extra_output_option_length (char const *arg)
+{
+  if (! (arg[0] == '-' && arg[1] == '-'))
+    return 0;
+  arg += 2;
+  idx_t len = strcspn (arg, "=");
+
+  /* Any shorter abbreviation is ambiguous.  */
+  if (! (sizeof "ext" - 1 <= len && len <= sizeof "extra-output" - 1
+	 && memcmp (arg, "extra-output", len) == 0))
+    return 0;
+  return arg[len] ? 1 : 2;
+}
+
 /* Return a string containing the command options with which diff was invoked.
    Spaces appear between what were separate ARGV-elements.
    There is a space at the beginning but none at the end.
    If there were no options, the result is an empty string.
+   --extra-output options are omitted, as they say where output goes
+   rather than how to compare files.
 
    Arguments: OPTIONVEC, a vector containing separate ARGV-elements, and COUNT,
    the length of that vector.  */
@@ -267,6 +336,12 @@ option_list (char **optionvec, int count)
 
   for (int i = 0; i < count; i++)
     {
+      int skip = extra_output_option_length (optionvec[i]);
+      if (skip)
+	{
+	  i += skip - 1;
+	  continue;
+	}
       size_t optsize = 1 + shell_quote_length (optionvec[i]);
       if (ckd_add (&size, size, optsize))
 	xalloc_die ();
@@ -277,6 +352,12 @@ option_list (char **optionvec, int count)
 
   for (int i = 0; i < count; i++)
     {
+      int skip = extra_output_option_length (optionvec[i]);
+      if (skip)
+	{
+	  i += skip - 1;
+	  continue;
+	}
       *p++ = ' ';
       p = shell_quote_copy (p, optionvec[i]);
     }
@@ -286,13 +367,24 @@ option_list (char **optionvec, int count)
 }
 
 
-/* Return an option value suitable for add_exclude.  */
+/* Return an option value suitable for name_set_add.  */
 
 static int
 exclude_options (void)
 {
   return EXCLUDE_WILDCARDS | (ignore_file_name_case ? FNM_CASEFOLD : 0);
 }
+
+/* Add the pattern PATTERN with options OPTIONS to the patterns of file
+   names to be excluded.  This is add_exclude_file's callback, and the
+   gnulib exclude list EX is unused.  */
+
+static void
+add_excluded_pattern (MAYBE_UNUSED struct exclude *ex, char const *pattern,
+		      int options)
+{
+  name_set_add (&excluded, pattern, options);
+}
 
 int
 main (int argc, char **argv)
@@ -305,10 +397,7 @@ main (int argc, char **argv)
   bindtextdomain (PACKAGE, LOCALEDIR);
   textdomain (PACKAGE);
   c_stack_action (nullptr);
-  function_regexp_list.buf = &function_regexp;
-  ignore_regexp_list.buf = &ignore_regexp;
   re_set_syntax (RE_SYNTAX_GREP | RE_NO_POSIX_BACKTRACKING);
-  excluded = new_exclude ();
   presume_output_tty = false;
   xstdopen ();
 
@@ -320,6 +409,9 @@ main (int argc, char **argv)
   bool show_c_function = false;
   char const *from_file = nullptr;
   char const *to_file = nullptr;
+  char const *from_manifest = nullptr;
+  char const *to_manifest = nullptr;
+  char const *save_manifest_name = nullptr;
 
   for (int prev = -1, c;
        0 <= (c = getopt_long (argc, argv, shortopts, longopts, nullptr));
@@ -467,7 +559,7 @@ main (int argc, char **argv)
 	break;
 
       case 'F':
-	add_regexp (&function_regexp_list, optarg);
+	regexp_set_add (&function_regexp, optarg);
 	break;
 
       case 'h':
@@ -486,18 +578,20 @@ main (int argc, char **argv)
 	break;
 
       case 'I':
-	add_regexp (&ignore_regexp_list, optarg);
+	regexp_set_add (&ignore_regexp, optarg);
 	break;
 
       case 'l':
+#if !PAGINATE_INTERNALLY
 	if (!pr_program[0])
 	  try_help ("pagination not supported on this host", nullptr);
-	paginate = true;
-#ifdef SIGCHLD
+# ifdef SIGCHLD
 	/* Pagination requires forking and waiting, and
 	   System V fork+wait does not work if SIGCHLD is ignored.  */
 	signal (SIGCHLD, SIG_DFL);
+# endif
 #endif
+	paginate = true;
 	break;
 
       case 'L':
@@ -519,7 +613,7 @@ main (int argc, char **argv)
 
       case 'p':
 	show_c_function = true;
-	add_regexp (&function_regexp_list, "^[[:alpha:]$_]");
+	regexp_set_add (&function_regexp, "^[[:alpha:]$_]");
 	break;
 
       case 'P':
@@ -567,11 +661,11 @@ main (int argc, char **argv)
 	break;
 
       case 'x':
-	add_exclude (excluded, optarg, exclude_options ());
+	name_set_add (&excluded, optarg, exclude_options ());
 	break;
 
       case 'X':
-	if (add_exclude_file (add_exclude, excluded, optarg,
+	if (add_exclude_file (add_excluded_pattern, nullptr, optarg,
 			      exclude_options (), '\n'))
 	  pfatal_with_name (optarg);
 	break;
@@ -595,6 +689,14 @@ main (int argc, char **argv)
 	}
 	break;
 
+      case ASYNC_OUTPUT_OPTION:
+	async_output = true;
+	break;
+
+      case DIGEST_CACHE_OPTION:
+	digest_cache_name = optarg;
+	break;
+
       case BINARY_OPTION:
 #if O_BINARY
 	binary = true;
@@ -603,10 +705,35 @@ main (int argc, char **argv)
 #endif
 	break;
 
+      case FIELD_SEPARATOR_OPTION:
+	if (! optarg[0] || optarg[1])
+	  try_help ("invalid field separator %s", quote (optarg));
+	field_separator = optarg[0];
+	break;
+
+      case FLUSH_OPTION:
+	if (STREQ (optarg, "file"))
+	  flush_interval = 0;
+	else if (STREQ (optarg, "never"))
+	  flush_interval = -1;
+	else
+	  {
+	    char *numend;
+	    intmax_t numval = strtoimax (optarg, &numend, 10);
+	    if (numend == optarg || *numend || numval < 0)
+	      try_help ("invalid flush policy %s", quote (optarg));
+	    flush_interval = numval;
+	  }
+	break;
+
       case FROM_FILE_OPTION:
 	specify_value (&from_file, optarg, "--from-file");
 	break;
 
+      case FROM_MANIFEST_OPTION:
+	specify_value (&from_manifest, optarg, "--from-manifest");
+	break;
+
       case HELP_OPTION:
 	usage ();
 	check_stdout ();
@@ -626,11 +753,54 @@ main (int argc, char **argv)
 	ignore_file_name_case = true;
 	break;
 
+      case INCLUDE_OPTION:
+	name_set_add (&included, optarg, exclude_options ());
+	break;
+
       case INHIBIT_HUNK_MERGE_OPTION:
 	/* This option is obsolete, but accept it for backward
 	   compatibility.  */
 	break;
 
+      case JOBS_OPTION:
+	{
+	  char *numend;
+	  intmax_t numval = strtoimax (optarg, &numend, 10);
+	  if (numend == optarg || *numend || numval <= 0)
+	    try_help ("invalid number of jobs %s", quote (optarg));
+	  jobs = MIN (numval, INT_MAX);
+	}
+	break;
+
+      case MAX_HUNKS_OPTION:
+	{
+	  char *numend;
+	  intmax_t numval = strtoimax (optarg, &numend, 10);
+	  if (numend == optarg || *numend || numval <= 0)
+	    try_help ("invalid maximum number of hunks %s", quote (optarg));
+	  max_hunks = numval;
+	}
+	break;
+
+      case MAX_OUTPUT_BYTES_OPTION:
+	{
+	  intmax_t numval;
+	  if (xstrtoimax (optarg, nullptr, 10, &numval, "kKMGTPEZY0")
+	      != LONGINT_OK
+	      || numval <= 0)
+	    try_help ("invalid maximum output size %s", quote (optarg));
+	  if (!REPLACEABLE_STDOUT)
+	    try_help ("--max-output-bytes not supported on this host",
+		      nullptr);
+	  max_output_bytes = numval;
+	}
+	break;
+
+      case KEY_FIELD_OPTION:
+	add_key_fields (optarg);
+	specify_pairing (PAIR_KEYED);
+	break;
+
       case LEFT_COLUMN_OPTION:
 	left_column = true;
 	break;
@@ -653,11 +823,42 @@ main (int argc, char **argv)
 	specify_style (OUTPUT_NORMAL);
 	break;
 
+      case OUTPUT_BUFFER_OPTION:
+	{
+	  intmax_t numval;
+	  if (xstrtoimax (optarg, nullptr, 10, &numval, "kKMGTPEZY0")
+	      != LONGINT_OK
+	      || ! (0 < numval && numval <= MIN (IDX_MAX, SIZE_MAX)))
+	    try_help ("invalid output buffer size %s", quote (optarg));
+	  output_buffer_size = numval;
+	}
+	break;
+
+      case SAVE_MANIFEST_OPTION:
+	specify_value (&save_manifest_name, optarg, "--save-manifest");
+	break;
+
       case SDIFF_MERGE_ASSIST_OPTION:
 	specify_style (OUTPUT_SDIFF);
 	sdiff_merge_assist = true;
 	break;
 
+      case SORTED_OPTION:
+	specify_pairing (PAIR_SORTED);
+	break;
+
+      case STAT_OPTION:
+	specify_style (OUTPUT_STAT);
+	break;
+
+      case NUMSTAT_OPTION:
+	specify_style (OUTPUT_NUMSTAT);
+	break;
+
+      case EXTRA_OUTPUT_OPTION:
+	add_extra_output (optarg);
+	break;
+
       case STRIP_TRAILING_CR_OPTION:
 	strip_trailing_cr = true;
 	break;
@@ -690,6 +891,14 @@ main (int argc, char **argv)
 	specify_value (&to_file, optarg, "--to-file");
 	break;
 
+      case TO_MANIFEST_OPTION:
+	specify_value (&to_manifest, optarg, "--to-manifest");
+	break;
+
+      case UNORDERED_OPTION:
+	specify_pairing (PAIR_UNORDERED);
+	break;
+
       case UNCHANGED_LINE_FORMAT_OPTION:
       case OLD_LINE_FORMAT_OPTION:
       case NEW_LINE_FORMAT_OPTION:
@@ -746,22 +955,59 @@ main (int argc, char **argv)
         specify_style (OUTPUT_NORMAL);
     }
 
-  if (output_style != OUTPUT_CONTEXT || hard_locale (LC_TIME))
+  /* Set up the printers.  The analysis of each pair of files, which
+     they share, is brief only if all of them are.  */
+  if (!printers)
+    {
+      printer = xmalloc (sizeof *printer);
+      printers = 1;
+    }
+  printer[0] = (struct printer) { .style = output_style, .brief = brief };
+  comparison_style = output_style;
+  bool context_style = false, unified_style = false, line_style = false;
+  for (idx_t i = 0; i < printers; i++)
     {
+      struct printer const *p = &printer[i];
+      /* Lines paired regardless of order have no positions to show
+	 context at or to patch, so only a list of them makes sense.  */
+      if (line_pairing == PAIR_UNORDERED
+	  && ! (p->brief || p->style == OUTPUT_NORMAL
+		|| stat_output_style (p->style)))
+	try_help ("--unordered supports only normal, brief, --stat"
+		  " and --numstat output", nullptr);
+      if (! (p->brief || stat_output_style (p->style)))
+	{
+	  if (!line_style)
+	    comparison_style = p->style;
+	  else if (robust_output_style (p->style)
+		   != robust_output_style (comparison_style))
+	    try_help ("conflicting output style options", nullptr);
+	  line_style = true;
+	}
+      brief &= p->brief;
+      context_style |= p->style == OUTPUT_CONTEXT;
+      unified_style |= p->style == OUTPUT_UNIFIED;
+    }
+  if ((context_style | unified_style) && context < 3
+      && ! (output_style == OUTPUT_CONTEXT || output_style == OUTPUT_UNIFIED))
+    context = 3;
+  select_printer (nullptr);
+
+  /* Unified diffs use the ISO format for times, and so do context
+     diffs in locales with conventions of their own.  Otherwise
+     context diffs use the format of POSIX 1003.1-2017, even if they
+     go to an --extra-output file next to unified diffs.  */
 #if defined STAT_TIMESPEC || defined STAT_TIMESPEC_NS
-      time_format = "%Y-%m-%d %H:%M:%S.%N %z";
+  time_format = "%Y-%m-%d %H:%M:%S.%N %z";
 #else
-      time_format = "%Y-%m-%d %H:%M:%S %z";
+  time_format = "%Y-%m-%d %H:%M:%S %z";
 #endif
+  bool iso_context = hard_locale (LC_TIME);
+  context_time_format = iso_context ? time_format : "%a %b %e %T %Y";
 #if !HAVE_TM_GMTOFF
-      localtz = tzalloc (getenv ("TZ"));
+  if (! context_style || unified_style || iso_context)
+    localtz = tzalloc (getenv ("TZ"));
 #endif
-    }
-  else
-    {
-      /* See POSIX 1003.1-2017 for this format.  */
-      time_format = "%a %b %e %T %Y";
-    }
 
   if (0 <= ocontext
       && (output_style == OUTPUT_CONTEXT
@@ -772,8 +1018,23 @@ main (int argc, char **argv)
 
   if (! tabsize)
     tabsize = 8;
+  stat_width = width ? width : 80;
   if (! width)
     width = 130;
+  if (! field_separator)
+    field_separator = '\t';
+
+  /* Set up standard output as requested.  Nothing has been output
+     yet, so this is still allowed.  Output through a 'pr' subprocess
+     is not written asynchronously, as 'pr' shares standard output.  */
+  if (async_output && (PAGINATE_INTERNALLY || !paginate))
+    start_async_output (output_buffer_size);
+  else if (output_buffer_size
+	   && setvbuf (stdout, ximalloc (output_buffer_size), _IOFBF,
+		       output_buffer_size) != 0)
+    pfatal_with_name (_("standard output"));
+  if (max_output_bytes)
+    limit_output (max_output_bytes);
 
   {
     /* Maximize first the half line width, and then the gutter width,
@@ -800,8 +1061,10 @@ main (int argc, char **argv)
   if (horizon_lines < context)
     horizon_lines = context;
 
-  summarize_regexp_list (&function_regexp_list);
-  summarize_regexp_list (&ignore_regexp_list);
+  if (function_regexp)
+    regexp_set_finish (function_regexp);
+  if (ignore_regexp)
+    regexp_set_finish (ignore_regexp);
 
   if (output_style == OUTPUT_IFDEF)
     {
@@ -823,6 +1086,7 @@ main (int argc, char **argv)
 	  group_format[CHANGED] = p;
 	  strcpy (stpcpy (p, group_format[OLD]), group_format[NEW]);
 	}
+      compile_ifdef_formats ();
     }
 
   no_diff_means_no_output =
@@ -835,17 +1099,52 @@ main (int argc, char **argv)
   files_can_be_treated_as_binary =
     (brief & binary
      & ~ (ignore_blank_lines | ignore_case | strip_trailing_cr
-          | (ignore_regexp_list.regexps || ignore_white_space)));
+          | (ignore_regexp || ignore_white_space)
+          | ! ordered_pairing (line_pairing)));
 
   switch_string = option_list (argv + 1, optind - 1);
 
+  if (digest_cache_name)
+    digest_cache_load (digest_cache_name);
+
   int exit_status = EXIT_SUCCESS;
 
   noparent.file[0].desc = AT_FDCWD;
   noparent.file[1].desc = AT_FDCWD;
   static enum detype const de_unknowns[] = {DE_UNKNOWN, DE_UNKNOWN};
 
-  if (from_file)
+  char const *manifest = from_manifest ? from_manifest : to_manifest;
+  if (manifest || save_manifest_name)
+    {
+      /* A manifest stands for a tree, so only one operand remains.  */
+      if ((from_manifest && to_manifest) || (manifest && save_manifest_name)
+	  || from_file || to_file)
+	try_help ("conflicting manifest options", nullptr);
+      if (manifest && !brief)
+	try_help ("manifests can be compared only with --brief", nullptr);
+      if (new_file || unidirectional_new_file || report_identical_files
+	  || starting_file || file_label[0])
+	try_help ("option not supported with manifests", nullptr);
+      /* A manifest records digests of the files' bytes, which cannot
+	 tell whether lines differ only in ways that are ignored.  */
+      if (ignore_case || ignore_white_space || ignore_blank_lines
+	  || ignore_regexp || strip_trailing_cr
+	  || line_pairing != PAIR_SEQUENCE)
+	try_help ("option not supported with manifests", nullptr);
+      if (argc - optind != 1)
+	{
+	  if (argc - optind < 1)
+	    try_help ("missing operand after %s", quote (argv[argc - 1]));
+	  else
+	    try_help ("extra operand %s", quote (argv[optind + 1]));
+	}
+
+      exit_status = (save_manifest_name
+		     ? save_manifest (save_manifest_name, argv[optind])
+		     : compare_manifest (manifest, !from_manifest,
+					 argv[optind], recursive));
+    }
+  else if (from_file)
     {
       if (to_file)
         fatal ("--from-file and --to-file both specified");
@@ -883,6 +1182,16 @@ main (int argc, char **argv)
         }
     }
 
+  for (idx_t i = 0; i < printers; i++)
+    if (printer[i].style == OUTPUT_STAT)
+      print_stat_summary (&printer[i]);
+  for (idx_t i = 1; i < printers; i++)
+    if (ferror (printer[i].file) || fclose (printer[i].file) != 0)
+      pfatal_with_name (printer[i].name);
+
+  if (!digest_cache_save ())
+    exit_status = EXIT_TROUBLE;
+
   /* Print any messages that were saved up for last.  */
   print_message_queue ();
 
@@ -891,59 +1200,6 @@ main (int argc, char **argv)
   return exit_status;
 }
 
-/* Append to REGLIST the regexp PATTERN.  */
-
-static void
-add_regexp (struct regexp_list *reglist, char const *pattern)
-{
-  idx_t patlen = strlen (pattern);
-  char const *m = re_compile_pattern (pattern, patlen, reglist->buf);
-
-  if (m != 0)
-    error (EXIT_TROUBLE, 0, "%s: %s", squote (0, pattern), m);
-  else
-    {
-      char *regexps = reglist->regexps;
-      idx_t len = reglist->len;
-      bool multiple_regexps = reglist->multiple_regexps = regexps != 0;
-      idx_t newlen = reglist->len = len + 2 * multiple_regexps + patlen;
-      idx_t size = reglist->size;
-
-      if (size <= newlen)
-	regexps = reglist->regexps = xpalloc (regexps, &reglist->size,
-					      newlen - size + 1, -1, 1);
-      if (multiple_regexps)
-        {
-          regexps[len++] = '\\';
-          regexps[len++] = '|';
-        }
-      memcpy (regexps + len, pattern, patlen + 1);
-    }
-}
-
-/* Ensure that REGLIST represents the disjunction of its regexps.
-   This is done here, rather than earlier, to avoid O(N^2) behavior.  */
-
-static void
-summarize_regexp_list (struct regexp_list *reglist)
-{
-  if (reglist->regexps)
-    {
-      /* At least one regexp was specified.  Allocate a fastmap for it.  */
-      reglist->buf->fastmap = xmalloc (1 << CHAR_BIT);
-      if (reglist->multiple_regexps)
-        {
-          /* Compile the disjunction of the regexps.
-             (If just one regexp was specified, it is already compiled.)  */
-          char const *m = re_compile_pattern (reglist->regexps, reglist->len,
-                                              reglist->buf);
-          if (m)
-	    error (EXIT_TROUBLE, 0, "%s: %s",
-		   squote (0, reglist->regexps), m);
-        }
-    }
-}
-
 /* Get the value of errno after a system call fails,
    and help the compiler by telling it that errno is positive.  */
 static int
@@ -972,6 +1228,11 @@ static char const *const option_help_msgid[] = {
   N_("-e, --ed                      output an ed script"),
   N_("-n, --rcs                     output an RCS format diff"),
   N_("-y, --side-by-side            output in two columns"),
+  N_("    --stat                    output a histogram of changed lines per file"),
+  N_("    --numstat                 output counts of changed lines per file"),
+  N_("    --extra-output=STYLE:FILE also output in STYLE to FILE, where STYLE is\n"
+     "                                normal, brief, context, unified, ed,\n"
+     "                                forward-ed, rcs, stat or numstat"),
   N_("-W, --width=NUM               output at most NUM (default 130) print columns"),
   N_("    --left-column             output only the left column of common lines"),
   N_("    --suppress-common-lines   do not output common lines"),
@@ -985,7 +1246,7 @@ static char const *const option_help_msgid[] = {
   N_("-T, --initial-tab             make tabs line up by prepending a tab"),
   N_("    --tabsize=NUM             tab stops every NUM (default 8) print columns"),
   N_("    --suppress-blank-empty    suppress space or tab before empty output lines"),
-  N_("-l, --paginate                pass output through 'pr' to paginate it"),
+  N_("-l, --paginate                paginate output as 'pr' would"),
   "",
   N_("-r, --recursive                 recursively compare any subdirectories found"),
   N_("    --no-dereference            don't follow symbolic links"),
@@ -995,11 +1256,18 @@ static char const *const option_help_msgid[] = {
   N_("    --no-ignore-file-name-case  consider case when comparing file names"),
   N_("-x, --exclude=PAT               exclude files that match PAT"),
   N_("-X, --exclude-from=FILE         exclude files that match any pattern in FILE"),
+  N_("    --include=PAT               compare only dirs and files that match PAT"),
   N_("-S, --starting-file=FILE        start with FILE when comparing directories"),
   N_("    --from-file=FILE1           compare FILE1 to all operands;\n"
      "                                  FILE1 can be a directory"),
   N_("    --to-file=FILE2             compare all operands to FILE2;\n"
      "                                  FILE2 can be a directory"),
+  N_("    --save-manifest=FILE        save a manifest of the tree under the\n"
+     "                                  operand, a directory, to FILE"),
+  N_("    --from-manifest=FILE        with -q, compare the tree in manifest FILE\n"
+     "                                  to the operand, a directory"),
+  N_("    --to-manifest=FILE          with -q, compare the operand, a directory,\n"
+     "                                  to the tree in manifest FILE"),
   "",
   N_("-i, --ignore-case               ignore case differences in file contents"),
   N_("-E, --ignore-tab-expansion      ignore changes due to tab expansion"),
@@ -1047,6 +1315,23 @@ static char const *const option_help_msgid[] = {
   N_("-d, --minimal            try hard to find a smaller set of changes"),
   N_("    --horizon-lines=NUM  keep NUM lines of the common prefix and suffix"),
   N_("    --speed-large-files  assume large files and many scattered small changes"),
+  N_("    --sorted             assume both files are sorted, and merge them"),
+  N_("    --unordered          ignore the order of lines; output must be normal,\n"
+     "                           brief, --stat or --numstat"),
+  N_("    --key-field=LIST     compare records that have the same key fields;\n"
+     "                           LIST is like '1' or '1,3-4'"),
+  N_("    --field-separator=C  separate record fields with C (default TAB)"),
+  N_("    --flush=WHEN         when to flush output; WHEN is 'file' (after each pair\n"
+     "                           of files that differ, the default), 'never', or\n"
+     "                           a number of seconds between flushes"),
+  N_("    --output-buffer=SIZE\n"
+     "                         use an output buffer of SIZE bytes"),
+  N_("    --async-output       write output in a separate thread"),
+  N_("    --jobs=N             compare files and format output in N threads"),
+  N_("    --digest-cache=FILE  remember digests of file contents in FILE"),
+  N_("    --max-hunks=N        output at most N hunks for each pair of files"),
+  N_("    --max-output-bytes=SIZE\n"
+     "                         stop output after SIZE bytes"),
   N_("    --color[=WHEN]       color output; WHEN is 'never', 'always', or 'auto';\n"
      "                           plain --color means --color='auto'"),
   N_("    --palette=PALETTE    the colors to use when --color is active; PALETTE is\n"
@@ -1106,6 +1391,59 @@ specify_value (char const **var, char const *value, char const *option)
   *var = value;
 }
 
+/* Add a printer for --extra-output=STYLE:FILE, where ARG is
+   "STYLE:FILE".  */
+static void
+add_extra_output (char const *arg)
+{
+  static struct
+  {
+    char name[sizeof "forward-ed"];
+    enum output_style style;
+    bool brief;
+  } const styles[] =
+    {
+      {"normal", OUTPUT_NORMAL, false},
+      {"brief", OUTPUT_NORMAL, true},
+      {"context", OUTPUT_CONTEXT, false},
+      {"unified", OUTPUT_UNIFIED, false},
+      {"ed", OUTPUT_ED, false},
+      {"forward-ed", OUTPUT_FORWARD_ED, false},
+      {"rcs", OUTPUT_RCS, false},
+      {"stat", OUTPUT_STAT, false},
+      {"numstat", OUTPUT_NUMSTAT, false},
+    };
+  static idx_t printers_alloc;
+
+  char const *colon = strchr (arg, ':');
+  if (colon && colon[1])
+    for (int i = 0; i < sizeof styles / sizeof *styles; i++)
+      if (strlen (styles[i].name) == colon - arg
+	  && memcmp (styles[i].name, arg, colon - arg) == 0)
+	{
+	  char const *name = colon + 1;
+	  FILE *file = fopen (name, "w");
+	  if (!file)
+	    pfatal_with_name (name);
+
+	  /* Leave room for standard output's printer, which comes first.  */
+	  idx_t n = MAX (printers, 1);
+	  if (printers_alloc <= n)
+	    printer = xpalloc (printer, &printers_alloc, n + 1 - printers_alloc,
+			       -1, sizeof *printer);
+	  printer[n] = (struct printer) {
+	    .style = styles[i].style,
+	    .brief = styles[i].brief,
+	    .file = file,
+	    .name = name
+	  };
+	  printers = n + 1;
+	  return;
+	}
+
+  try_help ("invalid --extra-output argument %s", quote (arg));
+}
+
 /* Set the output style to STYLE, diagnosing conflicts.  */
 static void
 specify_style (enum output_style style)
@@ -1118,6 +1456,69 @@ specify_style (enum output_style style)
     }
 }
 
+/* Compare field ranges, for qsort.  */
+static int
+compare_field_ranges (void const *a, void const *b)
+{
+  struct field_range const *r = a;
+  struct field_range const *s = b;
+  return (r->lo > s->lo) - (r->lo < s->lo);
+}
+
+/* Add the fields in LIST, e.g., "1,3-4", to the key fields.  */
+static void
+add_key_fields (char const *list)
+{
+  static idx_t key_fields_alloc;
+  char const *p = list;
+
+  do
+    {
+      char *end;
+      intmax_t lo = strtoimax (p, &end, 10);
+      intmax_t hi = lo;
+      if (end != p && *end == '-')
+	{
+	  p = end + 1;
+	  hi = strtoimax (p, &end, 10);
+	}
+      if (end == p || lo <= 0 || hi < lo || IDX_MAX < hi
+	  || (*end && *end != ','))
+	try_help ("invalid key field list %s", quote (list));
+      if (key_field_ranges == key_fields_alloc)
+	key_fields = xpalloc (key_fields, &key_fields_alloc, 1, -1,
+			      sizeof *key_fields);
+      key_fields[key_field_ranges].lo = lo;
+      key_fields[key_field_ranges].hi = hi;
+      key_field_ranges++;
+      p = end + 1;
+    }
+  while (p[-1]);
+
+  /* Sort the ranges and merge any that overlap or abut.  */
+  qsort (key_fields, key_field_ranges, sizeof *key_fields,
+	 compare_field_ranges);
+  idx_t n = 0;
+  for (idx_t i = 0; i < key_field_ranges; i++)
+    if (n && key_fields[i].lo <= key_fields[n - 1].hi + 1)
+      key_fields[n - 1].hi = MAX (key_fields[n - 1].hi, key_fields[i].hi);
+    else
+      key_fields[n++] = key_fields[i];
+  key_field_ranges = n;
+}
+
+/* Set the line pairing to PAIRING, diagnosing conflicts.  */
+static void
+specify_pairing (enum line_pairing pairing)
+{
+  if (line_pairing != pairing)
+    {
+      if (line_pairing != PAIR_SEQUENCE)
+        try_help ("conflicting line pairing options", nullptr);
+      line_pairing = pairing;
+    }
+}
+
 /* Set the color mode.  */
 static void
 specify_colors_style (char const *value)
@@ -1132,6 +1533,24 @@ specify_colors_style (char const *value)
     try_help ("invalid color %s", quote (value));
 }
 
+/* Return true if standard output should be flushed after comparing
+   files that differ, according to --flush.  */
+bool
+flush_due (void)
+{
+  if (flush_interval <= 0)
+    return flush_interval == 0;
+
+  struct timespec now;
+  timespec_get (&now, TIME_UTC);
+  if (timespec_cmp (now, next_flush) < 0)
+    return false;
+  if (ckd_add (&next_flush.tv_sec, now.tv_sec, flush_interval))
+    next_flush.tv_sec = TYPE_MAXIMUM (time_t);
+  next_flush.tv_nsec = now.tv_nsec;
+  return true;
+}
+
 
 /* True if PCMP's file F is a directory.  */
 static bool
@@ -1307,12 +1726,19 @@ compare_prepped_files (struct comparison const *parent,
       return EXIT_FAILURE;
     }
 
+  /* The digest cache may tell whether regular files of the same size
+     have the same contents, without reading them.  */
+  int cached = digest_cache_compare (cmp->file);
+  if (cached == 0 && no_diff_means_no_output)
+    return EXIT_SUCCESS;
+
   if (files_can_be_treated_as_binary
       && S_ISREG (cmp->file[0].stat.st_mode)
       && S_ISREG (cmp->file[1].stat.st_mode)
-      && cmp->file[0].stat.st_size != cmp->file[1].stat.st_size
-      && 0 <= cmp->file[0].stat.st_size
-      && 0 <= cmp->file[1].stat.st_size)
+      && (0 < cached
+	  || (cmp->file[0].stat.st_size != cmp->file[1].stat.st_size
+	      && 0 <= cmp->file[0].stat.st_size
+	      && 0 <= cmp->file[1].stat.st_size)))
     {
       message ("Files %s and %s differ\n",
 	       file_label[0] ? file_label[0] : squote (0, cmp->file[0].name),
@@ -1374,6 +1800,12 @@ compare_files (struct comparison const *parent, enum detype const detype[2],
                char const *name0,
                char const *name1)
 {
+  /* Once standard output has been cut short after some files were
+     found to differ, comparing more files cannot change the exit
+     status, except by finding trouble; do not bother.  */
+  if (output_truncated && some_files_differ && printers == 1)
+    return EXIT_FAILURE;
+
   /* If this is directory comparison, perhaps we have a file
      that exists only in one of the directories.
      If so, just print a message to that effect.  */
@@ -1390,6 +1822,8 @@ compare_files (struct comparison const *parent, enum detype const detype[2],
 
       /* Return EXIT_FAILURE so that diff_dirs will return
          EXIT_FAILURE ("some files differ").  */
+      if (!worker_thread)
+	some_files_differ = true;
       return EXIT_FAILURE;
     }
 
@@ -1428,6 +1862,9 @@ compare_files (struct comparison const *parent, enum detype const detype[2],
   int oflags = ((binary ? O_BINARY : 0) | O_CLOEXEC
 		| (no_dereference_symlinks ? O_NOFOLLOW : 0));
 
+  /* Whether each file was opened in advance by diff_dirs.  */
+  bool prefetched[2] = { false, false };
+
   /* Stat the files if needed, possibly opening them first if that is
      safe or will be done anyway.  */
 
@@ -1456,6 +1893,13 @@ compare_files (struct comparison const *parent, enum detype const detype[2],
 	  if (binary && ! isatty (fd))
 	    set_binary_mode (fd, O_BINARY);
 	}
+      else if (!toplevel && detype[f] == DE_REG
+	       && take_prefetched_file (parent, f, f ? name1 : name0,
+					&cmp.file[f]))
+	{
+	  fd = cmp.file[f].desc;
+	  prefetched[f] = true;
+	}
       else if (toplevel || detype[f] == DE_REG || detype[f] == DE_DIR
 	       || (O_PATH_DEFINED && detype[f] == DE_LNK
 		   && no_dereference_symlinks))
@@ -1505,10 +1949,11 @@ compare_files (struct comparison const *parent, enum detype const detype[2],
 	     || err == ENOENT || err == ENOTDIR || err == ELOOP
 	     || err == EOVERFLOW || err == ENAMETOOLONG))
 	{
-	  if ((fd < 0
-	       ? fstatat (parentdesc, nm, &cmp.file[f].stat,
-			  no_dereference_symlinks ? AT_SYMLINK_NOFOLLOW : 0)
-	       : fstat (fd, &cmp.file[f].stat))
+	  if (!prefetched[f]
+	      && (fd < 0
+		  ? fstatat (parentdesc, nm, &cmp.file[f].stat,
+			     no_dereference_symlinks ? AT_SYMLINK_NOFOLLOW : 0)
+		  : fstat (fd, &cmp.file[f].stat))
 	      < 0)
 	    err = get_errno ();
 	  else
@@ -1613,9 +2058,10 @@ compare_files (struct comparison const *parent, enum detype const detype[2],
   if (status == EXIT_SUCCESS)
     status = compare_prepped_files (parent, &cmp, O_RDONLY | oflags);
 
-  /* Close any input files.  */
+  /* Close any input files.  Files opened in advance are closed later,
+     with others.  */
   for (int f = 0; f < 2; f++)
-    if ((f == 0 || cmp.file[f].desc != cmp.file[0].desc)
+    if ((f == 0 || cmp.file[f].desc != cmp.file[0].desc) && !prefetched[f]
 	&& (cmp.file[f].dirstream ? closedir (cmp.file[f].dirstream) < 0
 	    : 0 <= cmp.file[f].desc && close (cmp.file[f].desc) < 0))
       {
@@ -1626,6 +2072,9 @@ compare_files (struct comparison const *parent, enum detype const detype[2],
   /* Now the comparison has been done, if no error prevented it,
      and STATUS is the value this function will return.  */
 
+  if (status == EXIT_FAILURE && !worker_thread)
+    some_files_differ = true;
+
   if (status == EXIT_SUCCESS)
     {
       if (report_identical_files && !dir_p (&cmp, 0))
@@ -1634,10 +2083,11 @@ compare_files (struct comparison const *parent, enum detype const detype[2],
 	   file_label[0] ? file_label[0] : squote (0, cmp.file[0].name),
 	   file_label[1] ? file_label[1] : squote (1, cmp.file[1].name));
     }
-  else
+  else if (!output_segment && flush_due ())
     {
       /* Flush stdout so that the user sees differences immediately.
-         This can hurt performance, unfortunately.  */
+         This can hurt performance, unfortunately, so --flush can
+         ask for fewer flushes.  */
       if (fflush (stdout) != 0)
         pfatal_with_name (_("standard output"));
     }
@@ -91,7 +91,13 @@ enum output_style
   OUTPUT_IFDEF,
 
   /* Output sdiff style (-y).  */
-  OUTPUT_SDIFF
+  OUTPUT_SDIFF,
+
+  /* Output a histogram of changed lines per file (--stat).  */
+  OUTPUT_STAT,
+
+  /* Output counts of changed lines per file (--numstat).  */
+  OUTPUT_NUMSTAT
 };
 
 /* True for output styles that are robust,
@@ -102,7 +108,56 @@ DIFF_INLINE bool robust_output_style (enum output_style s)
   return s != OUTPUT_ED && s != OUTPUT_FORWARD_ED;
 }
 
-XTERN enum output_style output_style;
+/* True for output styles that summarize changes rather than output
+   the changed lines.  */
+DIFF_INLINE bool stat_output_style (enum output_style s)
+{
+  return s == OUTPUT_STAT || s == OUTPUT_NUMSTAT;
+}
+
+XTERN thread_local enum output_style output_style;
+
+/* The output style that files are compared for.  This is the style
+   of the first printer that outputs changed lines, if any.  */
+XTERN enum output_style comparison_style;
+
+/* How to pair up the lines of the two files.  */
+enum line_pairing
+{
+  /* Find a minimal edit script; this is the default.  */
+  PAIR_SEQUENCE,
+
+  /* Merge two files that are both sorted (--sorted).  */
+  PAIR_SORTED,
+
+  /* Pair lines regardless of their order (--unordered).  */
+  PAIR_UNORDERED,
+
+  /* Pair records that have the same key fields (--key-field).  */
+  PAIR_KEYED
+};
+
+/* True for line pairings under which files with the same lines
+   in a different order differ.  */
+DIFF_INLINE bool ordered_pairing (enum line_pairing p)
+{
+  return p == PAIR_SEQUENCE || p == PAIR_SORTED;
+}
+
+XTERN enum line_pairing line_pairing;
+
+/* The fields of a record that form its key, for --key-field.
+   KEY_FIELDS is an array of KEY_FIELD_RANGES ranges of 1-origin
+   field numbers, sorted and not overlapping.  */
+struct field_range
+{
+  idx_t lo, hi;
+};
+XTERN struct field_range *key_fields;
+XTERN idx_t key_field_ranges;
+
+/* The byte that separates the fields of a record (--field-separator).  */
+XTERN char field_separator;
 
 /* Define the current color context used to print a line.  */
 XTERN enum colors_style colors_style;
@@ -173,11 +228,12 @@ XTERN timezone_t localtz;
 /* File labels for '-c' output headers (--label).  */
 XTERN char *file_label[2];
 
-/* Regexp to identify function-header lines (-F).  */
-XTERN struct re_pattern_buffer function_regexp;
+/* Regexps to identify function-header lines (-F), or null if none.  */
+XTERN struct regexp_set *function_regexp;
 
-/* Ignore changes that affect only lines matching this regexp (-I).  */
-XTERN struct re_pattern_buffer ignore_regexp;
+/* Ignore changes that affect only lines matching these regexps (-I),
+   or null if none.  */
+XTERN struct regexp_set *ignore_regexp;
 
 /* Say only whether files differ, not how (-q).  */
 XTERN bool brief;
@@ -223,6 +279,9 @@ XTERN bool left_column;
 /* Tell OUTPUT_SDIFF to not show common lines.  */
 XTERN bool suppress_common_lines;
 
+/* The line width for OUTPUT_STAT.  */
+XTERN intmax_t stat_width;
+
 /* The half line width and column 2 offset for OUTPUT_SDIFF.  */
 XTERN intmax_t sdiff_half_width;
 XTERN intmax_t sdiff_column2_offset;
@@ -237,14 +296,45 @@ XTERN char *switch_string;
 XTERN bool speed_large_files;
 
 /* Patterns that match file names to be excluded.  */
-XTERN struct exclude *excluded;
+XTERN struct name_set *excluded;
+
+/* If not null, patterns that match the names of the files other than
+   directories that are to be compared; all other files are excluded.  */
+XTERN struct name_set *included;
 
 /* Don't discard lines.  This makes things slower (sometimes much
    slower) but will find a guaranteed minimal set of changes.  */
 XTERN bool minimal;
 
-/* The strftime format to use for time strings.  */
+/* The strftime formats to use for time strings in the headers of
+   unified and of context diffs.  */
 XTERN char const *time_format;
+XTERN char const *context_time_format;
+
+/* The number of threads that may compare files and format output
+   (--jobs).  */
+XTERN int jobs;
+
+/* True in threads other than the main one, which compare files or
+   format output in parallel for --jobs.  Such threads leave signals,
+   and flushing standard output, to the main thread.  */
+XTERN thread_local bool worker_thread;
+
+/* If nonnull, the stream that takes the place of standard output in
+   this thread while files are compared in parallel.  Its contents are
+   copied to standard output in the order of a sequential comparison.  */
+XTERN thread_local FILE *output_segment;
+
+/* The maximum number of hunks to output for each pair of files, or
+   zero for no maximum (--max-hunks).  */
+XTERN intmax_t max_hunks;
+
+/* The maximum number of bytes to output to standard output, or zero
+   for no maximum (--max-output-bytes).  */
+XTERN intmax_t max_output_bytes;
+
+/* True if standard output has been cut short by --max-output-bytes.  */
+XTERN bool output_truncated;
 
 /* The result of comparison is an "edit script": a chain of 'struct change'.
    Each 'struct change' represents one place where some lines are deleted
@@ -362,6 +452,30 @@ struct file_data {
     /* 1 more than the maximum equivalence value used for this or its
        sibling file.  */
     lin equiv_max;
+
+    /* Vector shared with the sibling file, indexed by equivalence class,
+       caching whether the lines of each class can be ignored because of
+       -B or -I: positive if they can, negative if they cannot, and zero
+       if not yet known.  Null if there is nothing to cache, or if lines
+       in the same class need not have the same answer.  */
+    signed char *ignorable;
+
+    /* Index of the lines matching -F or -p, or null if there is
+       no such option or this is not the first file.  */
+    struct function_index *function_index;
+};
+
+/* The lines of a file that match -F or -p, found by scanning
+   forward on demand and kept so that each lookup is a binary search.  */
+struct function_index
+{
+  /* Numbers of the matching lines in increasing order, and the
+     number of elements used and allocated.  */
+  lin *lines;
+  idx_t count, alloc;
+
+  /* Every line before this one has been scanned.  */
+  lin scanned;
 };
 
 /* struct file_data.desc markers.
@@ -382,9 +496,19 @@ struct comparison
     struct comparison const *parent;
   };
 
+/* A pair of directory entries with the same name, one in each of the
+   directories being compared.  A null name means that the entry is
+   missing from that directory.  */
+
+struct name_pair
+  {
+    char const *name[2];
+    enum detype detype[2];
+  };
+
 /* Describe the two files currently being compared.  */
 
-XTERN struct comparison curr;
+XTERN thread_local struct comparison curr;
 
 /* A placeholder for the parent of the top level comparison.
    Only the desc slots are used; although they are typically AT_FDCWD,
@@ -393,9 +517,39 @@ XTERN struct comparison curr;
 
 XTERN struct comparison noparent;
 
-/* Stdio stream to output diffs to.  */
+/* Stdio stream to output diffs to.  Threads that format parts of
+   the output in parallel each have their own.  */
+
+XTERN thread_local FILE *outfile;
+
+/* An output style and where output in that style goes.  Standard
+   output comes first, in the style given by the usual options, and is
+   followed by the files given by --extra-output.  All of them share a
+   single comparison of each pair of files.  */
+
+struct printer
+{
+  /* The output style, and whether to say only whether files differ.  */
+  enum output_style style;
+  bool brief;
+
+  /* The output file and its name, or null for standard output.  */
+  FILE *file;
+  char const *name;
+
+  /* The rows of the --stat table, if STYLE is OUTPUT_STAT.  */
+  struct stat_entry *stat_entries;
+  idx_t stat_entries_used, stat_entries_alloc;
+};
 
-XTERN FILE *outfile;
+/* Threads that compare files in parallel each have a printer of their
+   own, so that they can build --stat tables of their own.  */
+XTERN thread_local struct printer *printer;
+XTERN idx_t printers;
+
+/* The printer whose output is being generated, or null while
+   comparing files.  */
+XTERN thread_local struct printer *current_printer;
 
 /* Declare various functions.  */
 
@@ -406,38 +560,87 @@ extern int diff_2_files (struct comparison *);
 extern void print_context_header (struct file_data[],
 				  char const *const *, bool);
 extern void print_context_script (struct change *, bool);
+extern void free_function_index (struct function_index *);
+extern void prepare_function_index (struct file_data const *);
 
 /* diff.c */
+extern bool flush_due (void);
 extern int compare_files (struct comparison const *, enum detype const[2],
 			  char const *, char const *);
 
+/* filter.c */
+extern char *fold_file_name (char *, char const *, idx_t);
+extern void name_set_add (struct name_set **, char const *, int);
+extern bool name_set_match (struct name_set const *, char const *);
+
+/* digest.c */
+extern void digest_cache_load (char const *);
+extern int digest_cache_compare (struct file_data const[2]);
+extern struct sha256_ctx *digest_cache_start (struct file_data const[2]);
+extern void digest_cache_add (struct sha256_ctx *, char const *, idx_t);
+extern void digest_cache_finish (struct sha256_ctx *,
+				 struct file_data const[2], bool);
+extern bool digest_cache_save (void);
+
 /* dir.c */
 extern int diff_dirs (struct comparison *);
+extern FILE *std_output (void);
 extern char *find_dir_file_pathname (struct file_data *, char const *,
 				     enum detype *)
   ATTRIBUTE_MALLOC ATTRIBUTE_DEALLOC_FREE
   ATTRIBUTE_RETURNS_NONNULL;
+extern struct name_pair *pair_dir_entries (int, struct file_data *, int,
+					   char const **, idx_t, idx_t *,
+					   char **);
 
 /* ed.c */
 extern void print_ed_script (struct change *);
 extern void pr_forward_ed_script (struct change *);
 
 /* ifdef.c */
+extern void compile_ifdef_formats (void);
 extern void print_ifdef_script (struct change *);
 
 /* io.c */
 extern void file_block_read (struct file_data *, idx_t);
 extern bool read_files (struct file_data[], bool);
 
+/* manifest.c */
+extern int save_manifest (char const *, char const *);
+extern int compare_manifest (char const *, int, char const *, bool);
+
+/* match.c */
+extern void regexp_set_add (struct regexp_set **, char const *);
+extern void regexp_set_finish (struct regexp_set *);
+extern bool regexp_set_match (struct regexp_set *, char const *, idx_t);
+extern bool self_synchronizing_encoding (void);
+
 /* normal.c */
 extern void print_normal_script (struct change *);
 
+/* prefetch.c */
+extern idx_t prefetch_files (struct comparison const *,
+			     struct name_pair const *, idx_t, int *);
+extern void end_prefetch (int *);
+extern bool take_prefetched_file (struct comparison const *, int,
+				  char const *, struct file_data *);
+extern bool take_prefetched_data (struct file_data *);
+
 /* rcs.c */
 extern void print_rcs_script (struct change *);
 
 /* side.c */
 extern void print_sdiff_script (struct change *);
 
+/* stat.c */
+extern void print_stat_script (struct change *, struct file_data const[]);
+extern void print_binary_stat (struct file_data const[]);
+extern void print_stat_summary (struct printer *);
+extern void move_stat_entries (struct printer *, struct printer *);
+
+/* stream.c */
+extern int stream_one_side (struct comparison *);
+
 /* util.c */
 extern char const change_letter[4];
 extern char const pr_program[];
@@ -450,18 +653,26 @@ extern void cleanup_signal_handlers (void);
 extern void debug_script (struct change *);
 extern _Noreturn void fatal (char const *);
 extern void finish_output (void);
+extern bool ignorable_line (struct file_data const *, lin);
 extern void message (char const *, ...) ATTRIBUTE_FORMAT ((printf, 1, 2));
+extern void message_here (char const *, ...)
+  ATTRIBUTE_FORMAT ((printf, 1, 2));
 extern void output_1_line (char const *, char const *, char const *,
                            char const *);
+extern bool output_cut_short (void);
 extern void perror_with_name (char const *);
 extern _Noreturn void pfatal_with_name (char const *);
 extern void print_1_line (char const *, char const *const *);
 extern void print_1_line_nl (char const *, char const *const *, bool);
+extern lin print_line_run (char const *, char const *,
+			   char const *const *, lin);
 extern void print_message_queue (void);
 extern void print_number_range (char, struct file_data *, lin, lin);
-extern void print_script (struct change *, struct change * (*) (struct change *),
+extern bool print_script (struct change *, struct change * (*) (struct change *),
                           void (*) (struct change *));
+extern void select_printer (struct printer *);
 extern void setup_output (char const *, char const *, bool);
+extern int text_width (char const *) ATTRIBUTE_PURE;
 extern void translate_range (struct file_data const *, lin, lin, lin *, lin *);
 
 enum color_context
@@ -478,4 +689,22 @@ XTERN bool presume_output_tty;
 extern void set_color_context (enum color_context color_context);
 extern void set_color_palette (char const *palette);
 
+/* paginate.c */
+#if HAVE_FOPENCOOKIE
+# define PAGINATE_INTERNALLY 1
+#else
+# define PAGINATE_INTERNALLY 0
+#endif
+extern FILE *open_paginated_output (char const *);
+
+/* writer.c */
+#if HAVE_FOPENCOOKIE && HAVE_ASSIGNABLE_STDOUT
+# define REPLACEABLE_STDOUT 1
+#else
+# define REPLACEABLE_STDOUT 0
+#endif
+extern void start_async_output (idx_t);
+extern void limit_output (intmax_t);
+extern bool output_limit_near (void);
+
 _GL_INLINE_HEADER_END
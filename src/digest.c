@@ -0,0 +1,415 @@
+/* Cache of file content digests for GNU DIFF.
+
+   Copyright (C) 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* With --digest-cache=FILE, diff remembers in FILE the SHA-256 digest
+   of each regular file that it has read in full and found equal to
+   another file, keyed by the file's device and inode numbers, size,
+   and modification and status change times.  A later run that finds
+   fresh entries for both files of a pair, that is, entries whose keys
+   match the files' current status, need not read the files: equal
+   digests mean equal contents, and different digests mean different
+   contents.  Any change to a file's contents changes its status change
+   time, and so makes its entry stale.
+
+   An entry is recorded only if the file's times are comfortably older
+   than the start of the run, so that a change made while the file is
+   being read, within the resolution of the file system's timestamps,
+   cannot go unnoticed.  Stale entries are dropped, and entries that do
+   not parse or whose check digits do not match are ignored.  The cache
+   is replaced by renaming a new file over it, so that concurrent runs
+   never see a partly written cache; the last one to finish wins.  */
+
+#include "diff.h"
+
+#include <diagnose.h>
+#include <error.h>
+#include <sha256.h>
+#include <stat-time.h>
+#include <timespec.h>
+#include <xalloc.h>
+
+#include <pthread.h>
+
+/* The first line of a digest cache.  */
+static char const digest_cache_header[] = "GNU diff digest cache 1\n";
+
+/* An entry is recorded only if the file's times are at least this many
+   seconds before the start of the run.  This allows for file systems
+   whose timestamps have a resolution as coarse as two seconds.  */
+enum { DIGEST_CACHE_SLACK = 2 };
+
+/* The number of hexadecimal check digits at the end of each entry.  */
+enum { CHECK_DIGITS = 8 };
+
+/* The digest of a file's contents, and the file's status when the
+   digest was computed.  */
+struct digest_entry
+{
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime, ctime;
+  unsigned char digest[SHA256_DIGEST_SIZE];
+
+  /* Whether this slot holds an entry, and whether that entry is known
+     to be stale and is not to be saved.  */
+  bool used, stale;
+};
+
+/* The name of the cache, or null if there is none.  */
+static char const *cache_name;
+
+/* The time the cache was loaded.  */
+static struct timespec cache_start;
+
+/* A hash table of entries keyed by device and inode number, using open
+   addressing.  The number of slots is zero or a power of two, and at
+   least one slot is unused.  */
+static struct digest_entry *slot;
+static idx_t slots, slots_used;
+
+/* Whether the cache has changed since it was loaded.  */
+static bool cache_changed;
+
+/* Lock for the above, as files may be compared in several threads.  */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return the slot for the file with device DEV and inode INO.  */
+
+static struct digest_entry *
+entry_slot (dev_t dev, ino_t ino)
+{
+  size_t mask = slots - 1;
+  size_t h = (size_t) ino * 31 + (size_t) dev;
+  for (size_t i = (h ^ (h >> 15)) & mask; ; i = (i + 1) & mask)
+    if (!slot[i].used || (slot[i].dev == dev && slot[i].ino == ino))
+      return &slot[i];
+}
+
+/* Put the entry E into the table, replacing any entry for its file.  */
+
+static void
+put_entry (struct digest_entry const *e)
+{
+  if (slots <= 2 * slots_used + 1)
+    {
+      struct digest_entry *old = slot;
+      idx_t old_slots = slots;
+      slots = old_slots ? 2 * old_slots : 1024;
+      slot = xicalloc (slots, sizeof *slot);
+      for (idx_t i = 0; i < old_slots; i++)
+	if (old[i].used)
+	  *entry_slot (old[i].dev, old[i].ino) = old[i];
+      free (old);
+    }
+
+  struct digest_entry *s = entry_slot (e->dev, e->ino);
+  slots_used += !s->used;
+  *s = *e;
+  s->used = true;
+}
+
+/* Store into CHECK the check digits of the entry text LINE, of length
+   LEN, followed by a null byte.  */
+
+static void
+check_digits (char check[CHECK_DIGITS + 1], char const *line, idx_t len)
+{
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  sha256_buffer (line, len, digest);
+  for (int i = 0; i < CHECK_DIGITS / 2; i++)
+    sprintf (check + 2 * i, "%02x", digest[i]);
+}
+
+/* Add the entry in LINE, of length LEN and without its newline, to the
+   table.  Return true if the entry is valid, false if it is ignored.  */
+
+static bool
+load_entry (char const *line, idx_t len)
+{
+  uintmax_t dev, ino;
+  intmax_t size, msec, csec;
+  long int mnsec, cnsec;
+  char hex[2 * SHA256_DIGEST_SIZE + 1];
+  char check[CHECK_DIGITS + 1];
+  int checked_len = -1, n = -1;
+  if (sscanf (line,
+	      "%ju %ju %jd %jd.%9ld %jd.%9ld %64[0-9a-f] %n%8[0-9a-f]%n",
+	      &dev, &ino, &size, &msec, &mnsec, &csec, &cnsec, hex,
+	      &checked_len, check, &n) != 9
+      || n != len || checked_len != len - CHECK_DIGITS
+      || strlen (hex) != 2 * SHA256_DIGEST_SIZE
+      || ! (0 <= mnsec && mnsec < TIMESPEC_HZ
+	    && 0 <= cnsec && cnsec < TIMESPEC_HZ))
+    return false;
+
+  char expected[CHECK_DIGITS + 1];
+  check_digits (expected, line, checked_len);
+  if (!STREQ (check, expected))
+    return false;
+
+  struct digest_entry e = {
+    .dev = dev, .ino = ino, .size = size,
+    .mtime = { .tv_sec = msec, .tv_nsec = mnsec },
+    .ctime = { .tv_sec = csec, .tv_nsec = cnsec }
+  };
+  if (e.dev != dev || e.ino != ino || e.size != size || e.size < 0
+      || e.mtime.tv_sec != msec || e.ctime.tv_sec != csec)
+    return false;
+  for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+    {
+      unsigned int byte;
+      sscanf (hex + 2 * i, "%2x", &byte);
+      e.digest[i] = byte;
+    }
+  put_entry (&e);
+  return true;
+}
+
+/* Use the digest cache FILE, loading it if it exists.  */
+
+void
+digest_cache_load (char const *file)
+{
+  cache_name = file;
+  timespec_get (&cache_start, TIME_UTC);
+
+  FILE *f = fopen (file, "r");
+  if (!f)
+    {
+      if (errno != ENOENT)
+	pfatal_with_name (file);
+      return;
+    }
+
+  /* Refuse to replace a file that is not a digest cache.  Rewrite the
+     cache if anything in it is ignored.  */
+  char *line = nullptr;
+  size_t linesize = 0;
+  ssize_t len = getline (&line, &linesize, f);
+  if (0 < len && !STREQ (line, digest_cache_header))
+    error (EXIT_TROUBLE, 0, _("%s: not a digest cache"), squote (0, file));
+  cache_changed = len <= 0;
+  while (0 < (len = getline (&line, &linesize, f)))
+    {
+      bool newline = line[len - 1] == '\n';
+      line[len - newline] = '\0';
+      if (! (newline && load_entry (line, len - newline)))
+	cache_changed = true;
+    }
+
+  free (line);
+  if (ferror (f) || fclose (f) != 0)
+    pfatal_with_name (file);
+}
+
+/* Return true if the file F might have an entry in the digest cache.  */
+
+static bool
+cacheable (struct file_data const *f)
+{
+  return (S_ISREG (f->stat.st_mode)
+	  && (f->desc == UNOPENED
+	      || (0 <= f->desc && f->desc != STDIN_FILENO)));
+}
+
+/* Return the entry for the file whose status is ST, if it is fresh.
+   Otherwise return null, marking any stale entry for the file.
+   The caller must hold the cache lock.  */
+
+static struct digest_entry const *
+fresh_entry (struct stat const *st)
+{
+  if (!slots)
+    return nullptr;
+  struct digest_entry *e = entry_slot (st->st_dev, st->st_ino);
+  if (!e->used || e->stale)
+    return nullptr;
+  if (e->size == st->st_size
+      && timespec_cmp (e->mtime, get_stat_mtime (st)) == 0
+      && timespec_cmp (e->ctime, get_stat_ctime (st)) == 0)
+    return e;
+  e->stale = cache_changed = true;
+  return nullptr;
+}
+
+/* Return 0 if the digest cache says that the regular files FILE[0] and
+   FILE[1] have the same contents, 1 if it says that they differ, and -1
+   if it does not know.  */
+
+int
+digest_cache_compare (struct file_data const file[2])
+{
+  if (! (cache_name && cacheable (&file[0]) && cacheable (&file[1])
+	 && file[0].stat.st_size == file[1].stat.st_size))
+    return -1;
+
+  pthread_mutex_lock (&cache_lock);
+  struct digest_entry const *e0 = fresh_entry (&file[0].stat);
+  struct digest_entry const *e1 = fresh_entry (&file[1].stat);
+  int r = e0 && e1 ? !!memcmp (e0->digest, e1->digest, sizeof e0->digest) : -1;
+  pthread_mutex_unlock (&cache_lock);
+  return r;
+}
+
+/* Return true if the file whose status is ST can be recorded in the
+   digest cache: its times must be well before the start of the run.  */
+
+static bool
+recordable (struct stat const *st)
+{
+  struct timespec limit = cache_start;
+  limit.tv_sec -= DIGEST_CACHE_SLACK;
+  return (timespec_cmp (get_stat_mtime (st), limit) < 0
+	  && timespec_cmp (get_stat_ctime (st), limit) < 0);
+}
+
+/* Return a digest computation for the open regular files FILE[0] and
+   FILE[1], which are about to be read in full and compared, or null if
+   there is no need to compute a digest.  */
+
+struct sha256_ctx *
+digest_cache_start (struct file_data const file[2])
+{
+  if (! (cache_name
+	 && 0 <= file[0].desc && 0 <= file[1].desc
+	 && digest_cache_compare (file) < 0
+	 && recordable (&file[0].stat) && recordable (&file[1].stat)))
+    return nullptr;
+
+  struct sha256_ctx *ctx = ximalloc (sizeof *ctx);
+  sha256_init_ctx (ctx);
+  return ctx;
+}
+
+/* Add the LEN bytes of BUF, the next bytes of the first file, to the
+   digest computation CTX.  */
+
+void
+digest_cache_add (struct sha256_ctx *ctx, char const *buf, idx_t len)
+{
+  sha256_process_bytes (buf, len, ctx);
+}
+
+/* Finish the digest computation CTX, if it is not null.  If SAME, the
+   files FILE[0] and FILE[1] were found to have the same contents, and
+   the digest is recorded for both.  */
+
+void
+digest_cache_finish (struct sha256_ctx *ctx,
+		     struct file_data const file[2], bool same)
+{
+  if (!ctx)
+    return;
+
+  if (same)
+    {
+      struct digest_entry e;
+      sha256_finish_ctx (ctx, e.digest);
+      e.stale = false;
+      pthread_mutex_lock (&cache_lock);
+      for (int f = 0; f < 2; f++)
+	{
+	  struct stat const *st = &file[f].stat;
+	  e.dev = st->st_dev;
+	  e.ino = st->st_ino;
+	  e.size = st->st_size;
+	  e.mtime = get_stat_mtime (st);
+	  e.ctime = get_stat_ctime (st);
+	  put_entry (&e);
+	}
+      cache_changed = true;
+      pthread_mutex_unlock (&cache_lock);
+    }
+
+  free (ctx);
+}
+
+/* Write the entry E to OUT.  */
+
+static void
+save_entry (FILE *out, struct digest_entry const *e)
+{
+  char line[7 * INT_BUFSIZE_BOUND (intmax_t) + 2 * SHA256_DIGEST_SIZE + 8];
+  int len = sprintf (line, "%ju %ju %jd %jd.%09ld %jd.%09ld ",
+		     (uintmax_t) e->dev, (uintmax_t) e->ino,
+		     (intmax_t) e->size,
+		     (intmax_t) e->mtime.tv_sec, (long int) e->mtime.tv_nsec,
+		     (intmax_t) e->ctime.tv_sec, (long int) e->ctime.tv_nsec);
+  for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+    len += sprintf (line + len, "%02x", e->digest[i]);
+  line[len++] = ' ';
+  char check[CHECK_DIGITS + 1];
+  check_digits (check, line, len);
+  fprintf (out, "%.*s%s\n", len, line, check);
+}
+
+/* Save the digest cache, if there is one and it has changed.  Keep the
+   permissions of the cache being replaced, or use the permissions that
+   creating the file would have given it.
+   Return true if successful, false (after diagnosing) otherwise.  */
+
+bool
+digest_cache_save (void)
+{
+  if (! (cache_name && cache_changed))
+    return true;
+
+  idx_t namelen = strlen (cache_name);
+  char *temp = ximalloc (namelen + sizeof ".XXXXXX");
+  strcpy (stpcpy (temp, cache_name), ".XXXXXX");
+  int fd = mkstemp (temp);
+
+  /* mkstemp creates the file readable and writable only by its owner.  */
+  mode_t mode;
+  struct stat st;
+  if (stat (cache_name, &st) == 0)
+    mode = st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+  else
+    {
+      mode_t mask = umask (0);
+      umask (mask);
+      mode = ((S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
+	      & ~mask);
+    }
+
+  FILE *out = fd < 0 || fchmod (fd, mode) != 0 ? nullptr : fdopen (fd, "w");
+  bool ok = !!out;
+  if (ok)
+    {
+      fputs (digest_cache_header, out);
+      for (idx_t i = 0; i < slots; i++)
+	if (slot[i].used && !slot[i].stale)
+	  save_entry (out, &slot[i]);
+      ok = !ferror (out);
+      ok &= fclose (out) == 0;
+      ok = ok && rename (temp, cache_name) == 0;
+    }
+  else if (0 <= fd)
+    close (fd);
+
+  if (!ok)
+    {
+      perror_with_name (cache_name);
+      if (0 <= fd)
+	unlink (temp);
+    }
+  free (temp);
+  return ok;
+}
@@ -23,13 +23,15 @@
 #include <diagnose.h>
 #include <dirname.h>
 #include <error.h>
-#include <exclude.h>
 #include <filenamecat.h>
+#include <hard-locale.h>
 #include <mcel.h>
 #include <quote.h>
 #include <setjmp.h>
 #include <xalloc.h>
 
+#include <pthread.h>
+
 #ifndef HAVE_STRUCT_DIRENT_D_TYPE
 # define HAVE_STRUCT_DIRENT_D_TYPE false
 #endif
@@ -43,8 +45,36 @@ struct dirdata
   idx_t nnames;	/* Number of names.  */
   char const **names;	/* Sorted names of files in dir, followed by 0.  */
   char *data;	/* Allocated storage for file names.  */
+  idx_t data_alloc, data_used;	/* Allocated and used bytes of DATA.  */
+
+  /* If not null, the sort keys of NAMES, and their storage.  */
+  char const **keys;
+  char *keydata;
 };
 
+/* A directory to be read by dir_read in a thread of its own: the
+   arguments, and the result and errno value.  */
+struct dir_reading
+{
+  int parentdirfd;
+  struct file_data *dir;
+  struct dirdata *dirdata;
+  bool ok;
+  int err;
+
+  /* The thread, and whether it has been started.  */
+  pthread_t thread;
+  bool started;
+};
+
+/* Once this many entries of the first directory have been read,
+   read the second directory concurrently.  Starting a thread costs
+   more than reading a small directory.  */
+enum { DIR_READ_CONCURRENT_MIN = 1024 };
+
+/* The initial and maximum sizes of the buffer for getdents64.  */
+enum { DIR_BUFFER_MIN = 32 * 1024, DIR_BUFFER_MAX = 1024 * 1024 };
+
 /* Whether file names in directories should be compared with
    locale-specific sorting.  */
 static bool locale_specific_sorting;
@@ -54,7 +84,123 @@ static jmp_buf failed_locale_specific_sorting;
 
 static int compare_names (char const *, char const *);
 static bool dir_loop (struct comparison const *, int);
+static bool dir_read (int, struct file_data *, struct dirdata *,
+		      char const *, bool, struct dir_reading *);
+
+#if HAVE_STRUCT_DIRENT_D_TYPE
+/* Return the enum detype value for the dirent type D_TYPE.  */
+
+static char
+dirent_detype (unsigned char d_type)
+{
+  switch (d_type)
+    {
+    case DT_BLK:  return DE_BLK;
+    case DT_CHR:  return DE_CHR;
+    case DT_DIR:  return DE_DIR;
+    case DT_FIFO: return DE_FIFO;
+    case DT_LNK:  return DE_LNK;
+    case DT_REG:  return DE_REG;
+    case DT_SOCK: return DE_SOCK;
+# ifdef DT_WHT
+    case DT_WHT:  return DE_WHT;
+# endif
+    case DT_UNKNOWN: return DE_UNKNOWN;
+    default:         return DE_OTHER;
+    }
+}
+#endif
+
+/* Return true if the entry NAME of type DETYPE in the directory DIRFD
+   is a directory, or a symbolic link to one if following links.  */
+
+static bool
+entry_is_directory (int dirfd, char const *name, char detype)
+{
+  if (detype != DE_UNKNOWN
+      && ! (detype == DE_LNK && !no_dereference_symlinks))
+    return detype == DE_DIR;
+
+  struct stat st;
+  return (fstatat (dirfd, name, &st,
+		   no_dereference_symlinks ? AT_SYMLINK_NOFOLLOW : 0) == 0
+	  && S_ISDIR (st.st_mode));
+}
+
+/* Add the directory entry NAME, of length NAMLEN and type DETYPE, of
+   the directory DIRFD to DIRDATA unless it is "." or ".." or is
+   excluded, or unless STARTFILE and STARTFILE_ONLY say to ignore it as
+   described for dir_read.  */
+
+static void
+add_dir_entry (struct dirdata *dirdata, int dirfd,
+	       char const *name, idx_t namlen, char detype,
+	       char const *startfile, bool startfile_only)
+{
+  /* Ignore "." and "..".  */
+  if (name[0] == '.'
+      && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+    return;
+
+  if (startfile)
+    {
+      int cmp = compare_names (name, startfile);
+      if (cmp < 0 || (startfile_only && !!cmp))
+	return;
+    }
+
+  /* --include does not apply to directories, so that it does not
+     stop diff -r from descending into them.  */
+  if (name_set_match (excluded, name)
+      || (included && !name_set_match (included, name)
+	  && !entry_is_directory (dirfd, name, detype)))
+    return;
+
+  idx_t d_size = HAVE_STRUCT_DIRENT_D_TYPE + namlen + 1;
+  if (dirdata->data_alloc - dirdata->data_used < d_size)
+    dirdata->data = xpalloc (dirdata->data, &dirdata->data_alloc,
+			     d_size - (dirdata->data_alloc
+				       - dirdata->data_used),
+			     -1, 1);
+  char *p = dirdata->data + dirdata->data_used;
+  if (HAVE_STRUCT_DIRENT_D_TYPE)
+    *p++ = detype;
+  memcpy (p, name, namlen + 1);
+  dirdata->data_used += d_size;
+  dirdata->nnames++;
+}
+
+/* Read the directory CONCURRENT->dir as dir_read does.  This is the
+   body of the thread that reads the second of two directories.  */
 
+static void *
+read_dir_concurrently (void *arg)
+{
+  struct dir_reading *r = arg;
+  r->ok = dir_read (r->parentdirfd, r->dir, r->dirdata,
+		    nullptr, false, nullptr);
+  r->err = errno;
+  return arg;
+}
+
+/* Start reading the directory CONCURRENT in a thread of its own,
+   unless that has already been done or is not possible.  */
+
+static void
+start_dir_reading (struct dir_reading *concurrent)
+{
+  if (concurrent->started)
+    return;
+
+  /* Leave signals to the main thread.  */
+  sigset_t blocked, oldset;
+  sigfillset (&blocked);
+  pthread_sigmask (SIG_BLOCK, &blocked, &oldset);
+  concurrent->started = pthread_create (&concurrent->thread, nullptr,
+					read_dir_concurrently,
+					concurrent) == 0;
+  pthread_sigmask (SIG_SETMASK, &oldset, nullptr);
+}
 
 /* Given the parent directory PARENTDIRFD (negative for current dir),
    read the directory named by DIR and store into DIRDATA a sorted
@@ -65,20 +211,18 @@ static bool dir_loop (struct comparison const *, int);
    otherwise, update DIR->desc and DIR->dirstream as needed.
    If STARTFILE, ignore directory entries less than STARTFILE, and if
    STARTFILE_ONLY, also ignore directory entries greater than STARTFILE.
+   If CONCURRENT, start reading it in a separate thread if DIR turns
+   out to be large; the caller must then wait for that thread.
    Return true if successful, false (setting errno) otherwise.  */
 
 static bool
 dir_read (int parentdirfd, struct file_data *dir, struct dirdata *dirdata,
-	  char const *startfile, bool startfile_only)
+	  char const *startfile, bool startfile_only,
+	  struct dir_reading *concurrent)
 {
-  /* Number of files in directory.  */
-  idx_t nnames = 0;
-
-  /* Allocated and used storage for file name data.  */
-  char *data;
-
-  dirdata->names = nullptr;
-  dirdata->data = nullptr;
+  dirdata->names = dirdata->keys = nullptr;
+  dirdata->data = dirdata->keydata = nullptr;
+  dirdata->nnames = dirdata->data_alloc = dirdata->data_used = 0;
 
   if (dir->desc != NONEXISTENT)
     {
@@ -95,17 +239,50 @@ dir_read (int parentdirfd, struct file_data *dir, struct dirdata *dirdata,
 	    return false;
 	  dir->desc = dirfd;
 	}
+
+      /* The number of entries read, including ignored ones.  */
+      idx_t entries = 0;
+
+#if HAVE_GETDENTS64 && HAVE_STRUCT_DIRENT_D_TYPE
+      /* Read the entries directly, a buffer at a time, without the
+	 copying and small buffer of readdir.  The buffer grows while
+	 it fills up, so that a large directory takes few calls.  */
+      idx_t bufsize = DIR_BUFFER_MIN;
+      char *buf = ximalloc (bufsize);
+      ssize_t n;
+      while (0 < (n = getdents64 (dirfd, buf, bufsize)))
+	{
+	  for (ssize_t off = 0; off < n; entries++)
+	    {
+	      struct dirent64 const *next = (struct dirent64 const *) (buf + off);
+	      add_dir_entry (dirdata, dirfd,
+			     next->d_name, strlen (next->d_name),
+			     dirent_detype (next->d_type),
+			     startfile, startfile_only);
+	      off += next->d_reclen;
+	    }
+	  if (concurrent && DIR_READ_CONCURRENT_MIN <= entries)
+	    start_dir_reading (concurrent);
+	  if (bufsize < DIR_BUFFER_MAX && bufsize / 2 < n)
+	    {
+	      free (buf);
+	      bufsize *= 2;
+	      buf = ximalloc (bufsize);
+	    }
+	}
+      int err = errno;
+      free (buf);
+      if (n < 0)
+	{
+	  errno = err;
+	  return false;
+	}
+#else
       DIR *reading = fdopendir (dirfd);
       if (!reading)
         return false;
       dir->dirstream = reading;
 
-      /* Initialize the table of filenames.  */
-
-      idx_t data_alloc = 512;
-      idx_t data_used = 0;
-      dirdata->data = data = ximalloc (data_alloc);
-
       /* Read the directory entries, and insert the subfiles
          into the 'data' table.  */
 
@@ -116,61 +293,27 @@ dir_read (int parentdirfd, struct file_data *dir, struct dirdata *dirdata,
 	  if (!next)
 	    break;
 
-          char *d_name = next->d_name;
-
-          /* Ignore "." and "..".  */
-          if (d_name[0] == '.'
-              && (d_name[1] == 0 || (d_name[1] == '.' && d_name[2] == 0)))
-            continue;
-
-	  if (startfile)
-	    {
-	      int cmp = compare_names (d_name, startfile);
-	      if (cmp < 0 || (startfile_only && !!cmp))
-		continue;
-	    }
-
-          if (excluded_file_name (excluded, d_name))
-            continue;
-
-	  idx_t d_size = HAVE_STRUCT_DIRENT_D_TYPE + _D_EXACT_NAMLEN (next) + 1;
-          if (data_alloc - data_used < d_size)
-	    dirdata->data = data
-	      = xpalloc (data, &data_alloc,
-			 d_size - (data_alloc - data_used), -1, 1);
-#if HAVE_STRUCT_DIRENT_D_TYPE
-	  char detype;
-	  switch (next->d_type)
-	    {
-	    case DT_BLK:  detype = DE_BLK;  break;
-	    case DT_CHR:  detype = DE_CHR;  break;
-	    case DT_DIR:  detype = DE_DIR;  break;
-	    case DT_FIFO: detype = DE_FIFO; break;
-	    case DT_LNK:  detype = DE_LNK;  break;
-	    case DT_REG:  detype = DE_REG;  break;
-	    case DT_SOCK: detype = DE_SOCK; break;
-# ifdef DT_WHT
-	    case DT_WHT:  detype = DE_WHT;  break;
+# if HAVE_STRUCT_DIRENT_D_TYPE
+	  char detype = dirent_detype (next->d_type);
+# else
+	  char detype = DE_UNKNOWN;
 # endif
-	    case DT_UNKNOWN: detype = DE_UNKNOWN; break;
-	    default:         detype = DE_OTHER;   break;
-	    }
-	  data[data_used++] = detype;
-	  d_size--;
-#endif
-          memcpy (data + data_used, d_name, d_size);
-          data_used += d_size;
-          nnames++;
+	  add_dir_entry (dirdata, dirfd, next->d_name, _D_EXACT_NAMLEN (next),
+			 detype, startfile, startfile_only);
+	  if (concurrent && ++entries == DIR_READ_CONCURRENT_MIN)
+	    start_dir_reading (concurrent);
         }
 
       if (errno)
 	return false;
+#endif
     }
 
   /* Create the 'names' table from the 'data' table.  */
+  idx_t nnames = dirdata->nnames;
   char const **names = xinmalloc (nnames + 1, sizeof *names);
   dirdata->names = names;
-  dirdata->nnames = nnames;
+  char const *data = dirdata->data;
   for (idx_t i = 0; i < nnames; i++)
     {
       data += HAVE_STRUCT_DIRENT_D_TYPE;
@@ -226,6 +369,687 @@ compare_names_for_qsort (void const *file1, void const *file2)
   return compare_names (*f1, *f2);
 }
 
+/* The number of leading bytes of a file name that are kept in its
+   sort key, and the number of names below which a radix sort is not
+   worth its setup.  */
+enum { NAME_PREFIX_BYTES = 8, RADIX_SORT_MIN = 256 };
+
+/* A file name and its sort key, the first NAME_PREFIX_BYTES bytes of
+   the name padded with null bytes and read as a big-endian number.
+   Keys order names with different prefixes as strcmp does, and most
+   comparisons of keys need not look at the names themselves.  */
+struct name_key
+{
+  uint_least64_t prefix;
+  char const *name;
+};
+
+/* Return the sort key of NAME.  */
+
+static uint_least64_t
+name_prefix (char const *name)
+{
+  uint_least64_t prefix = 0;
+  for (int i = 0; i < NAME_PREFIX_BYTES; i++)
+    {
+      unsigned char c = *name;
+      name += !!c;
+      prefix = prefix << CHAR_BIT | c;
+    }
+  return prefix;
+}
+
+/* Compare the name keys K1 and K2 as strcmp compares their names.  */
+
+static int
+compare_name_keys (void const *k1, void const *k2)
+{
+  struct name_key const *a = k1;
+  struct name_key const *b = k2;
+  if (a->prefix != b->prefix)
+    return a->prefix < b->prefix ? -1 : 1;
+
+  /* Names with the same key are equal if the key ends in a null byte.  */
+  return ((a->prefix & UCHAR_MAX)
+	  ? strcmp (a->name + NAME_PREFIX_BYTES, b->name + NAME_PREFIX_BYTES)
+	  : 0);
+}
+
+/* Sort the N names NAMES into strcmp order.  Sort the names by their
+   keys with a least-significant-byte radix sort, skipping bytes that
+   are the same in every key, and then sort each run of names with the
+   same key by the rest of the names.  */
+
+static void
+sort_names_bytewise (char const **names, idx_t n)
+{
+  struct name_key *buf = xinmalloc (n, 2 * sizeof *buf);
+  struct name_key *key = buf, *tmp = buf + n;
+  for (idx_t i = 0; i < n; i++)
+    key[i] = (struct name_key) { name_prefix (names[i]), names[i] };
+
+  if (n < RADIX_SORT_MIN)
+    qsort (key, n, sizeof *key, compare_name_keys);
+  else
+    {
+      static_assert (NAME_PREFIX_BYTES * CHAR_BIT <= 64);
+      idx_t count[NAME_PREFIX_BYTES][UCHAR_MAX + 1] = {0};
+      for (idx_t i = 0; i < n; i++)
+	for (int b = 0; b < NAME_PREFIX_BYTES; b++)
+	  count[b][key[i].prefix >> (b * CHAR_BIT) & UCHAR_MAX]++;
+
+      for (int b = 0; b < NAME_PREFIX_BYTES; b++)
+	{
+	  idx_t *c = count[b];
+	  int shift = b * CHAR_BIT;
+	  if (c[key[0].prefix >> shift & UCHAR_MAX] == n)
+	    continue;
+	  for (idx_t d = 0, pos = 0; d <= UCHAR_MAX; d++)
+	    {
+	      idx_t cd = c[d];
+	      c[d] = pos;
+	      pos += cd;
+	    }
+	  for (idx_t i = 0; i < n; i++)
+	    tmp[c[key[i].prefix >> shift & UCHAR_MAX]++] = key[i];
+	  struct name_key *t = key;
+	  key = tmp;
+	  tmp = t;
+	}
+
+      for (idx_t i = 0, j; i < n; i = j)
+	{
+	  for (j = i + 1; j < n && key[j].prefix == key[i].prefix; j++)
+	    continue;
+	  if (1 < j - i)
+	    qsort (key + i, j - i, sizeof *key, compare_name_keys);
+	}
+    }
+
+  for (idx_t i = 0; i < n; i++)
+    names[i] = key[i].name;
+  free (buf);
+}
+
+/* A file name and its sort key.  */
+struct keyed_name
+{
+  char const *key;
+  char const *name;
+};
+
+/* Compare the keyed names K1 and K2 by their keys, breaking ties with
+   file_name_cmp.  */
+
+static int
+compare_keyed_names (void const *k1, void const *k2)
+{
+  struct keyed_name const *a = k1;
+  struct keyed_name const *b = k2;
+  int r = strcmp (a->key, b->key);
+  return r ? r : file_name_cmp (a->name, b->name);
+}
+
+/* Compute the sort keys of the names of DIRDATA, and sort the names by
+   them.  The key of a name is its case-folded form if ignoring file
+   name case, its transformation by strxfrm if sorting by locale.  Keys
+   compare with strcmp as the names compare with compare_names, except
+   that names with equal keys compare equal only when ignoring case.
+   Computing each key once makes sorting take O(N log N) simple string
+   comparisons rather than calls to strcoll or mbscasecmp.  Return true
+   if successful, false if no keys are needed or strxfrm fails.  */
+
+static bool
+sort_names_by_key (struct dirdata *dirdata)
+{
+  if (! (ignore_file_name_case || locale_specific_sorting))
+    return false;
+
+  idx_t n = dirdata->nnames;
+  char *buf = nullptr;
+  idx_t alloc = 0, used = 0;
+
+  /* The offset of each key in BUF, until BUF stops moving.  */
+  idx_t *offset = xinmalloc (n, sizeof *offset);
+
+  for (idx_t i = 0; i < n; i++)
+    {
+      char const *name = dirdata->names[i];
+      offset[i] = used;
+      if (ignore_file_name_case)
+	{
+	  /* A folded character takes at most 4 bytes, and each takes at
+	     least one byte of the name.  */
+	  idx_t namelen = strlen (name);
+	  if (alloc - used <= 4 * namelen)
+	    buf = xpalloc (buf, &alloc, 4 * namelen + 1 - (alloc - used), -1, 1);
+	  used = fold_file_name (buf + used, name, namelen) + 1 - buf;
+	}
+      else
+	for (;;)
+	  {
+	    errno = 0;
+	    size_t len = strxfrm (buf + used, name, alloc - used);
+	    if (errno)
+	      {
+		free (offset);
+		free (buf);
+		return false;
+	      }
+	    if (len < alloc - used)
+	      {
+		used += len + 1;
+		break;
+	      }
+	    buf = xpalloc (buf, &alloc, len + 1 - (alloc - used), -1, 1);
+	  }
+    }
+
+  struct keyed_name *k = xinmalloc (n, sizeof *k);
+  for (idx_t i = 0; i < n; i++)
+    k[i] = (struct keyed_name) { buf + offset[i], dirdata->names[i] };
+  free (offset);
+  qsort (k, n, sizeof *k, compare_keyed_names);
+
+  char const **keys = xinmalloc (n, sizeof *keys);
+  for (idx_t i = 0; i < n; i++)
+    {
+      dirdata->names[i] = k[i].name;
+      keys[i] = k[i].key;
+    }
+  free (k);
+  dirdata->keys = keys;
+  dirdata->keydata = buf;
+  return true;
+}
+
+/* Discard the sort keys of DIRDATA.  */
+
+static void
+free_keys (struct dirdata *dirdata)
+{
+  free (dirdata->keys);
+  free (dirdata->keydata);
+  dirdata->keys = nullptr;
+  dirdata->keydata = nullptr;
+}
+
+/* Compare the I0th name of DIRDATA[0] with the I1th name of DIRDATA[1]
+   as compare_names does, using their sort keys if they have any.  */
+
+static int
+compare_entries (struct dirdata const dirdata[2], idx_t i0, idx_t i1)
+{
+  char const *name0 = dirdata[0].names[i0];
+  char const *name1 = dirdata[1].names[i1];
+  if (!dirdata[0].keys)
+    return compare_names (name0, name1);
+  int r = strcmp (dirdata[0].keys[i0], dirdata[1].keys[i1]);
+  return r || ignore_file_name_case ? r : file_name_cmp (name0, name1);
+}
+
+/* Set *NP to the pair of directory entries NAME0 and NAME1, either of
+   which may be null.  */
+
+static void
+set_name_pair (struct name_pair *np, char const *name0, char const *name1)
+{
+  np->name[0] = name0;
+  np->name[1] = name1;
+  np->detype[0] = HAVE_STRUCT_DIRENT_D_TYPE && name0 ? name0[-1] : DE_UNKNOWN;
+  np->detype[1] = HAVE_STRUCT_DIRENT_D_TYPE && name1 ? name1[-1] : DE_UNKNOWN;
+}
+
+/* Store into PAIR + NPAIRS the pairs of the N0 names NAME0 and the N1
+   names NAME1, which are all the same apart from case and are sorted by
+   file_name_cmp, and return the new number of pairs.  Prefer to pair
+   names that file_name_cmp says are the same: going through both lists
+   a name at a time, when the next two names differ, pair the greater
+   with its exact match in the other list if it has one that is not
+   yet paired, and otherwise pair the two names with each other.  Names
+   left over are paired with nothing.  Finding the exact matches first
+   makes this take linear time.  */
+
+static idx_t
+pair_case_group (struct name_pair *pair, idx_t npairs,
+		 char const *const *name0, idx_t n0,
+		 char const *const *name1, idx_t n1)
+{
+  if (n0 == 1 && n1 == 1)
+    {
+      set_name_pair (&pair[npairs], name0[0], name1[0]);
+      return npairs + 1;
+    }
+
+  /* MATCH0[I] is the index of NAME0[I]'s exact match in NAME1, or -1,
+     and USED0[I] says whether NAME0[I] has been paired.  Likewise for
+     MATCH1 and USED1.  */
+  idx_t *match0 = xinmalloc (n0 + n1, sizeof *match0);
+  idx_t *match1 = match0 + n0;
+  bool *used0 = xizalloc (n0 + n1);
+  bool *used1 = used0 + n0;
+  for (idx_t i = 0; i < n0 + n1; i++)
+    match0[i] = -1;
+  for (idx_t i = 0, j = 0; i < n0 && j < n1; )
+    {
+      int c = file_name_cmp (name0[i], name1[j]);
+      if (c == 0)
+	{
+	  match0[i] = j;
+	  match1[j] = i;
+	}
+      i += c <= 0;
+      j += 0 <= c;
+    }
+
+  idx_t i = 0, j = 0;
+  for (;;)
+    {
+      while (i < n0 && used0[i])
+	i++;
+      while (j < n1 && used1[j])
+	j++;
+      if (i == n0 || j == n1)
+	break;
+      idx_t pi = i, pj = j;
+      int c = file_name_cmp (name0[i], name1[j]);
+      if (c < 0 && 0 <= match1[j] && !used0[match1[j]])
+	pi = match1[j];
+      else if (0 < c && 0 <= match0[i] && !used1[match0[i]])
+	pj = match0[i];
+      used0[pi] = used1[pj] = true;
+      set_name_pair (&pair[npairs++], name0[pi], name1[pj]);
+    }
+  for (; i < n0; i++)
+    if (!used0[i])
+      set_name_pair (&pair[npairs++], name0[i], nullptr);
+  for (; j < n1; j++)
+    if (!used1[j])
+      set_name_pair (&pair[npairs++], nullptr, name1[j]);
+
+  free (match0);
+  free (used0);
+  return npairs;
+}
+
+/* Sort the names of DIRDATA[0] and DIRDATA[1], and store into PAIR,
+   which has room for a pair per name, one pair for each name that is
+   in either directory.  Return the number of pairs.  */
+
+static idx_t
+pair_names (struct dirdata dirdata[2], struct name_pair *pair)
+{
+  /* Use locale-specific sorting if possible, else native byte order.
+     In a locale whose collation is byte order anyway, use byte
+     order directly, which can be sorted faster.  */
+  locale_specific_sorting = hard_locale (LC_COLLATE);
+  if (locale_specific_sorting && ! ignore_file_name_case)
+    if (setjmp (failed_locale_specific_sorting))
+      locale_specific_sorting = false;
+
+  /* Sort the directories.  Use sort keys if possible, so that
+     names need not be collated or case-folded again and again.  */
+  if (FILE_NAME_CMP_BYTEWISE
+      && ! (locale_specific_sorting || ignore_file_name_case))
+    for (int i = 0; i < 2; i++)
+      sort_names_bytewise (dirdata[i].names, dirdata[i].nnames);
+  else if (! (sort_names_by_key (&dirdata[0])
+	      && sort_names_by_key (&dirdata[1])))
+    for (int i = 0; i < 2; i++)
+      {
+	free_keys (&dirdata[i]);
+	qsort (dirdata[i].names, dirdata[i].nnames,
+	       sizeof *dirdata[i].names, compare_names_for_qsort);
+      }
+
+  idx_t npairs = 0;
+  idx_t i0 = 0, i1 = 0;
+  while (i0 < dirdata[0].nnames || i1 < dirdata[1].nnames)
+    {
+      /* Compare next name in dir 0 with next name in dir 1.
+	 At the end of a dir,
+	 pretend the "next name" in that dir is very large.  */
+      int nameorder = (i0 == dirdata[0].nnames ? 1
+		       : i1 == dirdata[1].nnames ? -1
+		       : compare_entries (dirdata, i0, i1));
+
+      /* Names that are the same apart from case form a group in each
+	 dir, sorted by file_name_cmp.  Pair the groups as a whole,
+	 preferring file_name_cmp matches.  */
+      if (nameorder == 0 && ignore_file_name_case)
+	{
+	  idx_t e0 = i0 + 1, e1 = i1 + 1;
+	  char const *key = dirdata[0].keys[i0];
+	  while (e0 < dirdata[0].nnames
+		 && STREQ (dirdata[0].keys[e0], key))
+	    e0++;
+	  while (e1 < dirdata[1].nnames
+		 && STREQ (dirdata[1].keys[e1], key))
+	    e1++;
+	  npairs = pair_case_group (pair, npairs,
+				    dirdata[0].names + i0, e0 - i0,
+				    dirdata[1].names + i1, e1 - i1);
+	  i0 = e0;
+	  i1 = e1;
+	  continue;
+	}
+
+      set_name_pair (&pair[npairs++],
+		     0 < nameorder ? nullptr : dirdata[0].names[i0++],
+		     nameorder < 0 ? nullptr : dirdata[1].names[i1++]);
+    }
+
+  return npairs;
+}
+
+#if HAVE_OPEN_MEMSTREAM
+
+/* With --jobs, worker threads compare pairs of regular files found in
+   directories while the main thread reads directories and compares
+   everything else.  Each pair's output goes to a buffer of its own,
+   and the main thread copies the buffers to standard output in the
+   order that a sequential comparison would output them.  Output from
+   the main thread goes to buffers in the same queue while comparisons
+   that precede it are still pending.  */
+
+/* A pair of files to be compared by a worker thread, or a segment of
+   output from the main thread, in the queue of output waiting to be
+   copied to standard output.  */
+struct job
+{
+  /* The arguments for compare_files, or a null PARENT for a segment.  */
+  struct comparison const *parent;
+  enum detype detype[2];
+  char const *name[2];
+
+  /* The exit status of the comparison, and where to fold it in.  */
+  int status;
+  int *val;
+
+  /* The output.  */
+  char *buf;
+  size_t size;
+
+  /* The printer of the thread that compares the files, which has a
+     --stat table of its own.  */
+  struct printer printer;
+
+  /* True once the output is complete.  */
+  bool done;
+
+  struct job *next;
+};
+
+/* The number of pending jobs per worker thread.  More use more memory
+   for output not yet copied; fewer leave threads idle when some pairs
+   of files take longer to compare than others.  */
+enum { JOBS_PER_WORKER = 4 };
+
+/* The queue, oldest first, and the number of jobs in it.  Only the main
+   thread adds and removes jobs.  */
+static struct job *queue_head, *queue_tail;
+static idx_t queued;
+
+/* The segment at the end of the queue that the main thread is writing
+   to, if any.  */
+static struct job *main_segment;
+
+/* QUEUE_LOCK protects the links between jobs, the jobs' DONE members,
+   QUEUE_NEXT, the next job for a worker thread to take, and
+   QUEUE_CLOSING, which tells idle workers to exit.  JOB_READY signals
+   a new job or QUEUE_CLOSING, and JOB_DONE a change to DONE.  */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+static struct job *queue_next;
+static bool queue_closing;
+
+/* The worker threads, and how many there are.  */
+static pthread_t *worker;
+static int workers;
+
+/* Compare pairs of files from the queue until told to stop.  */
+
+static void *
+compare_jobs (void *arg)
+{
+  worker_thread = true;
+
+  pthread_mutex_lock (&queue_lock);
+  for (;;)
+    {
+      while (queue_next && !queue_next->parent)
+	queue_next = queue_next->next;
+      if (!queue_next)
+	{
+	  if (queue_closing)
+	    break;
+	  pthread_cond_wait (&job_ready, &queue_lock);
+	  continue;
+	}
+      struct job *job = queue_next;
+      queue_next = job->next;
+      pthread_mutex_unlock (&queue_lock);
+
+      printer = &job->printer;
+      select_printer (nullptr);
+      output_segment = open_memstream (&job->buf, &job->size);
+      if (!output_segment)
+	xalloc_die ();
+      job->status = compare_files (job->parent, job->detype,
+				   job->name[0], job->name[1]);
+      if (fclose (output_segment) != 0)
+	xalloc_die ();
+      output_segment = nullptr;
+
+      pthread_mutex_lock (&queue_lock);
+      job->done = true;
+      pthread_cond_broadcast (&job_done);
+    }
+  pthread_mutex_unlock (&queue_lock);
+  return arg;
+}
+
+/* Start the worker threads, if possible.  */
+
+static void
+start_workers (void)
+{
+  worker = xinmalloc (jobs, sizeof *worker);
+
+  /* Leave signals to the main thread.  */
+  sigset_t blocked, oldset;
+  sigfillset (&blocked);
+  pthread_sigmask (SIG_BLOCK, &blocked, &oldset);
+  while (workers < jobs
+	 && pthread_create (&worker[workers], nullptr, compare_jobs,
+			    nullptr) == 0)
+    workers++;
+  pthread_sigmask (SIG_SETMASK, &oldset, nullptr);
+
+  if (!workers)
+    {
+      free (worker);
+      worker = nullptr;
+    }
+}
+
+/* Stop the worker threads, which must have nothing left to do.  */
+
+static void
+stop_workers (void)
+{
+  pthread_mutex_lock (&queue_lock);
+  queue_closing = true;
+  pthread_cond_broadcast (&job_ready);
+  pthread_mutex_unlock (&queue_lock);
+
+  for (int w = 0; w < workers; w++)
+    pthread_join (worker[w], nullptr);
+  free (worker);
+  worker = nullptr;
+  workers = 0;
+  queue_closing = false;
+}
+
+/* Add JOB to the end of the queue.  */
+
+static void
+enqueue (struct job *job)
+{
+  job->next = nullptr;
+  pthread_mutex_lock (&queue_lock);
+  if (queue_tail)
+    queue_tail->next = job;
+  else
+    queue_head = job;
+  queue_tail = job;
+  if (!queue_next)
+    queue_next = job;
+  if (job->parent)
+    pthread_cond_signal (&job_ready);
+  pthread_mutex_unlock (&queue_lock);
+  queued++;
+}
+
+/* Finish the segment that the main thread is writing to, if any.  */
+
+static void
+close_main_segment (void)
+{
+  if (main_segment)
+    {
+      if (fclose (output_segment) != 0)
+	xalloc_die ();
+      output_segment = nullptr;
+      pthread_mutex_lock (&queue_lock);
+      main_segment->done = true;
+      pthread_mutex_unlock (&queue_lock);
+      main_segment = nullptr;
+    }
+}
+
+/* Wait for the first job in the queue to be done, copy its output to
+   standard output, and remove it from the queue.  */
+
+static void
+emit_first_job (void)
+{
+  struct job *job = queue_head;
+  if (job == main_segment)
+    close_main_segment ();
+
+  pthread_mutex_lock (&queue_lock);
+  while (!job->done)
+    pthread_cond_wait (&job_done, &queue_lock);
+  queue_head = job->next;
+  if (!queue_head)
+    queue_tail = nullptr;
+  if (queue_next == job)
+    queue_next = job->next;
+  pthread_mutex_unlock (&queue_lock);
+  queued--;
+
+  if (job->size)
+    {
+      /* Lock standard output, as diagnostics from worker threads
+	 flush it.  */
+      flockfile (stdout);
+      fwrite (job->buf, 1, job->size, stdout);
+      funlockfile (stdout);
+      if (flush_due () && fflush (stdout) != 0)
+	pfatal_with_name (_("standard output"));
+    }
+  free (job->buf);
+  move_stat_entries (&printer[0], &job->printer);
+  if (job->val && *job->val < job->status)
+    *job->val = job->status;
+  free (job);
+}
+
+/* Queue the comparison of the files named NAME0 and NAME1, of types
+   DETYPE, in the directories of PARENT, folding its exit status into
+   *VAL when its output is copied.  */
+
+static void
+enqueue_comparison (struct comparison const *parent,
+		    enum detype const detype[2],
+		    char const *name0, char const *name1, int *val)
+{
+  while ((idx_t) workers * JOBS_PER_WORKER <= queued)
+    emit_first_job ();
+  close_main_segment ();
+
+  struct printer const *p = &printer[0];
+  struct job *job = xmalloc (sizeof *job);
+  *job = (struct job) {
+    .parent = parent,
+    .detype = { detype[0], detype[1] },
+    .name = { name0, name1 },
+    .val = val,
+    .printer = { .style = p->style, .brief = p->brief,
+		 .file = p->file, .name = p->name }
+  };
+  enqueue (job);
+}
+
+/* Return true if the directory entry NAME, of type DETYPE, of file F
+   of CMP is missing or is a regular file, so that a worker thread can
+   compare it.  */
+
+static bool
+regular_entry (struct comparison const *cmp, int f, enum detype detype,
+	       char const *name)
+{
+  if (!name || detype == DE_REG)
+    return true;
+  if (! (detype == DE_UNKNOWN
+	 || (detype == DE_LNK && !no_dereference_symlinks)))
+    return false;
+  struct stat st;
+  return (fstatat (cmp->file[f].desc, name, &st,
+		   no_dereference_symlinks ? AT_SYMLINK_NOFOLLOW : 0) == 0
+	  && S_ISREG (st.st_mode));
+}
+
+/* Return true if files in directories can be compared by worker
+   threads.  Options whose state the threads would share, or that need
+   output in a strict sequence, rule this out.  So does colored output,
+   which is for terminals anyway.  */
+
+static bool
+parallel_comparison (void)
+{
+  return (1 < jobs && printers == 1 && !paginate && !max_output_bytes
+	  && !ignore_regexp && !function_regexp
+	  && (colors_style == NEVER
+	      || (colors_style == AUTO && !presume_output_tty
+		  && !isatty (STDOUT_FILENO))));
+}
+
+#endif
+
+/* Return the stream that takes the place of standard output in this
+   thread.  In the main thread, this starts a segment of output if
+   comparisons whose output comes first are pending.  */
+
+FILE *
+std_output (void)
+{
+#if HAVE_OPEN_MEMSTREAM
+  if (!output_segment && queued)
+    {
+      struct job *seg = xzalloc (sizeof *seg);
+      output_segment = open_memstream (&seg->buf, &seg->size);
+      if (!output_segment)
+	xalloc_die ();
+      main_segment = seg;
+      enqueue (seg);
+    }
+#endif
+  return output_segment ? output_segment : stdout;
+}
+
 /* Compare the contents of two directories named in CMP.
    This is a top-level routine; it does everything necessary for diff
    on two directories.
@@ -248,86 +1072,93 @@ diff_dirs (struct comparison *cmp)
       return EXIT_TROUBLE;
     }
 
-  /* Get contents of both dirs.  */
+  /* Get contents of both dirs, reading the second concurrently if the
+     first is large.  With --starting-file, read them one after the
+     other, as only the main thread can handle a failure to compare
+     names.  */
+  char const *startfile = cmp->parent == &noparent ? starting_file : nullptr;
   struct dirdata dirdata[2];
+  struct dir_reading reading = { .parentdirfd = cmp->parent->file[1].desc,
+				 .dir = &cmp->file[1],
+				 .dirdata = &dirdata[1] };
+  bool concurrent = !startfile && cmp->file[1].desc != NONEXISTENT;
+  bool ok0 = dir_read (cmp->parent->file[0].desc, &cmp->file[0], &dirdata[0],
+		       startfile, false, concurrent ? &reading : nullptr);
+  int err0 = errno;
+  if (reading.started)
+    pthread_join (reading.thread, nullptr);
+  else
+    {
+      reading.ok = dir_read (reading.parentdirfd, reading.dir,
+			     reading.dirdata, startfile, false, nullptr);
+      reading.err = errno;
+    }
+
+  struct name_pair *pair = nullptr;
+  idx_t npairs = 0;
   int val = EXIT_SUCCESS;
   for (int i = 0; i < 2; i++)
-    if (! dir_read (cmp->parent->file[i].desc, &cmp->file[i], &dirdata[i],
-		    cmp->parent == &noparent ? starting_file : nullptr, false))
+    if (! (i ? reading.ok : ok0))
       {
+	errno = i ? reading.err : err0;
         perror_with_name (cmp->file[i].name);
         val = EXIT_TROUBLE;
       }
 
+#if HAVE_OPEN_MEMSTREAM
+  bool start = (val == EXIT_SUCCESS && cmp->parent == &noparent
+		&& parallel_comparison ());
+  if (start)
+    start_workers ();
+#endif
+
   if (val == EXIT_SUCCESS)
     {
-      /* Use locale-specific sorting if possible, else native byte order.  */
-      locale_specific_sorting = true;
-      if (! ignore_file_name_case)
-	if (setjmp (failed_locale_specific_sorting))
-	  locale_specific_sorting = false;
-
-      /* Sort the directories.  */
-      for (int i = 0; i < 2; i++)
-        qsort (dirdata[i].names, dirdata[i].nnames, sizeof *dirdata[i].names,
-               compare_names_for_qsort);
-
-      /* Loop while files remain in one or both dirs.  */
-      char const **n0 = dirdata[0].names;
-      char const **n1 = dirdata[1].names;
-      while (*n0 || *n1)
+      pair = xinmalloc (dirdata[0].nnames + dirdata[1].nnames, sizeof *pair);
+      npairs = pair_names (dirdata, pair);
+
+      /* Compare the files of each pair.  When comparing them one at a
+         time, open and read runs of regular files in advance.  */
+      for (idx_t i = 0, prefetched = 0; i < npairs; i++)
         {
-          /* Compare next name in dir 0 with next name in dir 1.
-             At the end of a dir,
-             pretend the "next name" in that dir is very large.  */
-          int nameorder = !*n0 ? 1 : !*n1 ? -1 : compare_names (*n0, *n1);
-
-          /* Prefer a file_name_cmp match if available.  This algorithm is
-             O(N**2), where N is the number of names in a directory
-             that compare_names says are all equal, but in practice N
-             is so small it's not worth tuning.  */
-          if (nameorder == 0 && ignore_file_name_case)
-            {
-              int raw_order = file_name_cmp (*n0, *n1);
-              if (raw_order != 0)
-                {
-                  char const **lesser = raw_order < 0 ? n0 : n1;
-                  char const *greater_name = *(raw_order < 0 ? n1 : n0);
-
-                  for (char const **p = lesser + 1;
-                       *p && compare_names (*p, greater_name) == 0;
-                       p++)
-                    {
-                      int c = file_name_cmp (*p, greater_name);
-                      if (0 <= c)
-                        {
-                          if (c == 0)
-                            {
-                              memmove (lesser + 1, lesser,
-                                       (char *) p - (char *) lesser);
-                              *lesser = greater_name;
-                            }
-                          break;
-                        }
-                    }
-                }
-            }
-
-	  enum detype detypes[]
-	    = { HAVE_STRUCT_DIRENT_D_TYPE && *n0 ? (*n0)[-1] : DE_UNKNOWN,
-		HAVE_STRUCT_DIRENT_D_TYPE && *n1 ? (*n1)[-1] : DE_UNKNOWN };
-	  int v1 = compare_files (cmp, detypes,
-				  0 < nameorder ? nullptr : *n0++,
-				  nameorder < 0 ? nullptr : *n1++);
+	  enum detype const *detypes = pair[i].detype;
+	  char const *name0 = pair[i].name[0];
+	  char const *name1 = pair[i].name[1];
+#if HAVE_OPEN_MEMSTREAM
+	  if (workers
+	      && regular_entry (cmp, 0, detypes[0], name0)
+	      && regular_entry (cmp, 1, detypes[1], name1))
+	    {
+	      enqueue_comparison (cmp, detypes, name0, name1, &val);
+	      continue;
+	    }
+	  if (!workers && prefetched <= i)
+#else
+	  if (prefetched <= i)
+#endif
+	    prefetched = i + prefetch_files (cmp, &pair[i], npairs - i, &val);
+	  int v1 = compare_files (cmp, detypes, name0, name1);
           if (val < v1)
             val = v1;
         }
     }
 
+#if HAVE_OPEN_MEMSTREAM
+  /* The pending comparisons may refer to this directory, so finish
+     them before it is closed.  */
+  while (queued)
+    emit_first_job ();
+  if (start && workers)
+    stop_workers ();
+#endif
+
+  end_prefetch (&val);
+  free (pair);
   for (int i = 0; i < 2; i++)
     {
       free (dirdata[i].names);
       free (dirdata[i].data);
+      free_keys (&dirdata[i]);
     }
 
   return val;
@@ -356,7 +1187,8 @@ find_dir_file_pathname (struct file_data *dir, char const *file,
   dirdata.names = nullptr;
   dirdata.data = nullptr;
 
-  if (ignore_file_name_case && dir_read (AT_FDCWD, dir, &dirdata, file, true))
+  if (ignore_file_name_case
+      && dir_read (AT_FDCWD, dir, &dirdata, file, true, nullptr))
     for (char const **p = dirdata.names; *p; p++)
       {
 	if (file_name_cmp (*p, file) == 0)
@@ -374,3 +1206,40 @@ find_dir_file_pathname (struct file_data *dir, char const *file,
   free (dirdata.data);
   return val;
 }
+
+/* Read the directory DIR, opening it relative to PARENTDIRFD if it is
+   not open, and pair its entries with the N names NAMES, which are
+   reordered, as diff_dirs pairs the entries of two directories.  DIR's
+   entries are the names of side SIDE of the pairs, and NAMES those of
+   the other side; each of NAMES must be preceded by a byte giving the
+   file type as an enum detype value, as in a struct dirdata.
+   Update DIR->desc and DIR->dirstream as needed.
+   If successful, store the number of pairs into *NPAIRS and the
+   storage of DIR's names, for the caller to free after the pairs,
+   into *DATA, and return the pairs.  Otherwise, set errno and return
+   null.  */
+
+struct name_pair *
+pair_dir_entries (int parentdirfd, struct file_data *dir, int side,
+		  char const **names, idx_t n, idx_t *npairs, char **data)
+{
+  struct dirdata dirdata[2];
+  if (!dir_read (parentdirfd, dir, &dirdata[side], nullptr, false, nullptr))
+    {
+      int err = errno;
+      free (dirdata[side].names);
+      free (dirdata[side].data);
+      errno = err;
+      return nullptr;
+    }
+  dirdata[!side] = (struct dirdata) { .nnames = n, .names = names };
+
+  struct name_pair *pair = xinmalloc (dirdata[side].nnames + n + 1,
+				      sizeof *pair);
+  *npairs = pair_names (dirdata, pair);
+  *data = dirdata[side].data;
+  free (dirdata[side].names);
+  for (int i = 0; i < 2; i++)
+    free_keys (&dirdata[i]);
+  return pair;
+}
@@ -120,7 +120,8 @@ pr_forward_ed_hunk (struct change *hunk)
   /* For insertion (with or without deletion), print the number range
      and the lines from file 2.  */
 
-  for (lin i = f1; i <= l1; i++)
+  lin i = f1 + print_line_run ("", "", &curr.file[1].linbuf[f1], l1 - f1 + 1);
+  for (; i <= l1; i++)
     print_1_line ("", &curr.file[1].linbuf[i]);
 
   fputs (".\n", outfile);
@@ -168,7 +169,9 @@ print_rcs_hunk (struct change *hunk)
                tf1 <= tl1 ? tl1 - tf1 + 1 : 1);
 
       /* Print the inserted lines.  */
-      for (lin i = f1; i <= l1; i++)
+      lin i = f1 + print_line_run ("", "", &curr.file[1].linbuf[f1],
+				   l1 - f1 + 1);
+      for (; i <= l1; i++)
 	print_1_line ("", &curr.file[1].linbuf[i]);
     }
 }
@@ -0,0 +1,406 @@
+/* Match file names against sets of shell patterns for GNU DIFF.
+
+   Copyright (C) 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Options like --exclude can be given many times, and --exclude-from
+   can supply thousands of patterns, so rather than trying each pattern
+   in turn with fnmatch on every directory entry, sort the patterns by
+   kind as they are added.  A pattern without wildcards goes into a
+   hash table of names, and a pattern "*SUFFIX" or "PREFIX*" whose
+   SUFFIX or PREFIX has no wildcards goes into a trie of suffixes or
+   prefixes; the time to match a name against these does not depend on
+   the number of patterns.  Only the remaining patterns are tried with
+   fnmatch.  Patterns that ignore case are kept apart from the others,
+   and are matched against the case-folded form of a name, which is in
+   UTF-8.  A suffix is matched bytewise, so in a locale whose encoding
+   is not self-synchronizing, a pattern "*SUFFIX" that considers case
+   is left to fnmatch.
+
+   A set is not modified once option parsing is done, so names can be
+   matched against it by several threads at once.  */
+
+#include "diff.h"
+
+#include <fnmatch.h>
+#include <mcel.h>
+#include <xalloc.h>
+
+#include <ctype.h>
+
+/* A node of a trie of byte strings.  */
+struct trie_node
+{
+  /* The node's first child and its next sibling, or 0 if none.  */
+  idx_t child, sibling;
+
+  /* The byte leading to this node from its parent.  */
+  unsigned char byte;
+
+  /* Whether a string of the trie ends at this node.  */
+  bool end;
+};
+
+/* A trie of byte strings.  If it is not empty, node 0 is the root.  */
+struct trie
+{
+  struct trie_node *node;
+  idx_t nodes, nodes_alloc;
+};
+
+/* A hash table of strings, using open addressing.  */
+struct name_table
+{
+  /* The slots, each null or a string.  Their number is zero or a power
+     of two, and at least one is null.  */
+  char **slot;
+  idx_t slots, used;
+};
+
+/* The patterns of a set that consider case, or that ignore it.  */
+struct literal_patterns
+{
+  /* The patterns without wildcards.  */
+  struct name_table exact;
+
+  /* The prefixes of patterns "PREFIX*", and the suffixes of patterns
+     "*SUFFIX", the latter stored reversed.  */
+  struct trie prefix, suffix;
+};
+
+/* A pattern tried with fnmatch, and its fnmatch options.  */
+struct fnmatch_pattern
+{
+  char *pattern;
+  int options;
+};
+
+struct name_set
+{
+  /* [false] for the patterns that consider case, [true] for those that
+     ignore it; the latter are case-folded.  */
+  struct literal_patterns literal[2];
+
+  /* Whether LITERAL[true] has any patterns.  */
+  bool casefold;
+
+  /* The other patterns, in the order they were given.  */
+  struct fnmatch_pattern *other;
+  idx_t others, others_alloc;
+};
+
+/* Store into P the case-folded form of the file name NAME, of length
+   LEN, followed by a null byte, and return the address of the null
+   byte.  P must have room for 4 * LEN + 1 bytes.
+
+   In a multibyte locale, characters are stored in UTF-8, whatever the
+   locale's encoding, so that folded names sort by code point, as
+   mbscasecmp sorts them.  An encoding error is stored as the byte
+   0xF8, which does not occur in UTF-8, followed by the byte in error,
+   so that it sorts after all characters.  */
+
+char *
+fold_file_name (char *p, char const *name, idx_t len)
+{
+  if (MB_CUR_MAX == 1)
+    for (idx_t i = 0; i < len; i++)
+      *p++ = tolower ((unsigned char) name[i]);
+  else
+    for (char const *lim = name + len; name < lim; )
+      {
+	mcel_t g = mcel_scan (name, lim);
+	name += g.len;
+	if (g.err)
+	  {
+	    *p++ = (char) 0xF8;
+	    *p++ = g.err;
+	    continue;
+	  }
+
+	char32_t c = c32tolower (g.ch);
+	if (c < 0x80)
+	  {
+	    *p++ = c;
+	    continue;
+	  }
+	static unsigned char const lead[] = { 0, 0, 0xC0, 0xE0, 0xF0 };
+	int n = c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+	for (int i = n - 1; 0 < i; i--)
+	  {
+	    p[i] = 0x80 | (c & 0x3F);
+	    c >>= 6;
+	  }
+	p[0] = lead[n] | c;
+	p += n;
+      }
+  *p = '\0';
+  return p;
+}
+
+/* Return true if the first LEN bytes of the pattern PAT have a
+   wildcard that is not escaped by a backslash.  This is how gnulib's
+   exclude module decides which patterns need fnmatch.  */
+
+static bool
+has_wildcards (char const *pat, idx_t len)
+{
+  for (idx_t i = 0; i < len; i++)
+    switch (pat[i])
+      {
+      case '\\':
+	i += i + 1 < len;
+	break;
+
+      case '?': case '*': case '[': case ']':
+	return true;
+      }
+  return false;
+}
+
+/* Return a newly allocated copy of the first LEN bytes of the pattern
+   PAT, which has no wildcards, with its backslash escapes removed and
+   case-folded if CASEFOLD.  */
+
+static char *
+literal_string (char const *pat, idx_t len, bool casefold)
+{
+  char *lit = ximalloc (len + 1);
+  idx_t litlen = 0;
+  for (idx_t i = 0; i < len; i++)
+    {
+      i += pat[i] == '\\' && i + 1 < len;
+      lit[litlen++] = pat[i];
+    }
+  lit[litlen] = '\0';
+
+  if (!casefold)
+    return lit;
+  char *folded = ximalloc (4 * litlen + 1);
+  fold_file_name (folded, lit, litlen);
+  free (lit);
+  return folded;
+}
+
+/* Return the hash of the string S.  */
+
+static size_t
+hash_name (char const *s)
+{
+  size_t h = 0;
+  for (; *s; s++)
+    h = h * 31 + (unsigned char) *s;
+  return h ^ (h >> 15);
+}
+
+/* Return the slot of the table T where the string S is, or would be
+   put.  T must have a slot.  */
+
+static char **
+table_slot (struct name_table const *t, char const *s)
+{
+  size_t mask = t->slots - 1;
+  for (size_t i = hash_name (s) & mask; ; i = (i + 1) & mask)
+    if (!t->slot[i] || STREQ (t->slot[i], s))
+      return &t->slot[i];
+}
+
+/* Add the string S, which the table T now owns, to T.  */
+
+static void
+table_add (struct name_table *t, char *s)
+{
+  if (t->slots <= 2 * t->used + 1)
+    {
+      struct name_table old = *t;
+      t->slots = old.slots ? 2 * old.slots : 16;
+      t->slot = xicalloc (t->slots, sizeof *t->slot);
+      for (idx_t i = 0; i < old.slots; i++)
+	if (old.slot[i])
+	  *table_slot (t, old.slot[i]) = old.slot[i];
+      free (old.slot);
+    }
+
+  char **slot = table_slot (t, s);
+  if (*slot)
+    free (s);
+  else
+    {
+      *slot = s;
+      t->used++;
+    }
+}
+
+/* Return true if the table T has the string S.  */
+
+static bool
+table_has (struct name_table const *t, char const *s)
+{
+  return t->slots && *table_slot (t, s);
+}
+
+/* Return the byte of the string S, of length LEN, that is reached
+   after I bytes when reading S forwards, or backwards if REVERSED.  */
+
+static unsigned char
+nth_byte (char const *s, idx_t len, idx_t i, bool reversed)
+{
+  return s[reversed ? len - 1 - i : i];
+}
+
+/* Add the string S, of length LEN, to the trie T, reversed if
+   REVERSED.  */
+
+static void
+trie_add (struct trie *t, char const *s, idx_t len, bool reversed)
+{
+  if (!t->nodes)
+    {
+      t->node = xpalloc (nullptr, &t->nodes_alloc, 1, -1, sizeof *t->node);
+      t->node[0] = (struct trie_node) {0};
+      t->nodes = 1;
+    }
+
+  idx_t n = 0;
+  for (idx_t i = 0; i < len; i++)
+    {
+      unsigned char b = nth_byte (s, len, i, reversed);
+      idx_t c = t->node[n].child;
+      while (c && t->node[c].byte != b)
+	c = t->node[c].sibling;
+      if (!c)
+	{
+	  if (t->nodes == t->nodes_alloc)
+	    t->node = xpalloc (t->node, &t->nodes_alloc, 1, -1,
+			       sizeof *t->node);
+	  c = t->nodes++;
+	  t->node[c] = (struct trie_node) { .sibling = t->node[n].child,
+					    .byte = b };
+	  t->node[n].child = c;
+	}
+      n = c;
+    }
+  t->node[n].end = true;
+}
+
+/* Return true if a string of the trie T is a prefix of the string S,
+   of length LEN, or a suffix of S if REVERSED.  */
+
+static bool
+trie_match (struct trie const *t, char const *s, idx_t len, bool reversed)
+{
+  if (!t->nodes)
+    return false;
+
+  for (idx_t i = 0, n = 0; ; i++)
+    {
+      if (t->node[n].end)
+	return true;
+      if (i == len)
+	return false;
+      unsigned char b = nth_byte (s, len, i, reversed);
+      for (n = t->node[n].child; n && t->node[n].byte != b;
+	   n = t->node[n].sibling)
+	continue;
+      if (!n)
+	return false;
+    }
+}
+
+/* Add the shell pattern PATTERN, with the options OPTIONS suitable for
+   gnulib's add_exclude, to the set *SETP, creating the set if *SETP is
+   null.  Of the options, only FNM_CASEFOLD matters.  */
+
+void
+name_set_add (struct name_set **setp, char const *pattern, int options)
+{
+  struct name_set *set = *setp;
+  if (!set)
+    set = *setp = xizalloc (sizeof *set);
+
+  bool casefold = !!(options & FNM_CASEFOLD);
+  struct literal_patterns *lit = &set->literal[casefold];
+  idx_t len = strlen (pattern);
+
+  if (!has_wildcards (pattern, len))
+    table_add (&lit->exact, literal_string (pattern, len, casefold));
+  else if (pattern[0] == '*' && !has_wildcards (pattern + 1, len - 1)
+	   && (casefold || self_synchronizing_encoding ()))
+    {
+      char *suffix = literal_string (pattern + 1, len - 1, casefold);
+      trie_add (&lit->suffix, suffix, strlen (suffix), true);
+      free (suffix);
+    }
+  else if (pattern[len - 1] == '*' && !has_wildcards (pattern, len - 1))
+    {
+      /* The final '*' is not escaped, as PATTERN has a wildcard.  */
+      char *prefix = literal_string (pattern, len - 1, casefold);
+      trie_add (&lit->prefix, prefix, strlen (prefix), false);
+      free (prefix);
+    }
+  else
+    {
+      if (set->others == set->others_alloc)
+	set->other = xpalloc (set->other, &set->others_alloc, 1, -1,
+			      sizeof *set->other);
+      set->other[set->others++] = (struct fnmatch_pattern)
+	{ .pattern = xstrdup (pattern), .options = options & FNM_CASEFOLD };
+      return;
+    }
+
+  set->casefold |= casefold;
+}
+
+/* Return true if the string S, of length LEN, matches one of LIT.  */
+
+static bool
+literal_match (struct literal_patterns const *lit, char const *s, idx_t len)
+{
+  return (table_has (&lit->exact, s)
+	  || trie_match (&lit->suffix, s, len, true)
+	  || trie_match (&lit->prefix, s, len, false));
+}
+
+/* Return true if the file name NAME matches a pattern of SET.
+   A null SET has no patterns.  */
+
+bool
+name_set_match (struct name_set const *set, char const *name)
+{
+  if (!set)
+    return false;
+
+  idx_t len = strlen (name);
+  if (literal_match (&set->literal[false], name, len))
+    return true;
+
+  if (set->casefold)
+    {
+      char buf[1024];
+      char *folded = 4 * len < sizeof buf ? buf : ximalloc (4 * len + 1);
+      idx_t foldedlen = fold_file_name (folded, name, len) - folded;
+      bool match = literal_match (&set->literal[true], folded, foldedlen);
+      if (folded != buf)
+	free (folded);
+      if (match)
+	return true;
+    }
+
+  for (idx_t i = 0; i < set->others; i++)
+    if (fnmatch (set->other[i].pattern, name, set->other[i].options) == 0)
+      return true;
+  return false;
+}
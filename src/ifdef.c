@@ -23,7 +23,7 @@
 #include "diff.h"
 
 #include <c-ctype.h>
-#include <xmalloca.h>
+#include <xalloc.h>
 
 struct group
 {
@@ -31,19 +31,70 @@ struct group
   lin from, upto; /* start and limit lines for this group of lines */
 };
 
-static char const *format_group (FILE *, char const *, char,
-                                 struct group const *);
-static char const *do_printf_spec (FILE *, char const *,
-                                   struct file_data const *, lin,
-                                   struct group const *);
-static char const *scan_char_literal (char const *, char *);
+/* The operations of a compiled line or line group format.  */
+enum format_op
+{
+  FORMAT_TEXT,			/* Output literal text.  */
+  FORMAT_LINE,			/* %l: the line without its newline.  */
+  FORMAT_LINE_NL,		/* %L: the line.  */
+  FORMAT_OLD_LINES,		/* %<: lines from the first file.  */
+  FORMAT_UNCHANGED_LINES,	/* %=: common lines.  */
+  FORMAT_NEW_LINES,		/* %>: lines from the second file.  */
+  FORMAT_DECIMAL,		/* %dn etc.: a number in plain decimal.  */
+  FORMAT_NUMBER,		/* %5dn etc.: a number, via printf.  */
+  FORMAT_IF,			/* %(A=B?: go to TARGET unless A == B.  */
+  FORMAT_GOTO			/* Go to TARGET.  */
+};
+
+/* An instruction of a compiled format.  */
+struct format_insn
+{
+  enum format_op op;
+
+  /* For FORMAT_DECIMAL and FORMAT_NUMBER, LETTER[0] names the number.
+     For FORMAT_IF, LETTER[I] names the Ith number to compare, or is
+     zero if VALUE[I] is that number.  */
+  char letter[2];
+  intmax_t value[2];
+
+  /* For FORMAT_TEXT, the offset and length of the text in the
+     program's text buffer.  For FORMAT_NUMBER, the offset of the
+     printf format.  */
+  idx_t text, len;
+
+  /* For FORMAT_IF and FORMAT_GOTO, the index of the next instruction.  */
+  idx_t target;
+};
+
+/* A format compiled into a list of instructions, so that its
+   %-escapes are parsed once rather than for every line or group.  */
+struct format_program
+{
+  struct format_insn *insn;
+  idx_t n, alloc;
+
+  /* The literal text and printf formats used by the instructions.  */
+  char *text;
+  idx_t text_len, text_alloc;
+
+  /* Instructions at or after this index may be jumped to, so text
+     must not be appended to the instruction before it.  */
+  idx_t label;
+};
+
+/* The compiled group formats, and line formats.  */
+static struct format_program group_program[CHANGED + 1];
+static struct format_program line_program[NEW + 1];
+
 static lin groups_letter_value (struct group const *, char);
-static void format_ifdef (char const *, lin, lin, lin, lin);
+static void format_ifdef (struct format_program const *, lin, lin, lin, lin);
 static void print_ifdef_hunk (struct change *);
-static void print_ifdef_lines (FILE *, char const *, struct group const *);
+static void print_ifdef_lines (enum changes, struct group const *);
+static char const *scan_char_literal (char const *, char *);
 
-static lin next_line0;
-static lin next_line1;
+/* Next line number to be printed in the two input files.  */
+static thread_local lin next_line0;
+static thread_local lin next_line1;
 
 /* Print the edit-script SCRIPT as a merged #ifdef file.  */
 
@@ -51,12 +102,12 @@ void
 print_ifdef_script (struct change *script)
 {
   next_line0 = next_line1 = - curr.file[0].prefix_lines;
-  print_script (script, find_change, print_ifdef_hunk);
-  if (next_line0 < curr.file[0].valid_lines
-      || next_line1 < curr.file[1].valid_lines)
+  if (print_script (script, find_change, print_ifdef_hunk)
+      && (next_line0 < curr.file[0].valid_lines
+	  || next_line1 < curr.file[1].valid_lines))
     {
       begin_output ();
-      format_ifdef (group_format[UNCHANGED],
+      format_ifdef (&group_program[UNCHANGED],
 		    next_line0, curr.file[0].valid_lines,
 		    next_line1, curr.file[1].valid_lines);
     }
@@ -79,40 +130,157 @@ print_ifdef_hunk (struct change *hunk)
 
   /* Print lines up to this change.  */
   if (next_line0 < first0 || next_line1 < first1)
-    format_ifdef (group_format[UNCHANGED],
+    format_ifdef (&group_program[UNCHANGED],
                   next_line0, first0,
                   next_line1, first1);
 
   /* Print this change.  */
   next_line0 = last0 + 1;
   next_line1 = last1 + 1;
-  format_ifdef (group_format[changes],
+  format_ifdef (&group_program[changes],
                 first0, next_line0,
                 first1, next_line1);
 }
 
-/* Print a set of lines according to FORMAT.
-   Lines BEG0 up to END0 are from the first file;
-   lines BEG1 up to END1 are from the second file.  */
+/* Append the instruction INSN to PROG, and return its index.  */
+
+static idx_t
+emit (struct format_program *prog, struct format_insn insn)
+{
+  if (prog->n == prog->alloc)
+    prog->insn = xpalloc (prog->insn, &prog->alloc, 1, -1, sizeof *prog->insn);
+  prog->insn[prog->n] = insn;
+  return prog->n++;
+}
+
+/* Append the N bytes at P to the text buffer of PROG, and return
+   their offset.  */
+
+static idx_t
+add_text (struct format_program *prog, char const *p, idx_t n)
+{
+  idx_t off = prog->text_len;
+  if (prog->text_alloc - off < n)
+    prog->text = xpalloc (prog->text, &prog->text_alloc,
+			  n - (prog->text_alloc - off), -1, 1);
+  memcpy (prog->text + off, p, n);
+  prog->text_len += n;
+  return off;
+}
+
+/* Append an instruction to PROG that outputs the character C,
+   extending the previous instruction if it outputs the text just
+   before.  */
 
 static void
-format_ifdef (char const *format, lin beg0, lin end0, lin beg1, lin end1)
+emit_char (struct format_program *prog, char c)
+{
+  struct format_insn *last
+    = prog->label < prog->n ? &prog->insn[prog->n - 1] : nullptr;
+  if (last && last->op == FORMAT_TEXT
+      && last->text + last->len == prog->text_len)
+    {
+      add_text (prog, &c, 1);
+      last->len++;
+    }
+  else
+    emit (prog, (struct format_insn) { .op = FORMAT_TEXT,
+				       .text = add_text (prog, &c, 1),
+				       .len = 1 });
+}
+
+/* Return the index of the next instruction of PROG, which is to be
+   jumped to.  */
+
+static idx_t
+label (struct format_program *prog)
 {
-  format_group (outfile, format, '\0',
-		((struct group const[])
-		 {{.file = &curr.file[0], .from = beg0, .upto = end0},
-		  {.file = &curr.file[1], .from = beg1, .upto = end1}}));
+  return prog->label = prog->n;
 }
 
-/* Print to file OUT a set of lines according to FORMAT.
+/* Return true if C is a letter that names a number in a group format.  */
+
+static bool
+group_letter (char c)
+{
+  return c && strchr ("eflmnEFLMN", c);
+}
+
+/* Compile the printf-style SPEC, which is part of a line format if
+   IN_LINE and a group format otherwise, and append it to PROG.
+   Yield the address of the first character after SPEC, or a null
+   pointer if SPEC is ill-formed.  */
+
+static char const *
+compile_printf_spec (struct format_program *prog, char const *spec,
+		     bool in_line)
+{
+  char const *f = spec;
+  char c;
+
+  /* Scan printf-style SPEC of the form %[-'0]*[0-9]*(.[0-9]*)?[cdoxX].  */
+  dassert (*f == '%');
+  f++;
+  while ((c = *f++) == '-' || c == '\'' || c == '0')
+    continue;
+  while (c_isdigit (c))
+    c = *f++;
+  if (c == '.')
+    while (c_isdigit (c = *f++))
+      continue;
+  if (!c)
+    return nullptr;
+  char c1 = *f++;
+
+  switch (c)
+    {
+    case 'c':
+      if (c1 != '\'')
+        return nullptr;
+      else
+        {
+          char value;
+          f = scan_char_literal (f, &value);
+          if (!f)
+            return nullptr;
+	  emit_char (prog, value);
+        }
+      break;
+
+    case 'd': case 'o': case 'x': case 'X':
+      {
+	if (! (in_line ? c1 == 'n' : group_letter (c1)))
+	  return nullptr;
+
+	/* For example, if the spec is "%3xn" and pI is "l", use the printf
+	   format spec "%3lx".  Here the spec prefix is "%3".  */
+	idx_t spec_prefix_len = f - spec - 2;
+	struct format_insn insn = { .op = FORMAT_DECIMAL, .letter = {c1} };
+	if (! (spec_prefix_len == 1 && c == 'd'))
+	  {
+	    insn.op = FORMAT_NUMBER;
+	    insn.text = add_text (prog, spec, spec_prefix_len);
+	    add_text (prog, pI, sizeof pI - 1);
+	    add_text (prog, (char []) {c, '\0'}, 2);
+	  }
+	emit (prog, insn);
+      }
+      break;
+
+    default:
+      return nullptr;
+    }
+
+  return f;
+}
+
+/* Compile the group format FORMAT, appending it to PROG.
    The format ends at the first free instance of ENDCHAR.
-   Yield the address of the terminating character.
-   GROUPS specifies which lines to print.
-   If OUT is zero, do not actually print anything; just scan the format.  */
+   Yield the address of the terminating character.  */
 
 static char const *
-format_group (FILE *out, char const *format, char endchar,
-              struct group const *groups)
+compile_group_format (struct format_program *prog, char const *format,
+		      char endchar)
 {
   char const *f = format;
 
@@ -128,9 +296,9 @@ format_group (FILE *out, char const *format, char endchar,
             break;
 
           case '(':
-            /* Print if-then-else format e.g. '%(n=1?thenpart:elsepart)'.  */
+            /* If-then-else format e.g. '%(n=1?thenpart:elsepart)'.  */
             {
-              intmax_t value[2];
+	      struct format_insn test = { .op = FORMAT_IF };
 
               for (int i = 0; i < 2; i++)
                 {
@@ -138,52 +306,52 @@ format_group (FILE *out, char const *format, char endchar,
                     {
                       char *fend;
                       errno = 0;
-                      value[i] = strtoimax (f, &fend, 10);
+                      test.value[i] = strtoimax (f, &fend, 10);
                       if (errno)
                         goto bad_format;
                       f = fend;
                     }
                   else
                     {
-                      value[i] = groups_letter_value (groups, *f);
-                      if (value[i] < 0)
+		      if (!group_letter (*f))
                         goto bad_format;
-                      f++;
+		      test.letter[i] = *f++;
                     }
                   if (*f++ != "=?"[i])
                     goto bad_format;
                 }
 
-	      bool equal_values = value[0] == value[1];
-              FILE *thenout = equal_values ? out : nullptr;
-	      FILE *elseout = equal_values ? nullptr : out;
-              f = format_group (thenout, f, ':', groups);
+	      idx_t test_insn = emit (prog, test);
+              f = compile_group_format (prog, f, ':');
               if (*f)
                 {
-                  f = format_group (elseout, f + 1, ')', groups);
+		  idx_t skip_insn
+		    = emit (prog, (struct format_insn) { .op = FORMAT_GOTO });
+		  prog->insn[test_insn].target = label (prog);
+                  f = compile_group_format (prog, f + 1, ')');
+		  prog->insn[skip_insn].target = label (prog);
                   if (*f)
                     f++;
                 }
+	      else
+		prog->insn[test_insn].target = label (prog);
             }
             continue;
 
           case '<':
-            /* Print lines deleted from first file.  */
-            print_ifdef_lines (out, line_format[OLD], &groups[0]);
+	    emit (prog, (struct format_insn) { .op = FORMAT_OLD_LINES });
             continue;
 
           case '=':
-            /* Print common lines.  */
-            print_ifdef_lines (out, line_format[UNCHANGED], &groups[0]);
+	    emit (prog, (struct format_insn) { .op = FORMAT_UNCHANGED_LINES });
             continue;
 
           case '>':
-            /* Print lines inserted from second file.  */
-            print_ifdef_lines (out, line_format[NEW], &groups[1]);
+	    emit (prog, (struct format_insn) { .op = FORMAT_NEW_LINES });
             continue;
 
           default:
-            f = do_printf_spec (out, f - 2, nullptr, 0, groups);
+            f = compile_printf_spec (prog, f - 2, false);
             if (f)
               continue;
             /* Fall through. */
@@ -194,13 +362,150 @@ format_group (FILE *out, char const *format, char endchar,
           }
        }
 
-      if (out)
-        putc (c, out);
+      emit_char (prog, c);
     }
 
   return f;
 }
 
+/* Compile the line format FORMAT into PROG.  */
+
+static void
+compile_line_format (struct format_program *prog, char const *format)
+{
+  for (char const *f = format; *f; )
+    {
+      char c = *f++;
+      char const *f1 = f;
+      if (c == '%')
+	{
+	  c = *f++;
+	  switch (c)
+	    {
+	    case '%':
+	      break;
+
+	    case 'l':
+	      emit (prog, (struct format_insn) { .op = FORMAT_LINE });
+	      continue;
+
+	    case 'L':
+	      emit (prog, (struct format_insn) { .op = FORMAT_LINE_NL });
+	      continue;
+
+	    default:
+	      f = compile_printf_spec (prog, f - 2, true);
+	      if (f)
+		continue;
+	      c = '%';
+	      f = f1;
+	      break;
+	    }
+	}
+
+      emit_char (prog, c);
+    }
+}
+
+/* Compile the line and group formats.  Call this once, after the
+   formats are known and before any output.  */
+
+void
+compile_ifdef_formats (void)
+{
+  for (int i = 0; i <= CHANGED; i++)
+    compile_group_format (&group_program[i], group_format[i], '\0');
+  for (int i = 0; i <= NEW; i++)
+    compile_line_format (&line_program[i], line_format[i]);
+}
+
+/* Output VALUE as instruction INSN of PROG specifies.  */
+
+static void
+print_format_number (struct format_program const *prog,
+		     struct format_insn const *insn, lin value)
+{
+  if (insn->op == FORMAT_NUMBER)
+    fprintf (outfile, prog->text + insn->text, value);
+  else
+    {
+      char buf[INT_STRLEN_BOUND (lin)];
+      char *p = buf + sizeof buf;
+      lin v = value;
+      do
+	*--p = '0' + (v < 0 ? - (v % 10) : v % 10);
+      while ((v /= 10) != 0);
+      if (value < 0)
+	*--p = '-';
+      fwrite (p, 1, buf + sizeof buf - p, outfile);
+    }
+}
+
+/* Return the value of operand I of the if-then-else instruction INSN,
+   for the line group pair GROUPS.  */
+
+static intmax_t
+test_operand (struct format_insn const *insn, int i,
+	      struct group const *groups)
+{
+  return (insn->letter[i]
+	  ? groups_letter_value (groups, insn->letter[i])
+	  : insn->value[i]);
+}
+
+/* Print a set of lines according to the compiled group format PROG.
+   Lines BEG0 up to END0 are from the first file;
+   lines BEG1 up to END1 are from the second file.  */
+
+static void
+format_ifdef (struct format_program const *prog,
+	      lin beg0, lin end0, lin beg1, lin end1)
+{
+  struct group const groups[] =
+    {{.file = &curr.file[0], .from = beg0, .upto = end0},
+     {.file = &curr.file[1], .from = beg1, .upto = end1}};
+
+  for (idx_t i = 0; i < prog->n; )
+    {
+      struct format_insn const *insn = &prog->insn[i++];
+      switch (insn->op)
+	{
+	case FORMAT_TEXT:
+	  fwrite (prog->text + insn->text, 1, insn->len, outfile);
+	  break;
+
+	case FORMAT_OLD_LINES:
+	  print_ifdef_lines (OLD, &groups[0]);
+	  break;
+
+	case FORMAT_UNCHANGED_LINES:
+	  print_ifdef_lines (UNCHANGED, &groups[0]);
+	  break;
+
+	case FORMAT_NEW_LINES:
+	  print_ifdef_lines (NEW, &groups[1]);
+	  break;
+
+	case FORMAT_DECIMAL: case FORMAT_NUMBER:
+	  print_format_number (prog, insn,
+			       groups_letter_value (groups, insn->letter[0]));
+	  break;
+
+	case FORMAT_IF:
+	  if (test_operand (insn, 0, groups) != test_operand (insn, 1, groups))
+	    i = insn->target;
+	  break;
+
+	case FORMAT_GOTO:
+	  i = insn->target;
+	  break;
+
+	default:
+	  unreachable ();
+	}
+    }
+}
+
 /* For the line group pair G, return the number corresponding to LETTER.
    Return -1 if LETTER is not a group format letter.  */
 static lin
@@ -226,18 +531,17 @@ groups_letter_value (struct group const *g, char letter)
     }
 }
 
-/* Print to file OUT, using FORMAT to print the line group GROUP.
-   But do nothing if OUT is zero.  */
+/* Print the line group GROUP, using the line format for lines of
+   kind WHICH.  */
 static void
-print_ifdef_lines (FILE *out, char const *format,
-                   struct group const *group)
+print_ifdef_lines (enum changes which, struct group const *group)
 {
-  if (!out)
-    return;
-
+  char const *format = line_format[which];
+  struct format_program const *prog = &line_program[which];
   struct file_data const *file = group->file;
   char const *const *linbuf = file->linbuf;
   lin from = group->from, upto = group->upto;
+  FILE *out = outfile;
 
   /* If possible, use a single fwrite; it's faster.  */
   if (!expand_tabs && format[0] == '%')
@@ -258,123 +562,38 @@ print_ifdef_lines (FILE *out, char const *format,
     }
 
   for (;  from < upto;  from++)
-    {
-      char c;
-      char const *f = format;
-
-      while ((c = *f++))
-        {
-          char const *f1 = f;
-          if (c == '%')
-	   {
-	    c = *f++;
-	    switch (c)
-              {
-              case '%':
-                break;
-
-              case 'l':
-                output_1_line (linbuf[from],
-                               (linbuf[from + 1]
-                                - (linbuf[from + 1][-1] == '\n')),
-                               nullptr, nullptr);
-                continue;
-
-              case 'L':
-                output_1_line (linbuf[from], linbuf[from + 1],
-			       nullptr, nullptr);
-                continue;
-
-              default:
-                f = do_printf_spec (out, f - 2, file, from, nullptr);
-                if (f)
-                  continue;
-                c = '%';
-                f = f1;
-                break;
-              }
-	   }
-
-          putc (c, out);
-        }
-    }
-}
-
-static char const *
-do_printf_spec (FILE *out, char const *spec,
-                struct file_data const *file, lin n,
-                struct group const *groups)
-{
-  char const *f = spec;
-  char c;
-
-  /* Scan printf-style SPEC of the form %[-'0]*[0-9]*(.[0-9]*)?[cdoxX].  */
-  dassert (*f == '%');
-  f++;
-  while ((c = *f++) == '-' || c == '\'' || c == '0')
-    continue;
-  while (c_isdigit (c))
-    c = *f++;
-  if (c == '.')
-    while (c_isdigit (c = *f++))
-      continue;
-  char c1 = *f++;
-
-  switch (c)
-    {
-    case 'c':
-      if (c1 != '\'')
-        return nullptr;
-      else
-        {
-          char value;
-          f = scan_char_literal (f, &value);
-          if (!f)
-            return nullptr;
-          if (out)
-            putc (value, out);
-        }
-      break;
-
-    case 'd': case 'o': case 'x': case 'X':
+    for (idx_t i = 0; i < prog->n; i++)
       {
-        lin value;
-
-        if (file)
-          {
-            if (c1 != 'n')
-              return nullptr;
-            value = translate_line_number (file, n);
-          }
-        else
-          {
-            value = groups_letter_value (groups, c1);
-            if (value < 0)
-              return nullptr;
-          }
-
-        if (out)
-          {
-            /* For example, if the spec is "%3xn" and pI is "l", use the printf
-               format spec "%3lx".  Here the spec prefix is "%3".  */
-            idx_t spec_prefix_len = f - spec - 2;
-            idx_t pI_len = sizeof pI - 1;
-            char *format = xmalloca (spec_prefix_len + pI_len + 2);
-            char *p = mempcpy (format, spec, spec_prefix_len);
-            p = stpcpy (p, pI);
-            *p++ = c;
-            *p = '\0';
-            fprintf (out, format, value);
-            freea (format);
-          }
+	struct format_insn const *insn = &prog->insn[i];
+	switch (insn->op)
+	  {
+	  case FORMAT_TEXT:
+	    if (insn->len == 1)
+	      putc (prog->text[insn->text], out);
+	    else
+	      fwrite (prog->text + insn->text, 1, insn->len, out);
+	    break;
+
+	  case FORMAT_LINE:
+	    output_1_line (linbuf[from],
+			   (linbuf[from + 1]
+			    - (linbuf[from + 1][-1] == '\n')),
+			   nullptr, nullptr);
+	    break;
+
+	  case FORMAT_LINE_NL:
+	    output_1_line (linbuf[from], linbuf[from + 1], nullptr, nullptr);
+	    break;
+
+	  case FORMAT_DECIMAL: case FORMAT_NUMBER:
+	    print_format_number (prog, insn,
+				 translate_line_number (file, from));
+	    break;
+
+	  default:
+	    unreachable ();
+	  }
       }
-      break;
-
-    default:
-      return nullptr;
-    }
-
-  return f;
 }
 
 /* Scan the character literal represented in the string LIT; LIT points just
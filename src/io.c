@@ -62,21 +62,21 @@ struct equivclass
 
 /* Hash-table: array of buckets, each being a chain of equivalence classes.
    buckets[-1] is reserved for incomplete lines.  */
-static lin *buckets;
+static thread_local lin *buckets;
 
 /* Number of buckets in the hash table array, not counting buckets[-1].  */
-static idx_t nbuckets;
+static thread_local idx_t nbuckets;
 
 /* Array in which the equivalence classes are allocated.
    The bucket-chains go through the elements in this array.
    The number of an equivalence class is its index in this array.  */
-static struct equivclass *equivs;
+static thread_local struct equivclass *equivs;
 
 /* Index of first free element in the array 'equivs'.  */
-static lin equivs_index;
+static thread_local lin equivs_index;
 
 /* Number of elements allocated in the array 'equivs'.  */
-static idx_t equivs_alloc;
+static thread_local idx_t equivs_alloc;
 
 /* The file buffer, considered as an array of bytes rather than
    as an array of words.  */
@@ -125,6 +125,8 @@ sip (struct file_data *current, bool skip_test)
       current->bufsize = sizeof (word);
       current->buffer = ximalloc (current->bufsize);
     }
+  else if (take_prefetched_data (current))
+    return !skip_test && binary_file_p (current->buffer, current->buffered);
   else
     {
       idx_t blksize;
@@ -1232,7 +1234,7 @@ find_identical_ends (struct file_data filevec[])
      rounded up to the next power of 2 to speed index computation.  */
 
   lin alloc_lines0, prefix_count, middle_guess;
-  if (no_diff_means_no_output && ! function_regexp.fastmap
+  if (no_diff_means_no_output && ! function_regexp
       && context < LIN_MAX / 4 && context < n0)
     {
       middle_guess = guess_lines (0, 0, p0 - filevec[0].prefix_end);
@@ -1367,6 +1369,23 @@ read_files (struct file_data filevec[], bool pretend_binary)
 
   filevec[0].equiv_max = filevec[1].equiv_max = equivs_index;
 
+  /* Lines in the same class are equally blank.  They also equally
+     match -I's regular expression, unless the class has lines whose
+     text differs in case or white space.  */
+  bool memoize = ((ignore_blank_lines || ignore_regexp)
+		  && ! (ignore_regexp
+			&& (ignore_case
+			    || ignore_white_space != IGNORE_NO_WHITE_SPACE)));
+  filevec[0].ignorable = filevec[1].ignorable
+    = memoize ? xizalloc (equivs_index) : nullptr;
+
+  if (function_regexp)
+    {
+      struct function_index *fi = xmalloc (sizeof *fi);
+      *fi = (struct function_index) { .scanned = filevec[0].linbuf_base };
+      filevec[0].function_index = fi;
+    }
+
   free (equivs);
   free (buckets - 1);
 
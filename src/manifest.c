@@ -0,0 +1,820 @@
+/* Tree manifests for GNU DIFF.
+
+   Copyright (C) 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* With --save-manifest=FILE, diff writes to FILE a manifest of a
+   directory tree: for each file in the tree, its type, permissions,
+   size, and name relative to the top of the tree, and also the SHA-256
+   digest of a regular file's contents, the target of a symbolic link,
+   and the device numbers of a special file.  With --from-manifest=FILE
+   or --to-manifest=FILE, diff -q compares such a manifest with a
+   directory, reporting what diff -rq would report if it compared the
+   directory with the tree as it was when the manifest was saved.  Only
+   the directory is read, so the tree described by the manifest need
+   not exist any more.
+
+   The first line of a manifest is a header followed by the name of the
+   top of the tree, as given when the manifest was saved; a comparison
+   reports the tree's files under that name.  Each following line is an
+   entry "TYPE MODE SIZE EXTRA NAME", where TYPE is a letter as output
+   by 'ls -l', MODE the permissions in octal, EXTRA the digest, link
+   target, "MAJOR,MINOR" or "-", and NAME the relative file name.  In
+   names and link targets, each byte that is not a graphic ASCII
+   character, and each backslash, is written as a backslash followed by
+   three octal digits, so that the fields are separated by spaces.  */
+
+#include "diff.h"
+
+#include <c-ctype.h>
+#include <careadlinkat.h>
+#include <diagnose.h>
+#include <error.h>
+#include <file-type.h>
+#include <filenamecat.h>
+#include <quote.h>
+#include <sha256.h>
+#include <xalloc.h>
+
+#ifdef MAJOR_IN_MKDEV
+# include <sys/mkdev.h>
+#elif defined MAJOR_IN_SYSMACROS
+# include <sys/sysmacros.h>
+#elif !defined major /* Might be defined in sys/types.h.  */
+# define major(dev)  (((dev) >> 8) & 0xff)
+# define minor(dev)  ((dev) & 0xff)
+# define makedev(maj, min)  (((maj) << 8) | (min))
+#endif
+
+/* The start of the first line of a manifest.  */
+static char const manifest_header[] = "GNU diff manifest 1 ";
+
+/* File types, with their letters in manifests and their directory
+   entry types.  */
+static struct
+{
+  char letter;
+  char detype;
+  mode_t type;
+} const file_types[] =
+  {
+    { '-', DE_REG, S_IFREG },
+    { 'd', DE_DIR, S_IFDIR },
+    { 'l', DE_LNK, S_IFLNK },
+    { 'c', DE_CHR, S_IFCHR },
+    { 'b', DE_BLK, S_IFBLK },
+    { 'p', DE_FIFO, S_IFIFO },
+    { 's', DE_SOCK, S_IFSOCK },
+  };
+
+/* An entry of a manifest.  */
+struct manifest_entry
+{
+  /* The name of the file's directory relative to the top of the tree,
+     or "" for the top.  */
+  char *parent;
+
+  /* The file's status, as far as the manifest records it.  */
+  mode_t mode;
+  off_t size;
+  dev_t rdev;
+
+  /* The target of a symbolic link, or null.  */
+  char *target;
+
+  /* The digest of a regular file's contents.  */
+  unsigned char digest[SHA256_DIGEST_SIZE];
+
+  /* The last component of the file's name, preceded by its directory
+     entry type as in a directory's names, so that the name can be
+     paired with those of a directory by pair_dir_entries.  */
+  char detype;
+  char name[];
+};
+
+static_assert (offsetof (struct manifest_entry, name)
+	       == offsetof (struct manifest_entry, detype) + 1);
+
+/* A manifest being compared with a directory.  */
+struct manifest
+{
+  /* The name of the top of the tree, as recorded in the manifest.  */
+  char *root;
+
+  /* The entries, sorted by parent directory.  */
+  struct manifest_entry **entry;
+  idx_t entries;
+
+  /* The side of the comparison, 0 or 1, that the manifest stands for,
+     and whether to compare subdirectories (-r).  */
+  int side;
+  bool recursive;
+};
+
+/* A directory being read, and its ancestors, for detecting loops.  */
+struct ancestor
+{
+  struct stat stat;
+  struct ancestor const *parent;
+};
+
+/* Return the letter for the file type of MODE, or '?' if none.  */
+
+static char
+type_letter (mode_t mode)
+{
+  for (int i = 0; i < sizeof file_types / sizeof *file_types; i++)
+    if ((mode & S_IFMT) == file_types[i].type)
+      return file_types[i].letter;
+  return '?';
+}
+
+/* Output the string S to OUT, escaped as described above.  */
+
+static void
+put_escaped (char const *s, FILE *out)
+{
+  for (; *s; s++)
+    {
+      unsigned char c = *s;
+      if (c_isgraph (c) && c != '\\')
+	putc (c, out);
+      else
+	fprintf (out, "\\%03o", c);
+    }
+}
+
+/* Remove in place the escapes of the string S.  Return true if
+   successful, false if S is not validly escaped.  */
+
+static bool
+unescape (char *s)
+{
+  char *p = s;
+  for (; *s; s++)
+    {
+      if (*s != '\\')
+	*p++ = *s;
+      else
+	{
+	  int c = 0;
+	  for (int i = 1; i <= 3; i++)
+	    {
+	      if (! ('0' <= s[i] && s[i] <= '7'))
+		return false;
+	      c = 8 * c + s[i] - '0';
+	    }
+	  if (! (0 < c && c <= UCHAR_MAX))
+	    return false;
+	  *p++ = c;
+	  s += 3;
+	}
+    }
+  *p = '\0';
+  return true;
+}
+
+/* Return the name of the file BASE in the directory DIR, where both
+   names are relative to the top of a tree.  */
+
+static char *
+subname (char const *dir, char const *base)
+{
+  return dir[0] ? file_name_concat (dir, base, nullptr) : xstrdup (base);
+}
+
+/* Close the directory DIR if it is open.  Return true if successful,
+   false (after diagnosing) otherwise.  */
+
+static bool
+close_dir (struct file_data *dir)
+{
+  if (dir->dirstream ? closedir (dir->dirstream) < 0
+      : 0 <= dir->desc && close (dir->desc) < 0)
+    {
+      perror_with_name (dir->name);
+      return false;
+    }
+  return true;
+}
+
+/* Return true if the directory whose status is ST is among ANCESTOR.  */
+
+static bool
+dir_loop (struct stat const *st, struct ancestor const *ancestor)
+{
+  for (; ancestor; ancestor = ancestor->parent)
+    if (same_file (&ancestor->stat, st))
+      return true;
+  return false;
+}
+
+/* Store into DIGEST the SHA-256 digest of the contents of the file
+   NAME in the directory DIRFD.  Return true if successful, false
+   (setting errno) otherwise.  */
+
+static bool
+file_digest (int dirfd, char const *name,
+	     unsigned char digest[SHA256_DIGEST_SIZE])
+{
+  int fd = openat (dirfd, name,
+		   (O_RDONLY | O_CLOEXEC | O_BINARY
+		    | (no_dereference_symlinks ? O_NOFOLLOW : 0)));
+  if (fd < 0)
+    return false;
+
+  struct sha256_ctx ctx;
+  sha256_init_ctx (&ctx);
+  char buf[64 * 1024];
+  ssize_t n;
+  while (0 < (n = read (fd, buf, sizeof buf)))
+    sha256_process_bytes (buf, n, &ctx);
+  int err = errno;
+  close (fd);
+  if (n < 0)
+    {
+      errno = err;
+      return false;
+    }
+  sha256_finish_ctx (&ctx, digest);
+  return true;
+}
+
+/* Write to OUT the entries for the files in the directory DIR, whose
+   name relative to the top of the tree is REL, and for the files in
+   its subdirectories.  Open DIR relative to PARENTDIRFD if it is not
+   open.  DIR's status and those of its ancestors are in ANCESTOR.
+   Return EXIT_SUCCESS, or EXIT_TROUBLE if there was trouble.  */
+
+static int
+save_dir (FILE *out, int parentdirfd, struct file_data *dir, char const *rel,
+	  struct ancestor const *ancestor)
+{
+  idx_t npairs;
+  char *data;
+  struct name_pair *pair = pair_dir_entries (parentdirfd, dir, 0,
+					     nullptr, 0, &npairs, &data);
+  if (!pair)
+    {
+      perror_with_name (dir->name);
+      return EXIT_TROUBLE;
+    }
+
+  int status = EXIT_SUCCESS;
+  for (idx_t i = 0; i < npairs; i++)
+    {
+      char const *base = pair[i].name[0];
+      char *name = file_name_concat (dir->name, base, nullptr);
+      char *relname = subname (rel, base);
+      struct stat st;
+      unsigned char digest[SHA256_DIGEST_SIZE];
+      char linkbuf[128];
+      char *target = nullptr;
+
+      if (fstatat (dir->desc, base, &st,
+		   no_dereference_symlinks ? AT_SYMLINK_NOFOLLOW : 0) != 0
+	  || (S_ISREG (st.st_mode) && !file_digest (dir->desc, base, digest))
+	  || (S_ISLNK (st.st_mode)
+	      && ! (target = careadlinkat (dir->desc, base,
+					   linkbuf, sizeof linkbuf,
+					   nullptr, readlinkat))))
+	{
+	  perror_with_name (name);
+	  status = EXIT_TROUBLE;
+	}
+      else
+	{
+	  fprintf (out, "%c %04o %jd ", type_letter (st.st_mode),
+		   (unsigned int) (st.st_mode & ~S_IFMT),
+		   (intmax_t) st.st_size);
+	  if (S_ISREG (st.st_mode))
+	    for (int j = 0; j < SHA256_DIGEST_SIZE; j++)
+	      fprintf (out, "%02x", digest[j]);
+	  else if (target)
+	    put_escaped (target, out);
+	  else if (S_ISCHR (st.st_mode) || S_ISBLK (st.st_mode))
+	    fprintf (out, "%jd,%jd",
+		     (intmax_t) major (st.st_rdev),
+		     (intmax_t) minor (st.st_rdev));
+	  else
+	    putc ('-', out);
+	  putc (' ', out);
+	  put_escaped (relname, out);
+	  putc ('\n', out);
+
+	  if (S_ISDIR (st.st_mode))
+	    {
+	      struct ancestor a = { st, ancestor };
+	      struct file_data sub = { .name = name, .desc = UNOPENED };
+	      if (dir_loop (&st, ancestor))
+		{
+		  error (0, 0, _("%s: recursive directory loop"),
+			 squote (0, name));
+		  status = EXIT_TROUBLE;
+		}
+	      else
+		{
+		  int v = save_dir (out, dir->desc, &sub, relname, &a);
+		  if (!close_dir (&sub))
+		    v = EXIT_TROUBLE;
+		  status = MAX (status, v);
+		}
+	    }
+	}
+
+      if (target != linkbuf)
+	free (target);
+      free (relname);
+      free (name);
+    }
+
+  free (pair);
+  free (data);
+  return status;
+}
+
+/* Save to FILE a manifest of the directory DIRNAME and the files
+   under it.  Return EXIT_SUCCESS, or EXIT_TROUBLE if there was
+   trouble.  */
+
+int
+save_manifest (char const *file, char const *dirname)
+{
+  struct ancestor top = { .parent = nullptr };
+  if ((no_dereference_symlinks ? lstat : stat) (dirname, &top.stat) != 0)
+    {
+      perror_with_name (dirname);
+      return EXIT_TROUBLE;
+    }
+  if (!S_ISDIR (top.stat.st_mode))
+    {
+      errno = ENOTDIR;
+      perror_with_name (dirname);
+      return EXIT_TROUBLE;
+    }
+
+  FILE *out = fopen (file, "w");
+  if (!out)
+    pfatal_with_name (file);
+  fputs (manifest_header, out);
+  put_escaped (dirname, out);
+  putc ('\n', out);
+
+  struct file_data dir = { .name = dirname, .desc = UNOPENED };
+  int status = save_dir (out, AT_FDCWD, &dir, "", &top);
+  if (!close_dir (&dir))
+    status = EXIT_TROUBLE;
+  if (ferror (out) || fclose (out) != 0)
+    {
+      perror_with_name (file);
+      status = EXIT_TROUBLE;
+    }
+  return status;
+}
+
+/* Return the entry in LINE, a line of a manifest without its newline,
+   or null if LINE is not a valid entry.  LINE is modified.  */
+
+static struct manifest_entry *
+parse_entry (char *line)
+{
+  /* Split the line into its fields.  */
+  enum { FIELDS = 5 };
+  char *field[FIELDS];
+  char *p = line;
+  for (int i = 0; i < FIELDS; i++)
+    {
+      field[i] = p;
+      p += strcspn (p, " ");
+      if (i < FIELDS - 1)
+	{
+	  if (!*p)
+	    return nullptr;
+	  *p++ = '\0';
+	}
+    }
+  if (*p)
+    return nullptr;
+
+  int t = 0;
+  for (; t < sizeof file_types / sizeof *file_types; t++)
+    if (field[0][0] == file_types[t].letter)
+      break;
+  if (field[0][0] != '?' && t == sizeof file_types / sizeof *file_types)
+    return nullptr;
+  bool known_type = t < sizeof file_types / sizeof *file_types;
+  mode_t type = known_type ? file_types[t].type : 0;
+
+  char *end;
+  unsigned long int mode = strtoul (field[1], &end, 8);
+  if (field[0][1] || end == field[1] || *end || mode & S_IFMT)
+    return nullptr;
+  intmax_t size = strtoimax (field[2], &end, 10);
+  if (end == field[2] || *end || size < 0)
+    return nullptr;
+
+  char *name = field[4];
+  if (! (unescape (name) && name[0] && name[0] != '/')
+      || name[strlen (name) - 1] == '/' || strstr (name, "//"))
+    return nullptr;
+  char *base = strrchr (name, '/');
+  base = base ? base + 1 : name;
+  idx_t baselen = strlen (base);
+
+  struct manifest_entry *e
+    = xmalloc (MAX (sizeof *e,
+		    offsetof (struct manifest_entry, name) + baselen + 1));
+  *e = (struct manifest_entry) {
+    .parent = ximemdup0 (name, base == name ? 0 : base - 1 - name),
+    .mode = type | mode,
+    .size = size,
+    .detype = known_type ? file_types[t].detype : DE_OTHER,
+  };
+  memcpy (e->name, base, baselen + 1);
+
+  char *extra = field[3];
+  bool ok = true;
+  if (S_ISREG (e->mode))
+    {
+      ok = strlen (extra) == 2 * SHA256_DIGEST_SIZE;
+      for (int i = 0; ok && i < SHA256_DIGEST_SIZE; i++)
+	{
+	  unsigned int byte;
+	  ok = (c_isxdigit (extra[2 * i]) && c_isxdigit (extra[2 * i + 1])
+		&& sscanf (extra + 2 * i, "%2x", &byte) == 1);
+	  e->digest[i] = byte;
+	}
+    }
+  else if (S_ISLNK (e->mode))
+    {
+      ok = unescape (extra) && extra[0];
+      e->target = xstrdup (extra);
+    }
+  else if (S_ISCHR (e->mode) || S_ISBLK (e->mode))
+    {
+      intmax_t maj, min;
+      int n = -1;
+      ok = (sscanf (extra, "%jd,%jd%n", &maj, &min, &n) == 2
+	    && !extra[n] && 0 <= maj && 0 <= min);
+      e->rdev = makedev (maj, min);
+    }
+  else
+    ok = STREQ (extra, "-");
+
+  if (!ok)
+    {
+      free (e->parent);
+      free (e->target);
+      free (e);
+      return nullptr;
+    }
+  return e;
+}
+
+/* Compare the manifest entries *E1 and *E2 by their parent
+   directories.  */
+
+static int
+compare_parents (void const *e1, void const *e2)
+{
+  struct manifest_entry const *const *a = e1;
+  struct manifest_entry const *const *b = e2;
+  return strcmp ((*a)->parent, (*b)->parent);
+}
+
+/* Load into M the manifest FILE.  */
+
+static void
+load_manifest (struct manifest *m, char const *file)
+{
+  FILE *f = fopen (file, "r");
+  if (!f)
+    pfatal_with_name (file);
+
+  char *line = nullptr;
+  size_t linesize = 0;
+  intmax_t lineno = 1;
+  ssize_t len = getline (&line, &linesize, f);
+  idx_t headerlen = sizeof manifest_header - 1;
+  if (! (headerlen < len && line[len - 1] == '\n'
+	 && memcmp (line, manifest_header, headerlen) == 0))
+    error (EXIT_TROUBLE, 0, _("%s: not a diff manifest"), squote (0, file));
+  line[len - 1] = '\0';
+  if (! (unescape (line + headerlen) && line[headerlen]))
+    error (EXIT_TROUBLE, 0, _("%s:%jd: invalid manifest entry"),
+	   squote (0, file), lineno);
+  m->root = xstrdup (line + headerlen);
+
+  idx_t entries_alloc = 0;
+  while (0 < (len = getline (&line, &linesize, f)))
+    {
+      lineno++;
+      bool newline = line[len - 1] == '\n';
+      line[len - newline] = '\0';
+      struct manifest_entry *e = newline ? parse_entry (line) : nullptr;
+      if (!e)
+	error (EXIT_TROUBLE, 0, _("%s:%jd: invalid manifest entry"),
+	       squote (0, file), lineno);
+      if (m->entries == entries_alloc)
+	m->entry = xpalloc (m->entry, &entries_alloc, 1, -1, sizeof *m->entry);
+      m->entry[m->entries++] = e;
+    }
+
+  free (line);
+  if (ferror (f) || fclose (f) != 0)
+    pfatal_with_name (file);
+
+  qsort (m->entry, m->entries, sizeof *m->entry, compare_parents);
+}
+
+/* Free the contents of the manifest M.  */
+
+static void
+free_manifest (struct manifest *m)
+{
+  for (idx_t i = 0; i < m->entries; i++)
+    {
+      free (m->entry[i]->parent);
+      free (m->entry[i]->target);
+      free (m->entry[i]);
+    }
+  free (m->entry);
+  free (m->root);
+}
+
+/* Return the index of the first entry of M whose parent directory is
+   DIR, or of the entry where it would be.  */
+
+static idx_t
+first_child (struct manifest const *m, char const *dir)
+{
+  idx_t lo = 0, hi = m->entries;
+  while (lo < hi)
+    {
+      idx_t mid = lo + (hi - lo) / 2;
+      if (strcmp (m->entry[mid]->parent, dir) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static int compare_dir (struct manifest const *, char const *, char const *,
+			int, struct file_data *, struct ancestor const *);
+
+/* Compare the manifest entry E of M, for the file in the directory
+   whose name relative to the top of the tree is REL and whose name
+   as reported is MDIR, with the file LNAME in the directory DIR,
+   whose status and those of its ancestors are in ANCESTOR.  Report
+   as compare_files does.  Return EXIT_SUCCESS if the files are the
+   same, EXIT_FAILURE if they differ, and EXIT_TROUBLE if there was
+   trouble.  */
+
+static int
+compare_entry (struct manifest const *m, struct manifest_entry const *e,
+	       char const *rel, char const *mdir,
+	       struct file_data *dir, char const *lname,
+	       struct ancestor const *ancestor)
+{
+  int side = m->side;
+  char *name[2];
+  name[side] = file_name_concat (mdir, e->name, nullptr);
+  name[!side] = file_name_concat (dir->name, lname, nullptr);
+  struct stat st[2];
+  st[side] = (struct stat) { .st_mode = e->mode, .st_size = e->size,
+			     .st_rdev = e->rdev };
+  int status = EXIT_SUCCESS;
+
+  if (fstatat (dir->desc, lname, &st[!side],
+	       no_dereference_symlinks ? AT_SYMLINK_NOFOLLOW : 0) != 0)
+    {
+      perror_with_name (name[!side]);
+      status = EXIT_TROUBLE;
+    }
+  else if (S_ISDIR (st[0].st_mode) && S_ISDIR (st[1].st_mode))
+    {
+      if (!m->recursive)
+	message ("Common subdirectories: %s and %s\n",
+		 squote (0, name[0]), squote (1, name[1]));
+      else if (dir_loop (&st[!side], ancestor))
+	{
+	  error (0, 0, _("%s: recursive directory loop"),
+		 squote (0, name[!side]));
+	  status = EXIT_TROUBLE;
+	}
+      else
+	{
+	  struct ancestor a = { st[!side], ancestor };
+	  struct file_data sub = { .name = name[!side], .desc = UNOPENED };
+	  char *subrel = subname (rel, e->name);
+	  status = compare_dir (m, subrel, name[side], dir->desc, &sub, &a);
+	  if (!close_dir (&sub))
+	    status = EXIT_TROUBLE;
+	  free (subrel);
+	}
+    }
+  else if (! STREQ (c_file_type (&st[0]), c_file_type (&st[1]))
+	   || ! (S_ISREG (st[0].st_mode) || S_ISLNK (st[0].st_mode)
+		 || S_ISCHR (st[0].st_mode) || S_ISBLK (st[0].st_mode)))
+    {
+      message ("File %s is a %s while file %s is a %s\n",
+	       squote (0, name[0]), gettext (c_file_type (&st[0])),
+	       squote (1, name[1]), gettext (c_file_type (&st[1])));
+      status = EXIT_FAILURE;
+    }
+  else if (S_ISLNK (st[0].st_mode))
+    {
+      char linkbuf[128];
+      char *target[2];
+      target[side] = e->target;
+      target[!side] = careadlinkat (dir->desc, lname, linkbuf, sizeof linkbuf,
+				    nullptr, readlinkat);
+      if (!target[!side])
+	{
+	  perror_with_name (name[!side]);
+	  status = EXIT_TROUBLE;
+	}
+      else
+	{
+	  if (!STREQ (target[0], target[1]))
+	    {
+	      message ("Symbolic links %s -> %s and %s -> %s differ\n",
+		       quote_n (0, name[0]), quote_n (1, target[0]),
+		       quote_n (2, name[1]), quote_n (3, target[1]));
+	      status = EXIT_FAILURE;
+	    }
+	  if (target[!side] != linkbuf)
+	    free (target[!side]);
+	}
+    }
+  else if (!S_ISREG (st[0].st_mode))
+    {
+      if (st[0].st_rdev != st[1].st_rdev)
+	{
+	  intmax_t num[] = {
+	    major (st[0].st_rdev), minor (st[0].st_rdev),
+	    major (st[1].st_rdev), minor (st[1].st_rdev)
+	  };
+	  enum { n_num = sizeof num / sizeof *num };
+	  char numbuf[n_num][INT_BUFSIZE_BOUND (intmax_t)];
+	  for (int i = 0; i < n_num; i++)
+	    sprintf (numbuf[i], "%"PRIdMAX, num[i]);
+
+	  message ((S_ISCHR (st[0].st_mode)
+		    ? ("Character special files %s (%s, %s)"
+		       " and %s (%s, %s) differ\n")
+		    : ("Block special files %s (%s, %s)"
+		       " and %s (%s, %s) differ\n")),
+		   quote_n (0, name[0]), numbuf[0], numbuf[1],
+		   quote_n (2, name[1]), numbuf[2], numbuf[3]);
+	  status = EXIT_FAILURE;
+	}
+    }
+  else
+    {
+      /* Files of different sizes differ.  Otherwise, read the file in
+	 the directory and compare its digest with the manifest's.  */
+      unsigned char digest[SHA256_DIGEST_SIZE];
+      if (st[0].st_size == st[1].st_size
+	  && !file_digest (dir->desc, lname, digest))
+	{
+	  perror_with_name (name[!side]);
+	  status = EXIT_TROUBLE;
+	}
+      else if (st[0].st_size != st[1].st_size
+	       || memcmp (digest, e->digest, sizeof digest) != 0)
+	{
+	  message ("Files %s and %s differ\n",
+		   squote (0, name[0]), squote (1, name[1]));
+	  status = EXIT_FAILURE;
+	}
+    }
+
+  free (name[0]);
+  free (name[1]);
+  return status;
+}
+
+/* Compare the entries of the manifest M for the directory whose name
+   relative to the top of the tree is REL, and whose name as reported
+   is MDIR, with the files in the directory DIR, opening DIR relative
+   to PARENTDIRFD if it is not open.  DIR's status and those of its
+   ancestors are in ANCESTOR.  Report as diff_dirs does, and return
+   the maximum of the values returned by compare_entry, or
+   EXIT_TROUBLE if DIR cannot be read.  */
+
+static int
+compare_dir (struct manifest const *m, char const *rel, char const *mdir,
+	     int parentdirfd, struct file_data *dir,
+	     struct ancestor const *ancestor)
+{
+  /* The names of the manifest's entries for the directory, less those
+     that are excluded, as dir_read would exclude them.  */
+  idx_t first = first_child (m, rel), lim = first;
+  while (lim < m->entries && STREQ (m->entry[lim]->parent, rel))
+    lim++;
+  char const **names = xinmalloc (lim - first + 1, sizeof *names);
+  idx_t n = 0;
+  for (idx_t i = first; i < lim; i++)
+    {
+      struct manifest_entry const *e = m->entry[i];
+      if (! (name_set_match (excluded, e->name)
+	     || (included && !name_set_match (included, e->name)
+		 && !S_ISDIR (e->mode))))
+	names[n++] = e->name;
+    }
+
+  idx_t npairs;
+  char *data;
+  struct name_pair *pair = pair_dir_entries (parentdirfd, dir, !m->side,
+					     names, n, &npairs, &data);
+  if (!pair)
+    {
+      perror_with_name (dir->name);
+      free (names);
+      return EXIT_TROUBLE;
+    }
+
+  int status = EXIT_SUCCESS;
+  for (idx_t i = 0; i < npairs; i++)
+    {
+      char const *mname = pair[i].name[m->side];
+      char const *lname = pair[i].name[!m->side];
+      int v;
+      if (! (mname && lname))
+	{
+	  /* See POSIX 1003.1-2017 for this format.  */
+	  message ("Only in %s: %s\n",
+		   squote (0, mname ? mdir : dir->name),
+		   squote (1, mname ? mname : lname));
+	  v = EXIT_FAILURE;
+	}
+      else
+	{
+	  struct manifest_entry const *e
+	    = ((struct manifest_entry const *)
+	       (mname - offsetof (struct manifest_entry, name)));
+	  v = compare_entry (m, e, rel, mdir, dir, lname, ancestor);
+	}
+      status = MAX (status, v);
+    }
+
+  free (pair);
+  free (data);
+  free (names);
+  return status;
+}
+
+/* Compare the manifest FILE with the directory DIRNAME, the manifest
+   standing for the first tree if SIDE is 0 and for the second if SIDE
+   is 1.  If RECURSIVE, compare subdirectories too.  Report as diff -q
+   does, and return EXIT_SUCCESS if the trees are the same,
+   EXIT_FAILURE if they differ, and EXIT_TROUBLE if there was
+   trouble.  */
+
+int
+compare_manifest (char const *file, int side, char const *dirname,
+		  bool recursive)
+{
+  struct manifest m = { .side = side, .recursive = recursive };
+  load_manifest (&m, file);
+
+  int status;
+  struct ancestor top = { .parent = nullptr };
+  if ((no_dereference_symlinks ? lstat : stat) (dirname, &top.stat) != 0)
+    {
+      perror_with_name (dirname);
+      status = EXIT_TROUBLE;
+    }
+  else if (!S_ISDIR (top.stat.st_mode))
+    {
+      errno = ENOTDIR;
+      perror_with_name (dirname);
+      status = EXIT_TROUBLE;
+    }
+  else
+    {
+      struct file_data dir = { .name = dirname, .desc = UNOPENED };
+      status = compare_dir (&m, "", m.root, AT_FDCWD, &dir, &top);
+      if (!close_dir (&dir))
+	status = EXIT_TROUBLE;
+    }
+
+  free_manifest (&m);
+  return status;
+}
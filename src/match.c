@@ -0,0 +1,559 @@
+/* Match lines against sets of regular expressions for GNU DIFF.
+
+   Copyright (C) 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Options like -I and -F can be given many times, and a line matches
+   if it matches any of the regular expressions.  Rather than trying
+   every regular expression on every line, find a literal string that
+   any match of each regular expression must contain, and scan each
+   line for all these strings at once with an Aho-Corasick automaton.
+   A regular expression that is just a literal string, perhaps
+   anchored, is matched by the automaton alone; any other regular
+   expression is tried only on lines that contain its literal.
+   Regular expressions without a usable literal are combined into one
+   disjunction, which is tried on every line that nothing else
+   matched.  */
+
+#include "diff.h"
+
+#include <diagnose.h>
+#include <error.h>
+#include <mcel.h>
+#include <xalloc.h>
+
+#include <uchar.h>
+
+/* Where a pattern's literal must occur in a line.  */
+enum anchoring
+{
+  ANYWHERE = 0,
+  AT_START = 1,
+  AT_END = 2,
+  WHOLE_LINE = AT_START | AT_END
+};
+
+/* One regular expression of a set.  */
+struct pattern
+{
+  /* The source of the regular expression, and its length.  */
+  char const *source;
+  idx_t source_len;
+
+  /* The regular expression compiled on its own, or null if the
+     literal alone decides whether a line matches.  */
+  struct re_pattern_buffer *buf;
+
+  /* A literal string that every match contains, and its length.
+     The length is zero if no useful literal was found.  */
+  char *literal;
+  idx_t literal_len;
+
+  /* If BUF is null, where LITERAL must occur in a line.  */
+  enum anchoring anchoring;
+
+  /* The next pattern whose literal ends in the same automaton state,
+     or -1.  */
+  idx_t next;
+
+  /* The value of the set's SEARCHES when this pattern was last tried
+     with re_search.  */
+  idx_t tried;
+};
+
+struct regexp_set
+{
+  /* The regular expressions, in the order they were given.  */
+  struct pattern *pattern;
+  idx_t patterns, patterns_alloc;
+
+  /* True if some pattern matches every line, and if some pattern
+     matches every empty line.  */
+  bool match_all, match_empty;
+
+  /* The disjunction of the regular expressions that have no useful
+     literal, or null if there are none.  */
+  struct re_pattern_buffer *residue;
+
+  /* The Aho-Corasick automaton, if any pattern has a useful literal.
+     Bytes are mapped to classes by BYTE_CLASS; bytes that occur in no
+     literal all have class 0.  DELTA[S * CLASSES + C] is the state
+     after reading a byte of class C in state S, where state 0 is the
+     start state.  FIRST[S] is the first pattern whose literal ends in
+     state S, or -1.  REPORT[S] is the state for the longest proper
+     suffix of S's string that is the end of some literal, or -1.  */
+  unsigned char byte_class[UCHAR_MAX + 1];
+  idx_t classes, states;
+  idx_t *delta;
+  idx_t *first;
+  idx_t *report;
+
+  /* The number of searches done so far, for PATTERN[I].tried.  */
+  idx_t searches;
+};
+
+/* Return the index just past the bracket expression of PATTERN
+   (of length LEN) that starts at index I, or LEN if it is unterminated.  */
+static idx_t
+skip_bracket (char const *pattern, idx_t len, idx_t i)
+{
+  i++;
+  if (i < len && pattern[i] == '^')
+    i++;
+  if (i < len && pattern[i] == ']')
+    i++;
+  for (; i < len; i++)
+    if (pattern[i] == ']')
+      return i + 1;
+    else if (pattern[i] == '['
+	     && i + 1 < len && strchr (":=.", pattern[i + 1]))
+      {
+	char delim = pattern[i + 1];
+	for (i += 2; i + 1 < len; i++)
+	  if (pattern[i] == delim && pattern[i + 1] == ']')
+	    break;
+	i++;
+      }
+  return len;
+}
+
+/* Return the index just past the group of PATTERN (of length LEN)
+   whose "\(" starts at index I, or LEN if it is unterminated.  */
+static idx_t
+skip_group (char const *pattern, idx_t len, idx_t i)
+{
+  int depth = 0;
+  while (i < len)
+    if (pattern[i] == '[')
+      i = skip_bracket (pattern, len, i);
+    else if (pattern[i] == '\\' && i + 1 < len)
+      {
+	depth += (pattern[i + 1] == '(') - (pattern[i + 1] == ')');
+	i += 2;
+	if (depth == 0)
+	  return i;
+      }
+    else
+      i++;
+  return len;
+}
+
+/* Set P's literal to the longest literal string that every match of
+   its regular expression must contain.  If the literal alone decides
+   whether a line matches, set P's anchoring accordingly and return
+   true; otherwise return false.  Be conservative: it is always safe
+   to find a shorter literal, or none.
+
+   The regular expression uses RE_SYNTAX_GREP.  An operator like '*'
+   makes its operand optional, so it removes the preceding character
+   from the literal being accumulated.  Groups are skipped, as they
+   might be optional, and alternation means there is no single
+   literal.  */
+static bool
+analyze_pattern (struct pattern *p)
+{
+  char const *pat = p->source;
+  idx_t len = p->source_len;
+  char *run = ximalloc (len + 1);
+  idx_t run_len = 0;
+
+  /* The index in RUN of the last character added, or -1 if the
+     previous item of the regular expression was not added to RUN.  */
+  idx_t last = -1;
+
+  bool pure = true;
+  int anchoring = ANYWHERE;
+  p->literal = ximalloc (len + 1);
+  p->literal_len = 0;
+
+  idx_t i = 0;
+  if (i < len && pat[i] == '^')
+    {
+      anchoring |= AT_START;
+      i++;
+    }
+  idx_t start = i;
+
+  while (i < len)
+    {
+      bool end_run = false, drop_last = false;
+      char const *lit = nullptr;
+      idx_t litlen = 1;
+
+      switch (pat[i])
+	{
+	case '\n':
+	  goto give_up;
+
+	case '.':
+	  end_run = true;
+	  i++;
+	  break;
+
+	case '[':
+	  end_run = true;
+	  i = skip_bracket (pat, len, i);
+	  break;
+
+	case '*':
+	  if (i == start)
+	    lit = &pat[i++];
+	  else
+	    {
+	      drop_last = end_run = true;
+	      i++;
+	    }
+	  break;
+
+	case '$':
+	  if (i + 1 == len)
+	    {
+	      anchoring |= AT_END;
+	      i++;
+	    }
+	  else
+	    lit = &pat[i++];
+	  break;
+
+	case '\\':
+	  if (i + 1 == len)
+	    goto give_up;
+	  switch (pat[i + 1])
+	    {
+	    case '|': case ')':
+	      goto give_up;
+
+	    case '(':
+	      end_run = true;
+	      i = skip_group (pat, len, i);
+	      break;
+
+	    case '{':
+	      drop_last = end_run = true;
+	      for (i += 2; i + 1 < len; i++)
+		if (pat[i] == '\\' && pat[i + 1] == '}')
+		  break;
+	      i += 2;
+	      break;
+
+	    case '?':
+	      drop_last = end_run = true;
+	      i += 2;
+	      break;
+
+	    case '.': case '*': case '[': case ']': case '^': case '$':
+	    case '\\': case '/':
+	      lit = &pat[i + 1];
+	      i += 2;
+	      break;
+
+	    default:
+	      /* \+, a back-reference, or a GNU extension like \w or \<.  */
+	      end_run = true;
+	      i += 2;
+	      break;
+	    }
+	  break;
+
+	default:
+	  lit = &pat[i];
+	  if (MB_CUR_MAX > 1)
+	    {
+	      mcel_t g = mcel_scan (lit, pat + len);
+	      litlen = g.len;
+	    }
+	  i += litlen;
+	  break;
+	}
+
+      if (lit)
+	{
+	  last = run_len;
+	  memcpy (run + run_len, lit, litlen);
+	  run_len += litlen;
+	}
+      else
+	{
+	  pure = false;
+	  if (drop_last && 0 <= last)
+	    run_len = last;
+	  if (end_run)
+	    {
+	      if (p->literal_len < run_len)
+		{
+		  memcpy (p->literal, run, run_len);
+		  p->literal_len = run_len;
+		}
+	      run_len = 0;
+	      last = -1;
+	    }
+	}
+    }
+
+  if (p->literal_len < run_len)
+    {
+      memcpy (p->literal, run, run_len);
+      p->literal_len = run_len;
+    }
+  free (run);
+  p->anchoring = anchoring;
+  return pure;
+
+ give_up:
+  free (run);
+  p->literal_len = 0;
+  return false;
+}
+
+/* Return true if a byte string that is a valid multibyte character
+   string matches wherever its bytes occur, i.e., if no character's
+   encoding occurs within another character's encoding.  This is true
+   in unibyte locales and in UTF-8.  */
+bool
+self_synchronizing_encoding (void)
+{
+  if (MB_CUR_MAX == 1)
+    return true;
+  mbstate_t mbs = {0};
+  char32_t c;
+  return mbrtoc32 (&c, "\xc4\x80", 2, &mbs) == 2 && c == 0x100;
+}
+
+/* Add the regular expression PATTERN to the set *SETP,
+   creating the set if *SETP is null.  */
+void
+regexp_set_add (struct regexp_set **setp, char const *pattern)
+{
+  struct regexp_set *set = *setp;
+  if (!set)
+    set = *setp = xizalloc (sizeof *set);
+
+  idx_t patlen = strlen (pattern);
+  struct re_pattern_buffer *buf = xizalloc (sizeof *buf);
+  char const *m = re_compile_pattern (pattern, patlen, buf);
+  if (m)
+    error (EXIT_TROUBLE, 0, "%s: %s", squote (0, pattern), m);
+
+  if (set->patterns == set->patterns_alloc)
+    set->pattern = xpalloc (set->pattern, &set->patterns_alloc, 1, -1,
+			    sizeof *set->pattern);
+  struct pattern *p = &set->pattern[set->patterns++];
+  p->source = pattern;
+  p->source_len = patlen;
+  p->next = -1;
+  p->tried = -1;
+
+  /* Keep the compiled form only if the literal does not suffice.  */
+  if (analyze_pattern (p)
+      && (p->literal_len == 0 || self_synchronizing_encoding ()))
+    {
+      regfree (buf);
+      free (buf);
+      p->buf = nullptr;
+      if (p->literal_len == 0)
+	{
+	  if (p->anchoring == WHOLE_LINE)
+	    set->match_empty = true;
+	  else
+	    set->match_all = true;
+	}
+    }
+  else
+    {
+      buf->fastmap = ximalloc (UCHAR_MAX + 1);
+      p->buf = buf;
+    }
+}
+
+/* Build the Aho-Corasick automaton for the literals of SET.  */
+static void
+build_automaton (struct regexp_set *set)
+{
+  /* Map each byte that occurs in a literal to its own class.  */
+  idx_t total = 0;
+  set->classes = 1;
+  for (idx_t k = 0; k < set->patterns; k++)
+    {
+      struct pattern const *p = &set->pattern[k];
+      total += p->literal_len;
+      for (idx_t i = 0; i < p->literal_len; i++)
+	{
+	  unsigned char c = p->literal[i];
+	  if (!set->byte_class[c])
+	    set->byte_class[c] = set->classes++;
+	}
+    }
+
+  /* Build the trie of literals.  A missing transition is -1 for now.  */
+  idx_t classes = set->classes;
+  idx_t states_alloc = total + 1;
+  set->delta = xinmalloc (states_alloc, classes * sizeof *set->delta);
+  set->first = xinmalloc (states_alloc, sizeof *set->first);
+  set->report = xinmalloc (states_alloc, sizeof *set->report);
+  for (idx_t c = 0; c < classes; c++)
+    set->delta[c] = -1;
+  set->first[0] = -1;
+  set->states = 1;
+
+  for (idx_t k = 0; k < set->patterns; k++)
+    {
+      struct pattern *p = &set->pattern[k];
+      if (!p->literal_len)
+	continue;
+      idx_t s = 0;
+      for (idx_t i = 0; i < p->literal_len; i++)
+	{
+	  idx_t *t = &set->delta[s * classes
+				 + set->byte_class[(unsigned char) p->literal[i]]];
+	  if (*t < 0)
+	    {
+	      idx_t n = set->states++;
+	      for (idx_t c = 0; c < classes; c++)
+		set->delta[n * classes + c] = -1;
+	      set->first[n] = -1;
+	      *t = n;
+	    }
+	  s = *t;
+	}
+      p->next = set->first[s];
+      set->first[s] = k;
+    }
+
+  /* Complete the transitions and compute the report links
+     breadth first, using FAIL[S] for the state of the longest proper
+     suffix of S's string that is in the trie.  */
+  idx_t *fail = xinmalloc (set->states, 2 * sizeof *fail);
+  idx_t *queue = fail + set->states;
+  idx_t head = 0, tail = 0;
+  set->report[0] = -1;
+  for (idx_t c = 0; c < classes; c++)
+    {
+      idx_t t = set->delta[c];
+      if (t < 0)
+	set->delta[c] = 0;
+      else
+	{
+	  fail[t] = 0;
+	  set->report[t] = -1;
+	  queue[tail++] = t;
+	}
+    }
+  while (head < tail)
+    {
+      idx_t s = queue[head++];
+      for (idx_t c = 0; c < classes; c++)
+	{
+	  idx_t *t = &set->delta[s * classes + c];
+	  idx_t f = set->delta[fail[s] * classes + c];
+	  if (*t < 0)
+	    *t = f;
+	  else
+	    {
+	      fail[*t] = f;
+	      set->report[*t] = 0 <= set->first[f] ? f : set->report[f];
+	      queue[tail++] = *t;
+	    }
+	}
+    }
+  free (fail);
+}
+
+/* Finish building SET, after all its regular expressions are added.  */
+void
+regexp_set_finish (struct regexp_set *set)
+{
+  /* Combine the patterns that have no literal into one disjunction.  */
+  char *residue = nullptr;
+  idx_t residue_len = 0;
+  idx_t residue_patterns = 0;
+  for (idx_t k = 0; k < set->patterns; k++)
+    {
+      struct pattern *p = &set->pattern[k];
+      if (p->buf && !p->literal_len)
+	{
+	  idx_t sep = residue_patterns++ ? 2 : 0;
+	  residue = xirealloc (residue, residue_len + sep + p->source_len + 1);
+	  memcpy (residue + residue_len, "\\|", sep);
+	  memcpy (residue + residue_len + sep, p->source, p->source_len + 1);
+	  residue_len += sep + p->source_len;
+	  if (residue_patterns == 1)
+	    set->residue = p->buf;
+	  else
+	    {
+	      regfree (p->buf);
+	      free (p->buf);
+	    }
+	  p->buf = nullptr;
+	}
+    }
+  if (1 < residue_patterns)
+    {
+      /* Compile the disjunction of the regexps.
+	 (If just one regexp had no literal, it is already compiled.)  */
+      char const *m = re_compile_pattern (residue, residue_len, set->residue);
+      if (m)
+	error (EXIT_TROUBLE, 0, "%s: %s", squote (0, residue), m);
+    }
+  free (residue);
+
+  if (residue_patterns < set->patterns)
+    build_automaton (set);
+}
+
+/* Return true if the line LINE of length LEN, not counting any
+   trailing newline, matches a regular expression in SET.  */
+bool
+regexp_set_match (struct regexp_set *set, char const *line, idx_t len)
+{
+  if (set->match_all || (set->match_empty && len == 0))
+    return true;
+
+  if (set->delta)
+    {
+      idx_t searches = set->searches++;
+      idx_t classes = set->classes;
+      idx_t const *delta = set->delta;
+      unsigned char const *byte_class = set->byte_class;
+      idx_t s = 0;
+
+      for (idx_t i = 0; i < len; i++)
+	{
+	  s = delta[s * classes + byte_class[(unsigned char) line[i]]];
+	  for (idx_t r = 0 <= set->first[s] ? s : set->report[s];
+	       0 <= r; r = set->report[r])
+	    for (idx_t k = set->first[r]; 0 <= k; k = set->pattern[k].next)
+	      {
+		struct pattern *p = &set->pattern[k];
+		if (!p->buf)
+		  {
+		    if (! (p->anchoring & AT_START && i + 1 != p->literal_len)
+			&& ! (p->anchoring & AT_END && i + 1 != len))
+		      return true;
+		  }
+		else if (p->tried != searches)
+		  {
+		    p->tried = searches;
+		    if (0 <= re_search (p->buf, line, len, 0, len, nullptr))
+		      return true;
+		  }
+	      }
+	}
+    }
+
+  return (set->residue
+	  && 0 <= re_search (set->residue, line, len, 0, len, nullptr));
+}
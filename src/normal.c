@@ -57,7 +57,10 @@ print_normal_hunk (struct change *hunk)
   /* Print the lines that the first file has.  */
   if (changes & OLD)
     {
-      for (lin i = first0; i <= last0; i++)
+      lin i = first0 + print_line_run (initial_tab ? "<\t" : "< ", "<",
+				       &curr.file[0].linbuf[first0],
+				       last0 - first0 + 1);
+      for (; i <= last0; i++)
         {
           set_color_context (DELETE_CONTEXT);
 	  print_1_line_nl ("<", &curr.file[0].linbuf[i], true);
@@ -73,7 +76,10 @@ print_normal_hunk (struct change *hunk)
   /* Print the lines that the second file has.  */
   if (changes & NEW)
     {
-      for (lin i = first1; i <= last1; i++)
+      lin i = first1 + print_line_run (initial_tab ? ">\t" : "> ", ">",
+				       &curr.file[1].linbuf[first1],
+				       last1 - first1 + 1);
+      for (; i <= last1; i++)
         {
           set_color_context (ADD_CONTEXT);
 	  print_1_line_nl (">", &curr.file[1].linbuf[i], true);
@@ -0,0 +1,226 @@
+/* Paginated output for GNU DIFF.
+
+   Copyright (C) 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* With --paginate, the output for each pair of files is laid out the
+   way 'pr -h HEADER' lays out its input: 66-line pages, each with a
+   five-line header giving the date, HEADER and the page number, and a
+   five-line trailer.  A form feed ends the current page early.  Doing
+   this here rather than in a 'pr' subprocess saves a fork and exec for
+   every pair of files that differ.  */
+
+#include "diff.h"
+
+#if PAGINATE_INTERNALLY
+
+# include <hard-locale.h>
+# include <strftime.h>
+# include <xalloc.h>
+
+enum
+  {
+    /* The number of lines on a page, in its header, and in its
+       trailer.  */
+    PAGE_LINES = 66,
+    HEADER_LINES = 5,
+    TRAILER_LINES = 5,
+    BODY_LINES = PAGE_LINES - HEADER_LINES - TRAILER_LINES,
+
+    /* The width of the header line.  */
+    PAGE_WIDTH = 72
+  };
+
+/* The state of a paginated stream.  */
+struct pager
+{
+  /* The date and the header text, and the number of columns left over
+     for the page number and the spaces around the header text.  */
+  char *date;
+  char *header;
+  int spare_width;
+
+  /* The number of the last page started.  */
+  intmax_t page;
+
+  /* The number of lines output on the current page, or -1 if no page
+     has been started since the last one ended.  */
+  int lines;
+
+  /* True if the current line has been started but not ended.  */
+  bool mid_line;
+
+  /* True if a newline just after a form feed should be ignored.  */
+  bool after_form_feed;
+};
+
+/* Start a new page of P.  */
+
+static void
+begin_page (struct pager *p)
+{
+  /* The translation of "Page %jd" must not be much longer than
+     the original.  */
+  char page_text[256 + INT_STRLEN_BOUND (intmax_t)];
+  sprintf (page_text, _("Page %jd"), ++p->page);
+  int available = MAX (0, p->spare_width - text_width (page_text));
+  int lhs_spaces = available >> 1;
+  int rhs_spaces = available - lhs_spaces;
+  printf ("\n\n%s%*s%s%*s%s\n\n\n", p->date, lhs_spaces, " ",
+	  p->header, rhs_spaces, " ", page_text);
+  p->lines = 0;
+}
+
+/* End the current page of P, padding it to full length.  */
+
+static void
+end_page (struct pager *p)
+{
+  if (p->mid_line)
+    {
+      putchar ('\n');
+      p->lines++;
+      p->mid_line = false;
+    }
+  for (int i = p->lines; i < BODY_LINES + TRAILER_LINES; i++)
+    putchar ('\n');
+  p->lines = -1;
+}
+
+/* Paginate the SIZE bytes at BUF.  This is the write function of a
+   paginated stream.  */
+
+static ssize_t
+paginate_output (void *cookie, char const *buf, size_t size)
+{
+  struct pager *p = cookie;
+  char const *lim = buf + size;
+
+  while (buf < lim)
+    {
+      char c = *buf;
+
+      if (p->after_form_feed)
+	{
+	  p->after_form_feed = false;
+	  if (c == '\n')
+	    {
+	      buf++;
+	      continue;
+	    }
+	}
+
+      /* A full page ends just before the next output, which does not
+	 start a page of its own if it is a form feed.  */
+      if (p->lines == BODY_LINES)
+	{
+	  end_page (p);
+	  if (c == '\f')
+	    {
+	      buf++;
+	      p->after_form_feed = true;
+	      continue;
+	    }
+	}
+
+      if (p->lines < 0)
+	begin_page (p);
+
+      if (c == '\f')
+	{
+	  buf++;
+	  end_page (p);
+	  p->after_form_feed = true;
+	  continue;
+	}
+
+      /* Copy the rest of the line as-is.  */
+      char const *end = buf;
+      while (end < lim && *end != '\n' && *end != '\f')
+	end++;
+      bool newline = end < lim && *end == '\n';
+      end += newline;
+      fwrite (buf, 1, end - buf, stdout);
+      buf = end;
+      p->lines += newline;
+      p->mid_line = !newline;
+    }
+
+  return ferror (stdout) ? -1 : size;
+}
+
+/* Finish the last page and free the state.  This is the close function
+   of a paginated stream.  */
+
+static int
+close_paginated_output (void *cookie)
+{
+  struct pager *p = cookie;
+  if (0 <= p->lines)
+    end_page (p);
+  free (p->date);
+  free (p->header);
+  free (p);
+  return ferror (stdout) ? -1 : 0;
+}
+
+/* Return a stream whose output is paginated onto standard output,
+   with HEADER in the page headers.  */
+
+FILE *
+open_paginated_output (char const *header)
+{
+  struct pager *p = xmalloc (sizeof *p);
+
+  /* Date the pages with the current time, in the format that 'pr' uses.  */
+  char const *date_format = (getenv ("POSIXLY_CORRECT")
+			     && !hard_locale (LC_TIME)
+			     ? "%b %e %H:%M %Y"
+			     : "%Y-%m-%d %H:%M");
+  struct timespec now;
+  timespec_get (&now, TIME_UTC);
+  struct tm const *tm = localtime (&now.tv_sec);
+  if (tm)
+    {
+      idx_t size = nstrftime (nullptr, SIZE_MAX, date_format, tm, localtz,
+			      now.tv_nsec) + 1;
+      p->date = ximalloc (size);
+      nstrftime (p->date, size, date_format, tm, localtz, now.tv_nsec);
+    }
+  else
+    {
+      p->date = ximalloc (INT_STRLEN_BOUND (time_t) + sizeof ".000000000");
+      sprintf (p->date, "%jd.%09d", (intmax_t) now.tv_sec,
+	       (int) now.tv_nsec);
+    }
+
+  p->header = xstrdup (header);
+  p->spare_width = PAGE_WIDTH - text_width (p->date) - text_width (header);
+  p->page = 0;
+  p->lines = -1;
+  p->mid_line = p->after_form_feed = false;
+
+  FILE *f = fopencookie (p, "w",
+			 (cookie_io_functions_t) {
+			   .write = paginate_output,
+			   .close = close_paginated_output });
+  if (!f)
+    xalloc_die ();
+  return f;
+}
+
+#endif
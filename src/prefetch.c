@@ -0,0 +1,502 @@
+/* Batched opening and reading of files in directories, for GNU DIFF.
+
+   Copyright (C) 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Comparing a tree of many small files costs several system calls per
+   file: openat, fstat, read and close, each made when compare_files
+   gets to the file.  Where Linux's io_uring is available, diff_dirs
+   instead hands each run of pairs of regular files that it is about to
+   compare to prefetch_files, which opens them, gets their status and
+   reads the small ones in a few batches of operations, each batch
+   submitted with a single system call.  compare_files and sip then use
+   the results rather than making their own calls, and the files are
+   closed together with the next batch.  Where io_uring is unavailable,
+   nothing is prefetched and files are read as usual.  */
+
+#include "diff.h"
+
+#include <cmpbuf.h>
+#include <diagnose.h>
+#include <error.h>
+#include <filenamecat.h>
+#include <xalloc.h>
+
+#if HAVE_LINUX_IO_URING_H && defined STATX_BASIC_STATS
+
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/sysmacros.h>
+
+enum
+  {
+    /* The greatest number of pairs of files in a batch.  */
+    PREFETCH_PAIRS = 64,
+
+    /* The number of files in a batch, and the number of operations
+       that can be submitted at once: a batch's files are opened while
+       those of the previous batch are closed.  */
+    PREFETCH_FILES = 2 * PREFETCH_PAIRS,
+    RING_ENTRIES = 2 * PREFETCH_FILES
+  };
+
+/* A file opened in advance.  */
+struct prefetched
+{
+  /* The comparison of the directories that contain the file, the
+     index of the file's directory in it, and the file's name within
+     that directory.  */
+  struct comparison const *parent;
+  int f;
+  char const *name;
+
+  /* The file descriptor, or -1 if the file could not be opened, and
+     whether compare_files has taken it.  */
+  int desc;
+  bool taken;
+
+  /* The file's status, valid if DESC is nonnegative.  */
+  struct statx stx;
+  struct stat stat;
+
+  /* If nonnull, a buffer of BUFSIZE bytes that holds the first
+     BUFFERED bytes of the file.  */
+  word *buffer;
+  idx_t bufsize, buffered;
+};
+
+/* The files of the current batch, and how many there are.  */
+static struct prefetched file[PREFETCH_FILES];
+static int files;
+
+/* The io_uring instance: its file descriptor, and the parts of its
+   submission and completion queues that are shared with the kernel.  */
+static int ring_fd;
+static unsigned *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+
+/* Zero if the io_uring instance has not been set up yet, positive if
+   it works, negative if it is unavailable.  */
+static signed char ring_state;
+
+/* Set up the io_uring instance.  Return true if successful.  Kernels
+   that lack a shared mapping for both queues, or that cannot read from
+   the current file position, are too old to have every operation used
+   here, so do without them.  */
+
+static bool
+setup_ring (void)
+{
+  struct io_uring_params p = { 0 };
+  int fd = syscall (__NR_io_uring_setup, RING_ENTRIES, &p);
+  if (fd < 0)
+    return false;
+  if ((p.features & (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS))
+      != (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS))
+    {
+      close (fd);
+      return false;
+    }
+
+  size_t ring_size = MAX (p.sq_off.array + p.sq_entries * sizeof (unsigned),
+			  p.cq_off.cqes
+			  + p.cq_entries * sizeof (struct io_uring_cqe));
+  char *ring = mmap (nullptr, ring_size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED)
+    {
+      close (fd);
+      return false;
+    }
+  void *sqe_array = mmap (nullptr, p.sq_entries * sizeof (struct io_uring_sqe),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  fd, IORING_OFF_SQES);
+  if (sqe_array == MAP_FAILED)
+    {
+      munmap (ring, ring_size);
+      close (fd);
+      return false;
+    }
+
+  ring_fd = fd;
+  sq_tail = (unsigned *) (ring + p.sq_off.tail);
+  sq_mask = (unsigned *) (ring + p.sq_off.ring_mask);
+  sq_array = (unsigned *) (ring + p.sq_off.array);
+  cq_head = (unsigned *) (ring + p.cq_off.head);
+  cq_tail = (unsigned *) (ring + p.cq_off.tail);
+  cq_mask = (unsigned *) (ring + p.cq_off.ring_mask);
+  sqes = sqe_array;
+  cqes = (struct io_uring_cqe *) (ring + p.cq_off.cqes);
+  return true;
+}
+
+/* The number of operations queued for the next submission.  */
+static unsigned queued_ops;
+
+/* Queue an operation OPCODE on the file descriptor FD, with ADDR, LEN
+   and OFF as the operation defines them, and return it so that the
+   caller can set other members.  USER_DATA identifies the operation's
+   completion.  */
+
+static struct io_uring_sqe *
+queue_op (int opcode, int fd, void const *addr, unsigned len, uint64_t off,
+	  uint64_t user_data)
+{
+  unsigned tail = *sq_tail + queued_ops++;
+  unsigned i = tail & *sq_mask;
+  struct io_uring_sqe *sqe = &sqes[i];
+  memset (sqe, 0, sizeof *sqe);
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t) addr;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->user_data = user_data;
+  sq_array[i] = i;
+  return sqe;
+}
+
+/* Submit the queued operations, wait for all of them to complete, and
+   call DONE with the user data and result of each.  */
+
+static void
+run_ops (void (*done) (uint64_t, int))
+{
+  unsigned n = queued_ops;
+  if (!n)
+    return;
+  queued_ops = 0;
+  __atomic_store_n (sq_tail, *sq_tail + n, __ATOMIC_RELEASE);
+
+  for (unsigned submitted = 0; ; )
+    {
+      unsigned ready = (__atomic_load_n (cq_tail, __ATOMIC_ACQUIRE)
+			- *cq_head);
+      if (submitted == n && ready == n)
+	break;
+      int r = syscall (__NR_io_uring_enter, ring_fd, n - submitted,
+		       n - ready, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (0 <= r)
+	submitted += r;
+      else if (errno != EINTR && errno != EAGAIN)
+	pfatal_with_name ("io_uring_enter");
+    }
+
+  unsigned head = *cq_head;
+  for (unsigned i = 0; i < n; i++)
+    {
+      struct io_uring_cqe const *cqe = &cqes[(head + i) & *cq_mask];
+      done (cqe->user_data, cqe->res);
+    }
+  __atomic_store_n (cq_head, head + n, __ATOMIC_RELEASE);
+}
+
+/* Operations other than closing a file are identified by their file's
+   index in FILE.  Closing a file is identified by CLOSING plus the
+   index in CLOSED of the file's copy.  */
+enum { CLOSING = PREFETCH_FILES };
+static struct prefetched closed[PREFETCH_FILES];
+
+/* True if closing a file failed.  */
+static bool close_failed;
+
+/* Record the result RES of the operation identified by USER_DATA.
+   An error leaves the file to be opened and read as usual.  */
+
+static void
+record_result (uint64_t user_data, int res)
+{
+  if (CLOSING <= user_data)
+    {
+      if (res < 0)
+	{
+	  struct prefetched const *p = &closed[user_data - CLOSING];
+	  char *name = file_name_concat (p->parent->file[p->f].name,
+					 p->name, nullptr);
+	  error (0, -res, "%s", squote (0, name));
+	  free (name);
+	  close_failed = true;
+	}
+      return;
+    }
+
+  struct prefetched *p = &file[user_data];
+  if (p->desc < 0)
+    p->desc = res;
+  else if (!p->buffer)
+    {
+      if (res < 0)
+	{
+	  /* Leave the descriptor for closing, but not for comparing.  */
+	  p->taken = true;
+	}
+      else
+	{
+	  struct statx const *s = &p->stx;
+	  struct stat *st = &p->stat;
+	  memset (st, 0, sizeof *st);
+	  st->st_dev = makedev (s->stx_dev_major, s->stx_dev_minor);
+	  st->st_ino = s->stx_ino;
+	  st->st_mode = s->stx_mode;
+	  st->st_nlink = s->stx_nlink;
+	  st->st_uid = s->stx_uid;
+	  st->st_gid = s->stx_gid;
+	  st->st_rdev = makedev (s->stx_rdev_major, s->stx_rdev_minor);
+	  st->st_size = s->stx_size;
+	  st->st_blksize = s->stx_blksize;
+	  st->st_blocks = s->stx_blocks;
+	  st->st_atim = (struct timespec) { s->stx_atime.tv_sec,
+					     s->stx_atime.tv_nsec };
+	  st->st_mtim = (struct timespec) { s->stx_mtime.tv_sec,
+					     s->stx_mtime.tv_nsec };
+	  st->st_ctim = (struct timespec) { s->stx_ctime.tv_sec,
+					     s->stx_ctime.tv_nsec };
+	}
+    }
+  else if (res < 0)
+    {
+      /* The file position is unknown, so the file cannot be read
+	 as usual either.  */
+      p->taken = true;
+      free (p->buffer);
+      p->buffer = nullptr;
+    }
+  else
+    p->buffered = res;
+}
+
+/* Return the size of the buffer in which sip would read the start of
+   the file with status ST.  */
+
+static idx_t
+initial_buffer_size (struct stat const *st)
+{
+  idx_t blksize;
+  if (STAT_BLOCKSIZE (*st) < 0 || ckd_add (&blksize, STAT_BLOCKSIZE (*st), 0))
+    blksize = 0;
+  return buffer_lcm (sizeof (word), blksize, IDX_MAX);
+}
+
+/* Return true if the files of PAIR would be compared without reading
+   them, because of their sizes or because they are the same file.  */
+
+static bool
+decided_by_status (struct prefetched const pair[2])
+{
+  struct stat const *st0 = &pair[0].stat, *st1 = &pair[1].stat;
+  return ((files_can_be_treated_as_binary && st0->st_size != st1->st_size)
+	  || (no_diff_means_no_output && same_file (st0, st1)));
+}
+
+/* Queue the closing of the files of the current batch, and forget
+   them.  */
+
+static void
+queue_closes (void)
+{
+  for (int i = 0; i < files; i++)
+    {
+      struct prefetched *p = &file[i];
+      if (0 <= p->desc)
+	{
+	  closed[i] = *p;
+	  queue_op (IORING_OP_CLOSE, p->desc, nullptr, 0, 0, CLOSING + i);
+	}
+      free (p->buffer);
+    }
+  files = 0;
+}
+
+/* Open, get the status of, and read the start of the regular files in
+   the leading pairs of the N pairs of directory entries PAIR in the
+   directories of PARENT, and close the files of the previous batch.
+   If closing fails, set *VAL to EXIT_TROUBLE.  Return the number of
+   pairs whose files were prefetched, which is zero if PAIR does not
+   start with a pair of regular files or if io_uring is unavailable.  */
+
+idx_t
+prefetch_files (struct comparison const *parent,
+		struct name_pair const *pair, idx_t n, int *val)
+{
+  if (!ring_state)
+    ring_state = setup_ring () ? 1 : -1;
+  if (ring_state < 0)
+    return 0;
+
+  idx_t pairs = 0;
+  while (pairs < MIN (n, PREFETCH_PAIRS)
+	 && pair[pairs].detype[0] == DE_REG && pair[pairs].name[0]
+	 && pair[pairs].detype[1] == DE_REG && pair[pairs].name[1])
+    pairs++;
+
+  queue_closes ();
+
+  int oflags = (O_RDONLY | O_CLOEXEC
+		| (no_dereference_symlinks ? O_NOFOLLOW : 0));
+  for (idx_t i = 0; i < pairs; i++)
+    for (int f = 0; f < 2; f++)
+      {
+	struct prefetched *p = &file[files];
+	*p = (struct prefetched) { .parent = parent, .f = f,
+				   .name = pair[i].name[f], .desc = -1 };
+	struct io_uring_sqe *sqe
+	  = queue_op (IORING_OP_OPENAT, parent->file[f].desc, p->name, 0, 0,
+		      files);
+	sqe->open_flags = oflags;
+	files++;
+      }
+  close_failed = false;
+  run_ops (record_result);
+  if (close_failed)
+    *val = EXIT_TROUBLE;
+
+  for (int i = 0; i < files; i++)
+    {
+      struct prefetched *p = &file[i];
+      if (0 <= p->desc)
+	{
+	  struct io_uring_sqe *sqe
+	    = queue_op (IORING_OP_STATX, p->desc, "", STATX_BASIC_STATS,
+			(uintptr_t) &p->stx, i);
+	  sqe->statx_flags = AT_EMPTY_PATH;
+	}
+    }
+  run_ops (record_result);
+
+  /* Read the files that fit in sip's buffer, into buffers big enough
+     for slurp to use as is.  As these are bigger than the files, a
+     short read shows that the whole file has been read.  Larger files
+     gain little from this.  */
+  for (int i = 0; i < files; i += 2)
+    if (! (file[i].desc < 0 || file[i].taken
+	   || file[i + 1].desc < 0 || file[i + 1].taken
+	   || decided_by_status (&file[i])))
+      for (int f = 0; f < 2; f++)
+	{
+	  struct prefetched *p = &file[i + f];
+	  off_t size = p->stat.st_size;
+	  if (S_ISREG (p->stat.st_mode) && 0 <= size
+	      && size < initial_buffer_size (&p->stat))
+	    {
+	      p->bufsize = size - size % sizeof (word) + 2 * sizeof (word);
+	      p->buffer = ximalloc (p->bufsize);
+	      queue_op (IORING_OP_READ, p->desc, p->buffer, p->bufsize,
+			-1, i + f);
+	    }
+	}
+  run_ops (record_result);
+
+  return pairs;
+}
+
+/* Close the files of the current batch.  If this fails, set *VAL to
+   EXIT_TROUBLE.  */
+
+void
+end_prefetch (int *val)
+{
+  if (0 < ring_state && files)
+    {
+      queue_closes ();
+      close_failed = false;
+      run_ops (record_result);
+      if (close_failed)
+	*val = EXIT_TROUBLE;
+    }
+}
+
+/* If file F of the directory entry NAME in the directories of PARENT
+   has been opened in advance, set the descriptor and status of FILE
+   accordingly and return true.  The descriptor remains open until
+   the next batch, and must not be closed by the caller.  */
+
+bool
+take_prefetched_file (struct comparison const *parent, int f,
+		      char const *name, struct file_data *file_data)
+{
+  for (int i = f; i < files; i += 2)
+    {
+      struct prefetched *p = &file[i];
+      if (p->name == name && p->parent == parent)
+	{
+	  /* Leave anything that is no longer a regular file, e.g., a
+	     file replaced by a directory since diff_dirs read its
+	     directory, to be opened as usual.  */
+	  if (p->desc < 0 || p->taken || !S_ISREG (p->stat.st_mode))
+	    return false;
+	  p->taken = true;
+	  file_data->desc = p->desc;
+	  file_data->stat = p->stat;
+	  return true;
+	}
+    }
+  return false;
+}
+
+/* If the start of the file FILE_DATA, which was opened in advance, has
+   been read, make the data read FILE_DATA's buffer and return true.  */
+
+bool
+take_prefetched_data (struct file_data *file_data)
+{
+  for (int i = 0; i < files; i++)
+    {
+      struct prefetched *p = &file[i];
+      if (p->desc == file_data->desc && p->buffer)
+	{
+	  file_data->buffer = p->buffer;
+	  file_data->bufsize = p->bufsize;
+	  file_data->buffered = p->buffered;
+	  file_data->eof = p->buffered < p->bufsize;
+	  p->buffer = nullptr;
+	  return true;
+	}
+    }
+  return false;
+}
+
+#else
+
+idx_t
+prefetch_files (struct comparison const *parent,
+		struct name_pair const *pair, idx_t n, int *val)
+{
+  return 0;
+}
+
+void
+end_prefetch (int *val)
+{
+}
+
+bool
+take_prefetched_file (struct comparison const *parent, int f,
+		      char const *name, struct file_data *file_data)
+{
+  return false;
+}
+
+bool
+take_prefetched_data (struct file_data *file_data)
+{
+  return false;
+}
+
+#endif
@@ -28,7 +28,7 @@ static void print_sdiff_common_lines (lin, lin);
 static void print_sdiff_hunk (struct change *);
 
 /* Next line number to be printed in the two input files.  */
-static lin next0, next1;
+static thread_local lin next0, next1;
 
 /* Print the edit-script SCRIPT as a sdiff style output.  */
 
@@ -38,10 +38,25 @@ print_sdiff_script (struct change *script)
   begin_output ();
 
   next0 = next1 = - curr.file[0].prefix_lines;
-  print_script (script, find_change, print_sdiff_hunk);
+  if (print_script (script, find_change, print_sdiff_hunk))
+    print_sdiff_common_lines (curr.file[0].valid_lines,
+			      curr.file[1].valid_lines);
+}
+
+/* Output N copies of C, which is either a space or a tab.  */
 
-  print_sdiff_common_lines (curr.file[0].valid_lines,
-			    curr.file[1].valid_lines);
+static void
+put_repeated (char c, intmax_t n)
+{
+  static char const spaces[] = "                                ";
+  static char const tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+  char const *s = c == ' ' ? spaces : tabs;
+  int size = c == ' ' ? sizeof spaces - 1 : sizeof tabs - 1;
+
+  for (; size < n; n -= size)
+    fwrite (s, 1, size, outfile);
+  if (0 < n)
+    fwrite (s, 1, n, outfile);
 }
 
 /* Tab from column FROM to column TO, where FROM <= TO.  Yield TO.  */
@@ -49,23 +64,30 @@ print_sdiff_script (struct change *script)
 static intmax_t
 tab_from_to (intmax_t from, intmax_t to)
 {
-  FILE *out = outfile;
-
   if (!expand_tabs)
     {
       intmax_t tab_size = tabsize;
-      for (intmax_t tab = from + tab_size - from % tab_size;
-	   tab <= to;  tab += tab_size)
+      intmax_t tab = from + tab_size - from % tab_size;
+      if (tab <= to)
 	{
-	  putc ('\t', out);
-	  from = tab;
+	  intmax_t tabs = (to - tab) / tab_size + 1;
+	  put_repeated ('\t', tabs);
+	  from = tab + (tabs - 1) * tab_size;
 	}
     }
-  while (from++ < to)
-    putc (' ', out);
+  put_repeated (' ', to - from);
   return to;
 }
 
+/* Return true if the byte C is a printable ASCII character, which
+   has print width 1 in every supported locale.  */
+
+static bool
+ascii_print (char c)
+{
+  return ' ' <= c && c <= '~';
+}
+
 /* Print the text for half an sdiff line.  This means truncate to
    OUT_BOUND columns, observing tabs, and trim a trailing newline.
    Return the presumed column position on the output device after
@@ -84,8 +106,48 @@ print_half_line (char const *const *line, intmax_t indent, intmax_t out_bound)
   char const *text_pointer = line[0];
   char const *text_limit = line[1];
 
+  /* Text before this point has been checked for carriage returns and
+     backspaces, the only characters that can move IN_POSITION back
+     within OUT_BOUND.  */
+  char const *checked = text_pointer;
+
   while (text_pointer < text_limit)
     {
+      if (out_bound < in_position && checked <= text_pointer)
+	{
+	  /* Nothing more is output unless a carriage return or a
+	     backspace comes later.  Skip to a carriage return, as the
+	     columns before it do not matter.  After a backspace,
+	     keep counting columns.  */
+	  char const *p = text_pointer;
+	  while (p < text_limit && *p != '\r' && *p != '\b')
+	    p++;
+	  if (p == text_limit)
+	    break;
+	  if (*p == '\r')
+	    text_pointer = p;
+	  checked = p + 1;
+	}
+
+      /* Copy a run of printable ASCII characters as far as it fits.  */
+      if (ascii_print (*text_pointer))
+	{
+	  char const *run = text_pointer;
+	  do
+	    text_pointer++;
+	  while (text_pointer < text_limit && ascii_print (*text_pointer));
+	  intmax_t len = text_pointer - run;
+	  intmax_t fit = MAX (0, MIN (len, out_bound - in_position));
+	  if (fit)
+	    {
+	      fwrite (run, 1, fit, out);
+	      out_position = in_position + fit;
+	    }
+	  if (ckd_add (&in_position, in_position, len))
+	    return out_position;
+	  continue;
+	}
+
       char const *tp0 = text_pointer;
       char c = *text_pointer++;
 
@@ -103,8 +165,8 @@ print_half_line (char const *const *line, intmax_t indent, intmax_t out_bound)
                   {
                     if (out_bound < tabstop)
                       tabstop = out_bound;
-                    for (;  out_position < tabstop;  out_position++)
-                      putc (' ', out);
+		    put_repeated (' ', tabstop - out_position);
+		    out_position = MAX (out_position, tabstop);
                   }
                 else
                   if (tabstop < out_bound)
@@ -129,9 +191,12 @@ print_half_line (char const *const *line, intmax_t indent, intmax_t out_bound)
           if (in_position != 0 && --in_position < out_bound)
             {
               if (out_position <= in_position)
-                /* Add spaces to make up for suppressed tab past out_bound.  */
-                for (;  out_position < in_position;  out_position++)
-                  putc (' ', out);
+		{
+		  /* Add spaces to make up for suppressed tab past
+		     out_bound.  */
+		  put_repeated (' ', in_position - out_position);
+		  out_position = in_position;
+		}
               else
                 {
                   out_position = in_position;
@@ -161,36 +226,6 @@ print_half_line (char const *const *line, intmax_t indent, intmax_t out_bound)
           }
           break;
 
-        /* Print width 1.  */
-        case ' ': case '!': case '"': case '#': case '$': case '%':
-        case '&': case '\'': case '(': case ')': case '*':
-        case '+': case ',': case '-': case '.': case '/':
-        case '0': case '1': case '2': case '3': case '4':
-        case '5': case '6': case '7': case '8': case '9':
-        case ':': case ';': case '<': case '=': case '>':
-        case '?': case '@':
-        case 'A': case 'B': case 'C': case 'D': case 'E':
-        case 'F': case 'G': case 'H': case 'I': case 'J':
-        case 'K': case 'L': case 'M': case 'N': case 'O':
-        case 'P': case 'Q': case 'R': case 'S': case 'T':
-        case 'U': case 'V': case 'W': case 'X': case 'Y':
-        case 'Z':
-        case '[': case '\\': case ']': case '^': case '_': case '`':
-        case 'a': case 'b': case 'c': case 'd': case 'e':
-        case 'f': case 'g': case 'h': case 'i': case 'j':
-        case 'k': case 'l': case 'm': case 'n': case 'o':
-        case 'p': case 'q': case 'r': case 's': case 't':
-        case 'u': case 'v': case 'w': case 'x': case 'y':
-        case 'z': case '{': case '|': case '}': case '~':
-	  if (ckd_add (&in_position, in_position, 1))
-	    return out_position;
-	  if (in_position <= out_bound)
-	    {
-	      out_position = in_position;
-	      putc (c, out);
-	    }
-	  break;
-
 	/* Print width 0.  */
 	case '\0': case '\a': case '\f': case '\v':
 	  if (in_position <= out_bound)
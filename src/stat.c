@@ -0,0 +1,254 @@
+/* Summaries of changed lines for GNU DIFF.
+
+   Copyright (C) 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* With --numstat, output a line for each pair of files that differ,
+   giving the number of lines inserted and deleted.  With --stat, save
+   these counts and output them at the end as a table with a histogram,
+   followed by totals.  The counts come straight from the edit script,
+   so no lines are formatted.  */
+
+#include "diff.h"
+
+#include <diagnose.h>
+#include <xalloc.h>
+
+/* A row of the --stat table.  */
+struct stat_entry
+{
+  char *name;
+  lin inserted, deleted;
+  bool binary;
+};
+
+/* Record that the file pair FILEVEC differs by INSERTED and DELETED
+   lines, or in unknown ways if BINARY.  */
+
+static void
+record_stat (struct file_data const filevec[], lin inserted, lin deleted,
+	     bool binary)
+{
+  if (output_style == OUTPUT_NUMSTAT)
+    {
+      /* The row names the files, so it needs no "diff" header line.
+	 Begin output before quoting the name, as the header may use
+	 the same quoting slot.  */
+      setup_output (file_label[0] ? file_label[0] : filevec[0].name,
+		    file_label[1] ? file_label[1] : filevec[1].name, false);
+      begin_output ();
+    }
+
+  char const *name = (file_label[1] ? file_label[1]
+		      : squote (0, filevec[1].name));
+  struct printer *p = current_printer;
+
+  if (output_style == OUTPUT_NUMSTAT)
+    {
+      if (binary)
+	fprintf (outfile, "-\t-\t%s\n", name);
+      else
+	fprintf (outfile, "%"pI"d\t%"pI"d\t%s\n", inserted, deleted, name);
+      finish_output ();
+      return;
+    }
+
+  if (p->stat_entries_used == p->stat_entries_alloc)
+    p->stat_entries = xpalloc (p->stat_entries, &p->stat_entries_alloc, 1, -1,
+			       sizeof *p->stat_entries);
+  p->stat_entries[p->stat_entries_used++] = (struct stat_entry) {
+    .name = xstrdup (name),
+    .inserted = inserted,
+    .deleted = deleted,
+    .binary = binary
+  };
+}
+
+/* Record the number of lines inserted and deleted by the edit script
+   SCRIPT for the file pair FILEVEC.  Changes that -B or -I would not
+   output are not counted.  */
+
+void
+print_stat_script (struct change *script, struct file_data const filevec[])
+{
+  lin inserted = 0, deleted = 0;
+
+  for (struct change *next = script; next; )
+    {
+      struct change *this = next;
+      struct change *end = find_change (next);
+      next = end->link;
+
+      if (ignore_blank_lines || ignore_regexp)
+	{
+	  /* Disconnect the changes from the rest of the script,
+	     making them a hunk, to see whether they are ignorable.  */
+	  end->link = nullptr;
+	  lin first0, last0, first1, last1;
+	  enum changes changes = analyze_hunk (this, &first0, &last0,
+					       &first1, &last1);
+	  end->link = next;
+	  if (!changes)
+	    continue;
+	}
+
+      for (struct change *e = this; e != next; e = e->link)
+	{
+	  inserted += e->inserted;
+	  deleted += e->deleted;
+	}
+    }
+
+  if (inserted | deleted)
+    record_stat (filevec, inserted, deleted, false);
+}
+
+/* Record that the binary file pair FILEVEC differs.  */
+
+void
+print_binary_stat (struct file_data const filevec[])
+{
+  record_stat (filevec, 0, 0, true);
+}
+
+/* Move the rows of the --stat table of the printer FROM to the end of
+   that of the printer TO.  */
+
+void
+move_stat_entries (struct printer *to, struct printer *from)
+{
+  idx_t n = from->stat_entries_used;
+  if (n)
+    {
+      if (to->stat_entries_alloc - to->stat_entries_used < n)
+	to->stat_entries = xpalloc (to->stat_entries, &to->stat_entries_alloc,
+				    n - (to->stat_entries_alloc
+					 - to->stat_entries_used),
+				    -1, sizeof *to->stat_entries);
+      memcpy (to->stat_entries + to->stat_entries_used, from->stat_entries,
+	      n * sizeof *from->stat_entries);
+      to->stat_entries_used += n;
+    }
+  free (from->stat_entries);
+  from->stat_entries = nullptr;
+  from->stat_entries_used = from->stat_entries_alloc = 0;
+}
+
+/* Return the number of decimal digits in N, which is nonnegative.  */
+
+static int
+decimal_digits (intmax_t n)
+{
+  int digits = 1;
+  for (; 10 <= n; n /= 10)
+    digits++;
+  return digits;
+}
+
+/* Scale the count N, which is positive and at most MAX, to a bar of
+   at least one and at most WIDTH columns.  */
+
+static intmax_t
+scale_count (intmax_t n, intmax_t max, intmax_t width)
+{
+  return max <= width ? n : 1 + n * (width - 1) / max;
+}
+
+/* Output N copies of the character C to OUT.  */
+
+static void
+put_bar (char c, intmax_t n, FILE *out)
+{
+  for (; 0 < n; n--)
+    putc (c, out);
+}
+
+/* Output the --stat table and totals of the printer P.  */
+
+void
+print_stat_summary (struct printer *p)
+{
+  if (!p->stat_entries_used)
+    return;
+
+  select_printer (p);
+  setup_output (nullptr, nullptr, false);
+  begin_output ();
+  FILE *out = outfile;
+  int name_width = 0;
+  intmax_t max_change = 0;
+  bool any_binary = false;
+  for (idx_t i = 0; i < p->stat_entries_used; i++)
+    {
+      struct stat_entry const *e = &p->stat_entries[i];
+      name_width = MAX (name_width, text_width (e->name));
+      max_change = MAX (max_change, (intmax_t) e->inserted + e->deleted);
+      any_binary |= e->binary;
+    }
+  int count_width = MAX (decimal_digits (max_change),
+			 any_binary ? (int) sizeof "Bin" - 1 : 0);
+
+  /* Each row is " NAME | COUNT BAR", within the output width.  */
+  intmax_t bar_width = MAX (1, stat_width - name_width - count_width - 5);
+
+  intmax_t files = p->stat_entries_used, insertions = 0, deletions = 0;
+  for (idx_t i = 0; i < p->stat_entries_used; i++)
+    {
+      struct stat_entry const *e = &p->stat_entries[i];
+      fprintf (out, " %s%*s | ", e->name, name_width - text_width (e->name),
+	       "");
+      if (e->binary)
+	fprintf (out, "%*s\n", count_width, "Bin");
+      else
+	{
+	  /* Split the bar in proportion, showing both kinds of change
+	     if there is room.  */
+	  intmax_t change = (intmax_t) e->inserted + e->deleted;
+	  intmax_t bar = scale_count (change, max_change, bar_width);
+	  intmax_t plus = (bar * e->inserted + change / 2) / change;
+	  if (1 < bar)
+	    {
+	      if (e->inserted && plus == 0)
+		plus = 1;
+	      if (e->deleted && plus == bar)
+		plus = bar - 1;
+	    }
+	  fprintf (out, "%*jd ", count_width, change);
+	  put_bar ('+', plus, out);
+	  put_bar ('-', bar - plus, out);
+	  putc ('\n', out);
+	}
+      insertions += e->inserted;
+      deletions += e->deleted;
+      free (e->name);
+    }
+  p->stat_entries_used = 0;
+
+  fprintf (out, ngettext (" %jd file changed", " %jd files changed", files),
+	   files);
+  if (insertions || !deletions)
+    fprintf (out, ngettext (", %jd insertion(+)", ", %jd insertions(+)",
+			    insertions),
+	     insertions);
+  if (deletions || !insertions)
+    fprintf (out, ngettext (", %jd deletion(-)", ", %jd deletions(-)",
+			    deletions),
+	     deletions);
+  putc ('\n', out);
+  finish_output ();
+  select_printer (nullptr);
+}
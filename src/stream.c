@@ -0,0 +1,336 @@
+/* Streaming output of files that exist on one side only, for GNU DIFF.
+
+   Copyright (C) 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* With -N or --unidirectional-new-file, a file that is missing on one
+   side is compared as if it were empty, so every line of the other file
+   is inserted or deleted.  Reading that file into memory, hashing its
+   lines and searching for a common subsequence is a waste of effort.
+   Instead, count its lines in one pass and output them in a second
+   pass, a buffer at a time, so that memory use does not depend on the
+   size of the file.  */
+
+#include "diff.h"
+
+#include <cmpbuf.h>
+#include <xalloc.h>
+
+/* The minimum size of the buffer used for reading.  It is large enough
+   for print_line_run to hand runs of lines to writev.  */
+enum { STREAM_BUFFER_MIN = 256 * 1024 };
+
+/* Return the index of the file of CMP that can be streamed because the
+   other file does not exist, or -1 if the files must be compared as
+   usual.  */
+
+static int
+streamable_file (struct comparison const *cmp)
+{
+  /* Options that make some lines special, or that need more than
+     the lines in order, are left to the general code.  */
+  if (printers != 1 || brief || line_pairing != PAIR_SEQUENCE
+      || ignore_blank_lines || ignore_regexp || strip_trailing_cr
+      || O_BINARY)
+    return -1;
+
+  switch (output_style)
+    {
+    case OUTPUT_NORMAL: case OUTPUT_CONTEXT: case OUTPUT_UNIFIED:
+    case OUTPUT_STAT: case OUTPUT_NUMSTAT:
+      break;
+
+    default:
+      return -1;
+    }
+
+  for (int f = 0; f < 2; f++)
+    if (cmp->file[!f].desc == NONEXISTENT && 0 <= cmp->file[f].desc)
+      {
+	/* The status of a file given on the command line is not always
+	   known when its counterpart does not exist, so get it here
+	   without disturbing what the output headers show.  */
+	struct stat st;
+	return (fstat (cmp->file[f].desc, &st) == 0 && S_ISREG (st.st_mode)
+		? f : -1);
+      }
+  return -1;
+}
+
+/* Read into BUF, which has room for SIZE bytes, from FILE.
+   Return the number of bytes read, which is less than SIZE only
+   at end of file.  */
+
+static idx_t
+stream_read (struct file_data const *file, char *buf, idx_t size)
+{
+  ptrdiff_t n = block_read (file->desc, buf, size);
+  if (n < 0)
+    pfatal_with_name (file->name);
+  return n;
+}
+
+/* Output the range of line numbers of a side of a hunk that consists
+   of all N lines of a file.  UNIDIFF says whether the hunk is in
+   unified format.  */
+
+static void
+print_whole_range (lin n, bool unidiff)
+{
+  if (n == 0)
+    fputs (unidiff ? "0,0" : "0", outfile);
+  else if (n == 1)
+    putc ('1', outfile);
+  else
+    fprintf (outfile, "1,%"pI"d", n);
+}
+
+/* Output the line MARK RANGE END_MARK that precedes the lines of a side
+   of a context hunk, where RANGE is that of all N lines of a file.  */
+
+static void
+print_context_side (char const *mark, lin n, char const *end_mark)
+{
+  set_color_context (LINE_NUMBER_CONTEXT);
+  fprintf (outfile, "%s ", mark);
+  print_whole_range (n, false);
+  fprintf (outfile, " %s", end_mark);
+  set_color_context (RESET_CONTEXT);
+  putc ('\n', outfile);
+}
+
+/* Output the header of a hunk in which all N lines of a file are
+   inserted if INSERTED, deleted otherwise.  */
+
+static void
+print_stream_hunk_header (lin n, bool inserted)
+{
+  lin n0 = inserted ? 0 : n;
+  lin n1 = inserted ? n : 0;
+  FILE *out = outfile;
+
+  switch (output_style)
+    {
+    case OUTPUT_NORMAL:
+      set_color_context (LINE_NUMBER_CONTEXT);
+      print_whole_range (n0, false);
+      putc (change_letter[inserted ? NEW : OLD], out);
+      print_whole_range (n1, false);
+      set_color_context (RESET_CONTEXT);
+      putc ('\n', out);
+      break;
+
+    case OUTPUT_UNIFIED:
+      set_color_context (LINE_NUMBER_CONTEXT);
+      fputs ("@@ -", out);
+      print_whole_range (n0, true);
+      fputs (" +", out);
+      print_whole_range (n1, true);
+      fputs (" @@", out);
+      set_color_context (RESET_CONTEXT);
+      putc ('\n', out);
+      break;
+
+    case OUTPUT_CONTEXT:
+      fputs ("***************\n", out);
+      print_context_side ("***", n0, "****");
+      if (inserted)
+	print_context_side ("---", n1, "----");
+      break;
+
+    default:
+      unreachable ();
+    }
+}
+
+/* Output the N lines starting at LINE, flagged with FLAG, which is
+   "+" or "-" for context and unified output, "<" or ">" for normal
+   output.  */
+
+static void
+print_stream_lines (char const *flag, char const *const *line, lin n)
+{
+  bool unidiff = output_style == OUTPUT_UNIFIED;
+  char prefix[] = { flag[0], initial_tab ? '\t' : unidiff ? '\0' : ' ',
+		    '\0' };
+  enum color_context color_context = (*flag == '+' || *flag == '>'
+				      ? ADD_CONTEXT : DELETE_CONTEXT);
+
+  for (lin i = print_line_run (prefix, flag, line, n); i < n; i++)
+    {
+      set_color_context (color_context);
+      if (unidiff)
+	{
+	  putc (flag[0], outfile);
+	  if (initial_tab && ! (suppress_blank_empty && *line[i] == '\n'))
+	    putc ('\t', outfile);
+	  print_1_line_nl (nullptr, &line[i], true);
+	}
+      else
+	print_1_line_nl (flag, &line[i], true);
+      set_color_context (RESET_CONTEXT);
+      if (line[i + 1][-1] == '\n')
+	putc ('\n', outfile);
+    }
+}
+
+/* If one of the files of CMP does not exist and the other can be
+   streamed, report their differences and return 1 if they differ,
+   0 if not.  Return -1, having read nothing, if the files must be
+   compared as usual.  */
+
+int
+stream_one_side (struct comparison *cmp)
+{
+  int f = streamable_file (cmp);
+  if (f < 0)
+    return -1;
+  struct file_data *file = &cmp->file[f];
+  off_t start = lseek (file->desc, 0, SEEK_CUR);
+  if (start < 0)
+    return -1;
+
+  /* Check for a binary file as read_files would, by looking for a null
+     byte in a buffer of the size that it uses.  */
+  idx_t blksize;
+  if (STAT_BLOCKSIZE (file->stat) < 0
+      || ckd_add (&blksize, STAT_BLOCKSIZE (file->stat), 0))
+    blksize = 0;
+  idx_t test_size = buffer_lcm (sizeof (word), blksize, IDX_MAX);
+  idx_t bufsize = MAX (test_size, STREAM_BUFFER_MIN);
+  char *buf = ximalloc (bufsize);
+  idx_t buffered = stream_read (file, buf, bufsize);
+  if (!text && memchr (buf, 0, MIN (buffered, test_size)))
+    {
+      if (lseek (file->desc, start, SEEK_SET) < 0)
+	pfatal_with_name (file->name);
+      free (buf);
+      return -1;
+    }
+
+  /* Count the lines.  If the file fits in the buffer, it need not be
+     read again.  */
+  bool whole = buffered < bufsize;
+  intmax_t bytes = 0;
+  lin lines = 0;
+  char last = '\n';
+  for (;;)
+    {
+      char const *lim = buf + buffered;
+      for (char const *p = buf; (p = memchr (p, '\n', lim - p)); p++)
+	lines++;
+      if (buffered)
+	last = lim[-1];
+      bytes += buffered;
+      if (buffered < bufsize)
+	break;
+      buffered = stream_read (file, buf, bufsize);
+    }
+  lines += last != '\n';
+
+  if (!lines)
+    {
+      free (buf);
+      return 0;
+    }
+
+  bool inserted = f == 1;
+  curr = *cmp;
+  select_printer (&printer[0]);
+
+  if (stat_output_style (output_style))
+    {
+      struct change change = { .inserted = inserted ? lines : 0,
+			       .deleted = inserted ? 0 : lines };
+      print_stat_script (&change, cmp->file);
+      select_printer (nullptr);
+      free (buf);
+      return 1;
+    }
+
+  if (!whole)
+    {
+      if (lseek (file->desc, start, SEEK_SET) < 0)
+	pfatal_with_name (file->name);
+      buffered = 0;
+    }
+
+  setup_output (file_label[0] ? file_label[0] : cmp->file[0].name,
+		file_label[1] ? file_label[1] : cmp->file[1].name,
+		cmp->parent != &noparent);
+  begin_output ();
+  print_stream_hunk_header (lines, inserted);
+
+  char const *flag = (output_style == OUTPUT_NORMAL
+		      ? (inserted ? ">" : "<")
+		      : (inserted ? "+" : "-"));
+  char const **line = nullptr;
+  idx_t line_alloc = 0;
+
+  /* Output the lines a buffer at a time.  A line that does not fit
+     in the buffer is carried over to the start of the next buffer,
+     which grows if need be.  Stop after the bytes that were counted,
+     in case the file grows meanwhile.  */
+  for (intmax_t left = whole ? 0 : bytes; ; )
+    {
+      if (left)
+	{
+	  if (buffered == bufsize)
+	    buf = xpalloc (buf, &bufsize, 1, -1, 1);
+	  idx_t size = MIN (bufsize - buffered, left);
+	  idx_t nread = stream_read (file, buf + buffered, size);
+	  left = nread < size ? 0 : left - nread;
+	  buffered += nread;
+	}
+
+      char const *p = buf, *lim = buf + buffered;
+      idx_t n = 0;
+      for (char const *nl; (nl = memchr (p, '\n', lim - p)); p = nl + 1)
+	{
+	  if (line_alloc <= n + 1)
+	    line = xpalloc (line, &line_alloc, 2, -1, sizeof *line);
+	  line[n++] = p;
+	}
+      if (!left && p < lim)
+	{
+	  if (line_alloc <= n + 1)
+	    line = xpalloc (line, &line_alloc, 2, -1, sizeof *line);
+	  line[n++] = p;
+	  p = lim;
+	}
+      if (n)
+	{
+	  line[n] = p;
+	  print_stream_lines (flag, line, n);
+	}
+
+      if (!left || (max_output_bytes && output_cut_short ()))
+	break;
+      buffered = lim - p;
+      memmove (buf, p, buffered);
+    }
+
+  /* The empty new side of a context hunk follows the deleted lines.  */
+  if (output_style == OUTPUT_CONTEXT && !inserted)
+    print_context_side ("---", 0, "----");
+
+  finish_output ();
+  select_printer (nullptr);
+  free (line);
+  free (buf);
+  return 1;
+}
@@ -86,6 +86,12 @@
 
 #include "version.h"
 
+/* C23 thread_local, which is a keyword only in C23 and later.  */
+#if !defined thread_local && (!defined __STDC_VERSION__ \
+                              || __STDC_VERSION__ < 202311)
+# define thread_local _Thread_local
+#endif
+
 /* Evaluate an assertion E that is guaranteed to be true.
    E should not crash, loop forever, or have side effects.  */
 #if defined DDEBUG && !defined NDEBUG
@@ -144,8 +150,13 @@ static_assert (LIN_MAX == IDX_MAX);
 /* This section contains POSIX-compliant defaults for macros
    that are meant to be overridden by hand in config.h as needed.  */
 
+/* FILE_NAME_CMP_BYTEWISE is true if file_name_cmp compares the bytes
+   of file names as strcmp does.  */
 #ifndef file_name_cmp
 # define file_name_cmp strcmp
+# define FILE_NAME_CMP_BYTEWISE true
+#else
+# define FILE_NAME_CMP_BYTEWISE false
 #endif
 
 #ifndef initialize_main
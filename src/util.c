@@ -32,6 +32,12 @@
 
 #include <stdarg.h>
 #include <signal.h>
+#if HAVE_WRITEV
+# include <sys/uio.h>
+#endif
+#if HAVE_OPEN_MEMSTREAM
+# include <pthread.h>
+#endif
 
 /* Use SA_NOCLDSTOP as a proxy for whether the sigaction machinery is
    present.  */
@@ -55,8 +61,9 @@
 
 char const pr_program[] = PR_PROGRAM;
 
-/* Queue up one-line messages to be printed at the end,
-   when -l is specified.  Each message is recorded with a 'struct msg'.  */
+/* Queue up one-line messages to be printed at the end, when -l is
+   specified and a 'pr' subprocess may be writing to standard output.
+   Each message is recorded with a 'struct msg'.  */
 
 struct msg
 {
@@ -108,43 +115,43 @@ fatal (char const *msgid)
   error (EXIT_TROUBLE, 0, "%s", _(msgid));
 }
 
-/* Like printf, except if -l in effect then save the message and print later.
-   Also, all arguments must be char * or char const *.
-   This is used for things like "Only in ...".  */
+/* Like vprintf, except output to the destination of the printer P,
+   and if 'pr' may be running then save the message and print later.
+   Also, all arguments must be char * or char const *.  */
 
-void
-message (char const *format_msgid, ...)
+static void
+vmessage (struct printer const *p, char const *format_msgid, va_list ap)
 {
-  va_list ap;
-  va_start (ap, format_msgid);
-
-  if (paginate)
+  if (p && p->file)
+    vfprintf (p->file, _(format_msgid), ap);
+  else if (paginate && !PAGINATE_INTERNALLY)
     {
       idx_t argbytes = 0;
 
+      va_list aq;
+      va_copy (aq, ap);
       for (char const *m = format_msgid; *m; m++)
 	if (*m == '%')
 	  {
 	    if (m[1] == '%')
 	      m++;
 	    else
-	      argbytes += strlen (va_arg (ap, char const *)) + 1;
+	      argbytes += strlen (va_arg (aq, char const *)) + 1;
 	  }
-      va_end (ap);
+      va_end (aq);
 
       struct msg *new = xmalloc (FLEXSIZEOF (struct msg, args, argbytes));
       new->msgid = format_msgid;
       new->argbytes = argbytes;
 
-      va_start (ap, format_msgid);
-      char *p = new->args;
+      char *q = new->args;
       for (char const *m = format_msgid; *m; m++)
 	if (*m == '%')
 	  {
 	    if (m[1] == '%')
 	      m++;
 	    else
-	      p = stpcpy (p, va_arg (ap, char const *)) + 1;
+	      q = stpcpy (q, va_arg (ap, char const *)) + 1;
 	  }
 
       *msg_chain_end = new;
@@ -153,11 +160,38 @@ message (char const *format_msgid, ...)
     }
   else
     {
+      FILE *out = std_output ();
       if (sdiff_merge_assist)
-        putchar (' ');
-      vprintf (_(format_msgid), ap);
+        putc (' ', out);
+      vfprintf (out, _(format_msgid), ap);
     }
+}
 
+/* Like printf, except if 'pr' may be running then save the message and
+   print later.  Also, all arguments must be char * or char const *.
+   This is used for things like "Only in ...", which are output by
+   every printer.  */
+
+void
+message (char const *format_msgid, ...)
+{
+  for (idx_t i = 0; i < MAX (printers, 1); i++)
+    {
+      va_list ap;
+      va_start (ap, format_msgid);
+      vmessage (printers ? &printer[i] : nullptr, format_msgid, ap);
+      va_end (ap);
+    }
+}
+
+/* Like message, except output only for the current printer.  */
+
+void
+message_here (char const *format_msgid, ...)
+{
+  va_list ap;
+  va_start (ap, format_msgid);
+  vmessage (current_printer, format_msgid, ap);
   va_end (ap);
 }
 
@@ -235,6 +269,9 @@ static sig_atomic_t volatile interrupt_signal;
 /* A count of the number of pending stop signals that have been received.  */
 static sig_atomic_t volatile stop_signal_count;
 
+/* The color context of this thread's output.  */
+static thread_local enum color_context last_context = RESET_CONTEXT;
+
 /* An ordinary signal was received; arrange for the program to exit.  */
 
 static void
@@ -265,6 +302,9 @@ stophandler (int sig)
 static void
 process_signals (void)
 {
+  if (worker_thread)
+    return;
+
   while (interrupt_signal | stop_signal_count)
     {
       set_color_context (RESET_CONTEXT);
@@ -407,8 +447,8 @@ cleanup_signal_handlers (void)
     }
 }
 
-static char const *current_name[2];
-static bool currently_recursive;
+static thread_local char const *current_name[2];
+static thread_local bool currently_recursive;
 static bool colors_enabled;
 
 static struct color_ext_type *color_ext_list = nullptr;
@@ -794,10 +834,18 @@ check_color_output (bool is_pipe)
 {
   bool output_is_tty;
 
+  /* Threads compare files in parallel only if output is not colored.  */
+  if (worker_thread)
+    return;
+
+  colors_enabled = false;
   if (! outfile || colors_style == NEVER)
     return;
 
-  output_is_tty = presume_output_tty || (!is_pipe && isatty (fileno (outfile)));
+  if (outfile == stdout || is_pipe)
+    output_is_tty = presume_output_tty || (!is_pipe && isatty (STDOUT_FILENO));
+  else
+    output_is_tty = isatty (fileno (outfile));
 
   colors_enabled = (colors_style == ALWAYS
                     || (colors_style == AUTO && output_is_tty));
@@ -809,12 +857,45 @@ check_color_output (bool is_pipe)
     install_signal_handlers ();
 }
 
+/* Return the number of columns that the string S occupies.
+   Count an encoding error as one column, and a control character as
+   none.  */
+
+int
+text_width (char const *s)
+{
+  int width = 0;
+  for (char const *lim = s + strlen (s); s < lim; )
+    {
+      mcel_t g = mcel_scan (s, lim);
+      int w = g.err ? 1 : c32width (g.ch);
+      if (w < 0)
+	w = g.ch < 0x20 || (0x7f <= g.ch && g.ch < 0xa0) ? 0 : 1;
+      width += w;
+      s += g.len;
+    }
+  return width;
+}
+
+/* Make P the printer whose output is generated next, or go back to
+   comparing files if P is null.  */
+
+void
+select_printer (struct printer *p)
+{
+  current_printer = p;
+  output_style = p ? p->style : comparison_style;
+}
+
 /* Call before outputting the results of comparing files NAME0 and NAME1
    to set up OUTFILE, the stdio stream for the output to go to.
+   NAME0 and NAME1 are null if the output is not about one pair of files.
 
-   Usually, OUTFILE is just stdout.  But when -l was specified
-   we fork off a 'pr' and make OUTFILE a pipe to it.
-   'pr' then outputs to our stdout.  */
+   Usually, OUTFILE is just stdout, or the file of the current printer.
+   But when -l was specified OUTFILE is a stream that paginates its
+   output onto stdout.  Where such streams are not supported we fork
+   off a 'pr' and make OUTFILE a pipe to it, and 'pr' then outputs to
+   our stdout.  */
 
 void
 setup_output (char const *name0, char const *name1, bool recursive)
@@ -825,7 +906,7 @@ setup_output (char const *name0, char const *name1, bool recursive)
   outfile = nullptr;
 }
 
-#if HAVE_WORKING_FORK
+#if !PAGINATE_INTERNALLY && HAVE_WORKING_FORK
 static pid_t pr_pid;
 #endif
 
@@ -836,12 +917,15 @@ begin_output (void)
   if (outfile)
     return;
 
-  char const *names[2];
-  for (int f = 0; f < 2; f++)
-    names[f] = quotearg_n_style (f,
-				 (strchr (current_name[f], ' ')
-				  ? c_quoting_style : c_maybe_quoting_style),
-				 current_name[f]);
+  /* Output that is not about one pair of files, such as the --stat
+     summary, has no names.  */
+  char const *names[2] = { "", "" };
+  if (current_name[0])
+    for (int f = 0; f < 2; f++)
+      names[f] = squote_style (f,
+			       (strchr (current_name[f], ' ')
+				? c_quoting_style : c_maybe_quoting_style),
+			       current_name[f]);
 
   /* Construct the header of this piece of diff.  */
   /* POSIX 1003.1-2017 specifies this format.  But there are some bugs in
@@ -853,20 +937,34 @@ begin_output (void)
 			+ 1 + strlen (names[0]) + 1 + strlen (names[1]));
   char *p = stpcpy (name, "diff");
   p = stpcpy (p, switch_string);
-  *p++ = ' ';
-  p = stpcpy (p, names[0]);
-  *p++ = ' ';
-  strcpy (p, names[1]);
+  if (current_name[0])
+    {
+      *p++ = ' ';
+      p = stpcpy (p, names[0]);
+      *p++ = ' ';
+      strcpy (p, names[1]);
+    }
 
-  if (paginate)
+  if (current_printer && current_printer->file)
     {
+      outfile = current_printer->file;
+      check_color_output (false);
+      if (currently_recursive)
+	fprintf (outfile, "%s\n", name);
+    }
+  else if (paginate)
+    {
+#if PAGINATE_INTERNALLY
+      outfile = open_paginated_output (name);
+      check_color_output (true);
+#else
       if (fflush (stdout) != 0)
         pfatal_with_name (_("write failed"));
 
       char const *argv[4] = {pr_program, "-h", name, nullptr };
 
       /* Make OUTFILE a pipe to a subsidiary 'pr'.  */
-#if HAVE_WORKING_FORK
+# if HAVE_WORKING_FORK
       int pipes[2];
       if (pipe (pipes) != 0)
 	pfatal_with_name ("pipe");
@@ -896,7 +994,7 @@ begin_output (void)
 	    pfatal_with_name ("fdopen");
 	  check_color_output (true);
 	}
-#else
+# else
       char *command = system_quote_argv (SCI_SYSTEM, (char **) argv);
       errno = 0;
       outfile = popen (command, "w");
@@ -904,6 +1002,7 @@ begin_output (void)
 	pfatal_with_name (command);
       check_color_output (true);
       free (command);
+# endif
 #endif
     }
   else
@@ -911,13 +1010,13 @@ begin_output (void)
 
       /* If -l was not specified, output the diff straight to 'stdout'.  */
 
-      outfile = stdout;
+      outfile = std_output ();
       check_color_output (false);
 
       /* If handling multiple files (because scanning a directory),
          print which files the following output is about.  */
       if (currently_recursive)
-        puts (name);
+        fprintf (outfile, "%s\n", name);
     }
 
   free (name);
@@ -929,27 +1028,32 @@ begin_output (void)
 }
 
 /* Call after the end of output of diffs for one file.
-   Close OUTFILE and get rid of the 'pr' subfork.  */
+   Close OUTFILE and get rid of the 'pr' subfork, if any.  */
 
 void
 finish_output (void)
 {
-  if (outfile && outfile != stdout)
+  if (outfile && outfile != stdout && outfile != output_segment
+      && ! (current_printer && outfile == current_printer->file))
     {
-      int wstatus;
-      int werrno = 0;
       if (ferror (outfile))
         fatal ("write failed");
-#if ! HAVE_WORKING_FORK
+#if PAGINATE_INTERNALLY
+      if (fclose (outfile) != 0)
+        pfatal_with_name (_("write failed"));
+#else
+      int wstatus;
+      int werrno = 0;
+# if ! HAVE_WORKING_FORK
       wstatus = pclose (outfile);
       if (wstatus == -1)
         werrno = errno;
-#else
+# else
       if (fclose (outfile) != 0)
         pfatal_with_name (_("write failed"));
       if (waitpid (pr_pid, &wstatus, 0) < 0)
         pfatal_with_name ("waitpid");
-#endif
+# endif
       int status = (! werrno && WIFEXITED (wstatus)
 		    ? WEXITSTATUS (wstatus)
 		    : INT_MAX);
@@ -963,6 +1067,7 @@ finish_output (void)
 		 ? "subsidiary program %s failed"
 		 : "subsidiary program %s failed (exit status %d)"),
 	       quote (pr_program), status);
+#endif
     }
 
   outfile = nullptr;
@@ -977,6 +1082,243 @@ find_change (struct change *script)
   return script;
 }
 
+#if HAVE_OPEN_MEMSTREAM
+
+/* A hunk of an edit script, as split by print_script.  */
+struct hunk
+{
+  struct change *first, *last;
+};
+
+/* A group of consecutive hunks formatted by one thread into its
+   own buffer, and whether the buffer is complete.  */
+struct hunk_group
+{
+  idx_t first, lim;
+  char *buf;
+  size_t size;
+  bool done;
+};
+
+/* The work shared by the threads formatting an edit script, and the
+   comparison and printer of the thread that shares it.  */
+struct formatting
+{
+  struct comparison const *cmp;
+  struct printer *printer;
+  struct hunk const *hunk;
+  struct hunk_group *group;
+  idx_t ngroups;
+  void (*printfun) (struct change *);
+
+  /* LOCK protects NEXT_GROUP, the index of the next group to format,
+     and the groups' DONE members.  DONE signals changes to the latter.  */
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  idx_t next_group;
+};
+
+/* The fewest hunks worth handing to a thread.  */
+enum { HUNK_GROUP_MIN = 64 };
+
+/* The number of groups per thread, so that threads stay busy even if
+   some groups take longer to format than others.  */
+enum { GROUPS_PER_THREAD = 4 };
+
+/* Format groups of hunks until there are none left.  */
+
+static void *
+format_hunk_groups (void *arg)
+{
+  struct formatting *f = arg;
+  worker_thread = true;
+  curr = *f->cmp;
+  select_printer (f->printer);
+
+  for (;;)
+    {
+      pthread_mutex_lock (&f->lock);
+      idx_t g = f->next_group++;
+      pthread_mutex_unlock (&f->lock);
+      if (f->ngroups <= g)
+	break;
+
+      struct hunk_group *group = &f->group[g];
+      outfile = open_memstream (&group->buf, &group->size);
+      if (!outfile)
+	xalloc_die ();
+      last_context = RESET_CONTEXT;
+      for (idx_t h = group->first; h < group->lim; h++)
+	f->printfun (f->hunk[h].first);
+      if (fclose (outfile) != 0)
+	xalloc_die ();
+
+      pthread_mutex_lock (&f->lock);
+      group->done = true;
+      pthread_cond_broadcast (&f->done);
+      pthread_mutex_unlock (&f->lock);
+    }
+
+  return nullptr;
+}
+
+/* Like print_script, but format groups of hunks in parallel threads,
+   and output the groups in order.  Return false, having done nothing,
+   if this is not possible or not worth it.
+
+   Each hunk is formatted independently of the others, so this works
+   only for output styles whose hunks do not depend on state left by
+   previous hunks.  Anything else that a hunk's formatting can modify
+   is computed here beforehand: whether lines are ignorable, and where
+   -F's function headings are.  */
+
+static bool
+print_script_in_parallel (struct change *script,
+			  struct change * (*hunkfun) (struct change *),
+			  void (*printfun) (struct change *))
+{
+  switch (output_style)
+    {
+    case OUTPUT_NORMAL: case OUTPUT_CONTEXT: case OUTPUT_UNIFIED:
+    case OUTPUT_ED: case OUTPUT_FORWARD_ED: case OUTPUT_RCS:
+      break;
+
+    default:
+      return false;
+    }
+
+  /* Without a cache of ignorable lines, threads would match -I's
+     regular expressions, which are not thread-safe.  */
+  if (ignore_regexp && !curr.file[0].ignorable)
+    return false;
+
+  struct hunk *hunk = nullptr;
+  idx_t nhunks = 0, hunk_alloc = 0;
+  for (struct change *next = script; next; )
+    {
+      if (nhunks == hunk_alloc)
+	hunk = xpalloc (hunk, &hunk_alloc, 1, -1, sizeof *hunk);
+      struct change *end = hunkfun (next);
+      hunk[nhunks++] = (struct hunk) { .first = next, .last = end };
+      next = end->link;
+      end->link = nullptr;
+    }
+
+  idx_t ngroups = MIN (nhunks / HUNK_GROUP_MIN,
+		       (idx_t) jobs * GROUPS_PER_THREAD);
+  bool parallel = 1 < ngroups;
+  if (parallel)
+    {
+      /* Decide now which hunks have output, filling the cache of
+	 ignorable lines as a side effect.  */
+      bool output = false;
+      for (idx_t h = 0; h < nhunks; h++)
+	{
+	  lin first0, last0, first1, last1;
+	  output |= !!analyze_hunk (hunk[h].first,
+				    &first0, &last0, &first1, &last1);
+	}
+
+      if (output)
+	{
+	  begin_output ();
+	  if (function_regexp)
+	    prepare_function_index (&curr.file[0]);
+
+	  struct hunk_group *group = xinmalloc (ngroups, sizeof *group);
+	  for (idx_t g = 0; g < ngroups; g++)
+	    group[g] = (struct hunk_group) { .first = nhunks * g / ngroups,
+					     .lim = nhunks * (g + 1) / ngroups };
+	  struct formatting f = { .cmp = &curr, .printer = current_printer,
+				  .hunk = hunk, .group = group,
+				  .ngroups = ngroups, .printfun = printfun };
+	  pthread_mutex_init (&f.lock, nullptr);
+	  pthread_cond_init (&f.done, nullptr);
+
+	  /* Leave signals to this thread.  */
+	  int nthreads = MIN (jobs, ngroups);
+	  pthread_t *thread = xinmalloc (nthreads, sizeof *thread);
+	  sigset_t blocked, oldset;
+	  sigfillset (&blocked);
+	  pthread_sigmask (SIG_BLOCK, &blocked, &oldset);
+	  int started = 0;
+	  while (started < nthreads
+		 && pthread_create (&thread[started], nullptr,
+				    format_hunk_groups, &f) == 0)
+	    started++;
+	  pthread_sigmask (SIG_SETMASK, &oldset, nullptr);
+
+	  /* If no thread could be started, format in this one.  */
+	  if (!started)
+	    {
+	      FILE *out = outfile;
+	      format_hunk_groups (&f);
+	      worker_thread = false;
+	      outfile = out;
+	    }
+
+	  for (idx_t g = 0; g < ngroups; g++)
+	    {
+	      pthread_mutex_lock (&f.lock);
+	      while (!group[g].done)
+		pthread_cond_wait (&f.done, &f.lock);
+	      pthread_mutex_unlock (&f.lock);
+
+	      fwrite (group[g].buf, 1, group[g].size, outfile);
+	      free (group[g].buf);
+	      process_signals ();
+	    }
+
+	  for (int t = 0; t < started; t++)
+	    pthread_join (thread[t], nullptr);
+	  pthread_cond_destroy (&f.done);
+	  pthread_mutex_destroy (&f.lock);
+	  free (thread);
+	  free (group);
+	}
+    }
+  else
+    for (idx_t h = 0; h < nhunks; h++)
+      printfun (hunk[h].first);
+
+  /* Reconnect the script so it will all be freed properly.  */
+  for (idx_t h = 0; h + 1 < nhunks; h++)
+    hunk[h].last->link = hunk[h + 1].first;
+  free (hunk);
+  return true;
+}
+
+#else
+
+static bool
+print_script_in_parallel (struct change *script,
+			  struct change * (*hunkfun) (struct change *),
+			  void (*printfun) (struct change *))
+{
+  return false;
+}
+
+#endif
+
+/* Return true if --max-output-bytes has cut short standard output and
+   OUTFILE outputs to it, so that nothing more need be output.  */
+
+bool
+output_cut_short (void)
+{
+  if (current_printer && current_printer->file)
+    return false;
+  if (!output_truncated && output_limit_near ())
+    {
+      /* Let the limited stream see what has been output, which might
+	 be enough to reach the limit.  */
+      fflush (outfile);
+      if (outfile != stdout)
+	fflush (stdout);
+    }
+  return output_truncated;
+}
+
 /* Divide SCRIPT into pieces by calling HUNKFUN and
    print each piece with PRINTFUN.
    Both functions take one arg, an edit script.
@@ -986,14 +1328,23 @@ find_change (struct change *script)
    of the tail.
 
    PRINTFUN takes a subscript which belongs together (with a null
-   link at the end) and prints it.  */
+   link at the end) and prints it.
 
-void
+   Return true if the whole script was printed, false if output was
+   cut short by --max-hunks or --max-output-bytes.  */
+
+bool
 print_script (struct change *script,
               struct change * (*hunkfun) (struct change *),
               void (*printfun) (struct change *))
 {
+  /* Threads that compare files in parallel format their own output.  */
+  if (1 < jobs && !worker_thread && !max_hunks && !max_output_bytes
+      && print_script_in_parallel (script, hunkfun, printfun))
+    return true;
+
   struct change *next = script;
+  intmax_t hunks = 0;
 
   while (next)
     {
@@ -1009,14 +1360,41 @@ print_script (struct change *script,
       debug_script (this);
 #endif
 
+      /* Count the hunks that will be output, and stop before one
+	 that would exceed the maximum.  */
+      if (max_hunks)
+	{
+	  lin first0, last0, first1, last1;
+	  if (analyze_hunk (this, &first0, &last0, &first1, &last1))
+	    {
+	      if (hunks == max_hunks)
+		{
+		  end->link = next;
+		  begin_output ();
+		  fprintf (outfile,
+			   ngettext ("\\ Output truncated after %jd hunk\n",
+				     "\\ Output truncated after %jd hunks\n",
+				     max_hunks),
+			   max_hunks);
+		  return false;
+		}
+	      hunks++;
+	    }
+	}
+
       /* Print this hunk.  */
       (*printfun) (this);
 
       /* Reconnect the script so it will all be freed properly.  */
       end->link = next;
+
+      if (max_output_bytes && output_cut_short ())
+	return false;
     }
+
+  return true;
 }
-
+
 /* Print the text of a single line LINE,
    flagging it with the characters in LINE_FLAG (which say whether
    the line is inserted, deleted, changed, etc.).  LINE_FLAG must not
@@ -1165,6 +1543,114 @@ output_1_line (char const *base, char const *limit, char const *flag_format,
     }
 }
 
+#if HAVE_WRITEV
+
+# ifndef IOV_MAX
+#  define IOV_MAX 16
+# endif
+
+/* The number of iovecs that print_line_run passes to writev at once.  */
+enum { LINE_RUN_IOVECS = MIN (IOV_MAX, 1024) };
+
+/* Runs of lines shorter than this many bytes are output via stdio,
+   as for them a system call would cost more than the copying it saves.  */
+enum { LINE_RUN_MIN = 16 * 1024 };
+
+/* Write the data described by the N elements of IOV to file descriptor FD,
+   retrying after short writes and interrupts.  Modify IOV as needed.  */
+
+static void
+full_writev (int fd, struct iovec *iov, int n)
+{
+  while (0 < n)
+    {
+      ssize_t written = writev (fd, iov, n);
+      process_signals ();
+      if (written < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  pfatal_with_name (_("write failed"));
+	}
+      for (; 0 < n && iov->iov_len <= (size_t) written; iov++, n--)
+	written -= iov->iov_len;
+      if (0 < n)
+	{
+	  iov->iov_base = (char *) iov->iov_base + written;
+	  iov->iov_len -= written;
+	}
+    }
+}
+#endif
+
+/* Print the N lines starting at LINE, each one preceded by PREFIX,
+   or by EMPTY_PREFIX if it is an empty line and --suppress-blank-empty
+   is in effect.  Hand the line text to writev straight from the input
+   buffer rather than copying it through stdio.
+
+   This is possible only when lines are output verbatim, without tab
+   expansion or colors, and worth it only for long runs.  Return the
+   number of lines printed, perhaps zero; the caller prints the rest
+   of the run one line at a time as usual.  */
+
+lin
+print_line_run (char const *prefix, char const *empty_prefix,
+		char const *const *line, lin n)
+{
+#if HAVE_WRITEV
+  if (expand_tabs || colors_enabled || O_BINARY)
+    return 0;
+
+  /* A last line without a newline needs special treatment.  */
+  if (0 < n && line[n][-1] != '\n')
+    n--;
+  if (line[n] - line[0] < LINE_RUN_MIN)
+    return 0;
+
+  int fd = fileno (outfile);
+  if (fd < 0 || fflush (outfile) != 0)
+    return 0;
+
+  idx_t prefix_len = strlen (prefix);
+  idx_t empty_prefix_len = strlen (empty_prefix);
+  struct iovec iov[LINE_RUN_IOVECS];
+  int iovcnt = 0;
+
+  for (lin i = 0; i < n; i++)
+    {
+      char const *text = line[i];
+      idx_t len = line[i + 1] - text;
+      bool empty = suppress_blank_empty && *text == '\n';
+      char const *p = empty ? empty_prefix : prefix;
+      idx_t plen = empty ? empty_prefix_len : prefix_len;
+
+      if (LINE_RUN_IOVECS - 2 < iovcnt)
+	{
+	  full_writev (fd, iov, iovcnt);
+	  iovcnt = 0;
+	}
+
+      if (plen)
+	iov[iovcnt++] = (struct iovec) { .iov_base = (char *) p,
+					 .iov_len = plen };
+      else if (iovcnt && ((char *) iov[iovcnt - 1].iov_base
+			  + iov[iovcnt - 1].iov_len) == text)
+	{
+	  /* Adjacent lines without prefixes need only one iovec.  */
+	  iov[iovcnt - 1].iov_len += len;
+	  continue;
+	}
+      iov[iovcnt++] = (struct iovec) { .iov_base = (char *) text,
+				       .iov_len = len };
+    }
+
+  full_writev (fd, iov, iovcnt);
+  return n;
+#else
+  return 0;
+#endif
+}
+
 enum indicator_no
   {
     C_LEFT, C_RIGHT, C_END, C_RESET, C_HEADER, C_ADD, C_DELETE, C_LINE
@@ -1176,8 +1662,6 @@ put_indicator (const struct bin_str *ind)
   fwrite (ind->string, ind->len, 1, outfile);
 }
 
-static enum color_context last_context = RESET_CONTEXT;
-
 void
 set_color_context (enum color_context color_context)
 {
@@ -1264,6 +1748,53 @@ print_number_range (char sepchar, struct file_data *file, lin a, lin b)
     fprintf (outfile, "%"pI"d", trans_b);
 }
 
+/* Return true if line I of FILE can be ignored because of -B or -I,
+   i.e., if it is blank or matches the ignore regexp.  Consult and
+   update FILE's cache of answers by equivalence class, if it has one,
+   so that each distinct line is examined only once.  */
+
+bool
+ignorable_line (struct file_data const *file, lin i)
+{
+  signed char *cached = file->ignorable ? &file->ignorable[file->equivs[i]]
+			: nullptr;
+  if (cached && *cached)
+    return 0 < *cached;
+
+  int trivial_length = ignore_blank_lines - 1;
+    /* If 0, ignore zero-length lines;
+       if -1, do not ignore lines just because of their length.  */
+
+  bool skip_white_space =
+    ignore_blank_lines && IGNORE_TRAILING_SPACE <= ignore_white_space;
+  bool skip_leading_white_space =
+    skip_white_space && IGNORE_SPACE_CHANGE <= ignore_white_space;
+
+  char const *line = file->linbuf[i];
+  char const *lastbyte = file->linbuf[i + 1] - 1;
+  char const *newline = lastbyte + (*lastbyte != '\n');
+  idx_t len = newline - line;
+  char const *p = line;
+  if (skip_white_space)
+    while (*p != '\n')
+      {
+	mcel_t g = mcel_scan (p, newline);
+	if (! c32isspace (g.ch))
+	  {
+	    if (! skip_leading_white_space)
+	      p = line;
+	    break;
+	  }
+	p += g.len;
+      }
+  bool ignorable
+    = (newline - p == trivial_length
+       || (ignore_regexp && regexp_set_match (ignore_regexp, line, len)));
+  if (cached)
+    *cached = ignorable ? 1 : -1;
+  return ignorable;
+}
+
 /* Look at a hunk of edit script and report the range of lines in each file
    that it applies to.  HUNK is the start of the hunk, which is a chain
    of 'struct change'.  The first and last line numbers of file 0 are stored in
@@ -1282,19 +1813,7 @@ analyze_hunk (struct change *hunk,
               lin *first0, lin *last0,
               lin *first1, lin *last1)
 {
-  bool trivial = ignore_blank_lines || ignore_regexp.fastmap;
-  int trivial_length = ignore_blank_lines - 1;
-    /* If 0, ignore zero-length lines;
-       if -1, do not ignore lines just because of their length.  */
-
-  bool skip_white_space =
-    ignore_blank_lines && IGNORE_TRAILING_SPACE <= ignore_white_space;
-  bool skip_leading_white_space =
-    skip_white_space && IGNORE_SPACE_CHANGE <= ignore_white_space;
-
-  /* Help the compiler.  */
-  char const *const *linbuf0 = curr.file[0].linbuf;
-  char const *const *linbuf1 = curr.file[1].linbuf;
+  bool trivial = ignore_blank_lines || ignore_regexp;
 
   lin show_from = 0, show_to = 0;
 
@@ -1311,56 +1830,10 @@ analyze_hunk (struct change *hunk,
       show_to += next->inserted;
 
       for (lin i = next->line0; i <= l0 && trivial; i++)
-        {
-          char const *line = linbuf0[i];
-          char const *lastbyte = linbuf0[i + 1] - 1;
-          char const *newline = lastbyte + (*lastbyte != '\n');
-          idx_t len = newline - line;
-          char const *p = line;
-          if (skip_white_space)
-            while (*p != '\n')
-	      {
-		mcel_t g = mcel_scan (p, newline);
-		if (! c32isspace (g.ch))
-		  {
-		    if (! skip_leading_white_space)
-		      p = line;
-		    break;
-		  }
-		p += g.len;
-	      }
-          if (newline - p != trivial_length
-              && (! ignore_regexp.fastmap
-                  || (re_search (&ignore_regexp, line, len, 0, len, nullptr)
-		      < 0)))
-            trivial = false;
-        }
+	trivial = ignorable_line (&curr.file[0], i);
 
       for (lin i = next->line1; i <= l1 && trivial; i++)
-        {
-          char const *line = linbuf1[i];
-          char const *lastbyte = linbuf1[i + 1] - 1;
-          char const *newline = lastbyte + (*lastbyte != '\n');
-          idx_t len = newline - line;
-          char const *p = line;
-          if (skip_white_space)
-            while (*p != '\n')
-	      {
-		mcel_t g = mcel_scan (p, newline);
-		if (! c32isspace (g.ch))
-		  {
-		    if (! skip_leading_white_space)
-		      p = line;
-		    break;
-		  }
-		p += g.len;
-	      }
-          if (newline - p != trivial_length
-              && (! ignore_regexp.fastmap
-                  || (re_search (&ignore_regexp, line, len, 0, len, nullptr)
-		      < 0)))
-            trivial = false;
-        }
+	trivial = ignorable_line (&curr.file[1], i);
     }
   while ((next = next->link));
 
@@ -1375,7 +1848,7 @@ analyze_hunk (struct change *hunk,
 
   return (show_from ? OLD : UNCHANGED) | (show_to ? NEW : UNCHANGED);
 }
-
+
 #ifdef DEBUG
 void
 debug_script (struct change *sp)
@@ -0,0 +1,356 @@
+/* Asynchronous and limited output for GNU DIFF.
+
+   Copyright (C) 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* When standard output is slow, for example a pipe to a compressor,
+   diff can spend much of its time blocked in 'write' instead of
+   reading and comparing the next files.  With --async-output, standard
+   output becomes a stream that hands its data to a writer thread
+   through a ring of buffers.  Output is still formatted by the main
+   thread, which waits for the writer only when every buffer is full.
+
+   This replaces the stream that stdout names, which is possible only
+   where stdout is a variable; elsewhere output is synchronous.  */
+
+#include "diff.h"
+
+#if REPLACEABLE_STDOUT
+
+# include <xalloc.h>
+
+# include <pthread.h>
+
+/* The number of buffers in the ring.  */
+enum { RING_SLOTS = 8 };
+
+/* The default size of each buffer.  */
+enum { SLOT_SIZE_DEFAULT = 64 * 1024 };
+
+/* The buffers, how many bytes each holds, and their size.  */
+static char *slot[RING_SLOTS];
+static idx_t slot_len[RING_SLOTS];
+static idx_t slot_size;
+
+/* The index of the next buffer to write, and the number of full
+   buffers.  The main thread fills the buffer at index
+   (RING_HEAD + RING_COUNT) % RING_SLOTS, and no other thread accesses
+   that buffer until RING_COUNT is incremented.  */
+static int ring_head, ring_count;
+
+/* True if the writer should exit once the ring is empty.  */
+static bool ring_closing;
+
+/* The errno value of the first failed write, or zero.  */
+static int write_errno;
+
+/* RING_LOCK protects the ring variables above.  */
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_nonempty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ring_nonfull = PTHREAD_COND_INITIALIZER;
+
+/* The writer thread, and whether it is running.  */
+static pthread_t writer;
+static bool writer_running;
+
+/* The stream that standard output was before it was replaced.  */
+static FILE *real_stdout;
+
+/* Write the N bytes at BUF to standard output's file descriptor.
+   Return 0 on success, an errno value on failure.  */
+
+static int
+write_fully (char const *buf, idx_t n)
+{
+  while (0 < n)
+    {
+      ssize_t written = write (STDOUT_FILENO, buf, MIN (n, SSIZE_MAX));
+      if (written < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return errno;
+	}
+      buf += written;
+      n -= written;
+    }
+  return 0;
+}
+
+/* The writer thread.  Write full buffers in order until told to stop.
+   After a write fails, discard data so that the main thread can see
+   the error rather than wait forever.  */
+
+static void *
+writer_main (void *arg)
+{
+  pthread_mutex_lock (&ring_lock);
+  for (;;)
+    {
+      while (!ring_count && !ring_closing)
+	pthread_cond_wait (&ring_nonempty, &ring_lock);
+      if (!ring_count)
+	break;
+      int i = ring_head;
+      bool failed = write_errno != 0;
+      pthread_mutex_unlock (&ring_lock);
+
+      int err = failed ? 0 : write_fully (slot[i], slot_len[i]);
+
+      pthread_mutex_lock (&ring_lock);
+      if (err)
+	write_errno = err;
+      ring_head = (ring_head + 1) % RING_SLOTS;
+      ring_count--;
+      pthread_cond_signal (&ring_nonfull);
+    }
+  pthread_mutex_unlock (&ring_lock);
+  return arg;
+}
+
+/* Wait for the writer thread to write everything queued, and stop it.  */
+
+static void
+stop_writer (void)
+{
+  if (!writer_running)
+    return;
+  pthread_mutex_lock (&ring_lock);
+  ring_closing = true;
+  pthread_cond_signal (&ring_nonempty);
+  pthread_mutex_unlock (&ring_lock);
+  pthread_join (writer, nullptr);
+  writer_running = false;
+}
+
+/* Queue the SIZE bytes at BUF for output.  This is the write function
+   of the replacement standard output stream.  */
+
+static ssize_t
+queue_output (void *cookie, char const *buf, size_t size)
+{
+  if (!writer_running)
+    {
+      /* Output after the writer stopped, e.g., while exiting.  */
+      int err = write_errno ? write_errno : write_fully (buf, size);
+      if (err)
+	{
+	  errno = err;
+	  return -1;
+	}
+      return size;
+    }
+
+  for (size_t left = size; 0 < left; )
+    {
+      pthread_mutex_lock (&ring_lock);
+      while (ring_count == RING_SLOTS && !write_errno)
+	pthread_cond_wait (&ring_nonfull, &ring_lock);
+      int err = write_errno;
+      int i = (ring_head + ring_count) % RING_SLOTS;
+      pthread_mutex_unlock (&ring_lock);
+      if (err)
+	{
+	  errno = err;
+	  return -1;
+	}
+
+      idx_t n = MIN (left, (size_t) slot_size);
+      memcpy (slot[i], buf, n);
+      slot_len[i] = n;
+      buf += n;
+      left -= n;
+
+      pthread_mutex_lock (&ring_lock);
+      ring_count++;
+      pthread_cond_signal (&ring_nonempty);
+      pthread_mutex_unlock (&ring_lock);
+    }
+  return size;
+}
+
+/* Finish writing, and close the original standard output.  This is the
+   close function of the replacement standard output stream.  */
+
+static int
+close_output (void *cookie)
+{
+  stop_writer ();
+  int err = write_errno;
+  if (fclose (real_stdout) != 0 && !err)
+    err = errno;
+  if (err)
+    {
+      errno = err;
+      return -1;
+    }
+  return 0;
+}
+
+/* Before exiting, write any output still queued.  */
+
+static void
+finish_async_output (void)
+{
+  if (writer_running)
+    {
+      fflush (stdout);
+      stop_writer ();
+    }
+}
+
+/* Arrange for standard output to be written by a separate thread,
+   through buffers of BUFFER_SIZE bytes, or of a default size if
+   BUFFER_SIZE is zero.  Do nothing if this is not possible.
+   Call this before anything is output.  */
+
+void
+start_async_output (idx_t buffer_size)
+{
+  slot_size = buffer_size ? buffer_size : SLOT_SIZE_DEFAULT;
+  for (int i = 0; i < RING_SLOTS; i++)
+    slot[i] = ximalloc (slot_size);
+
+  /* Leave signals other than SIGPIPE to the main thread, which
+     handles them.  A broken pipe still kills diff as usual.  */
+  sigset_t blocked, oldset;
+  sigfillset (&blocked);
+  sigdelset (&blocked, SIGPIPE);
+  pthread_sigmask (SIG_BLOCK, &blocked, &oldset);
+  writer_running = pthread_create (&writer, nullptr, writer_main, nullptr) == 0;
+  pthread_sigmask (SIG_SETMASK, &oldset, nullptr);
+
+  if (!writer_running)
+    {
+      /* Fall back on writing synchronously.  */
+      for (int i = 0; i < RING_SLOTS; i++)
+	free (slot[i]);
+      return;
+    }
+
+  FILE *f = fopencookie (nullptr, "w",
+			 (cookie_io_functions_t) { .write = queue_output,
+						   .close = close_output });
+  if (! (f && setvbuf (f, ximalloc (slot_size), _IOFBF, slot_size) == 0))
+    xalloc_die ();
+  real_stdout = stdout;
+  stdout = f;
+  atexit (finish_async_output);
+}
+
+/* With --max-output-bytes, standard output becomes a stream that
+   passes at most that many bytes to the stream it replaced, and then a
+   line saying that the output was truncated.  Later output is
+   discarded, and OUTPUT_TRUNCATED tells diff that it need not bother
+   formatting it.  */
+
+/* The number of bytes that may still be output, and the limit.  */
+static intmax_t output_bytes_left;
+static intmax_t output_limit;
+
+/* The size of the limited stream's buffer.  Output that the stream has
+   not yet seen can reach the limit only if fewer bytes than this may
+   still be output.  */
+enum { LIMITED_OUTPUT_BUFSIZE = BUFSIZ };
+
+/* True if the last byte output ended a line.  */
+static bool output_at_line_start = true;
+
+/* Output the SIZE bytes at BUF to the stream COOKIE, as far as the
+   limit allows.  This is the write function of the limited standard
+   output stream.  */
+
+static ssize_t
+write_limited_output (void *cookie, char const *buf, size_t size)
+{
+  FILE *out = cookie;
+  if (!output_truncated)
+    {
+      idx_t n = MIN (size, output_bytes_left);
+      if (fwrite (buf, 1, n, out) != n)
+	return -1;
+      output_bytes_left -= n;
+      if (n)
+	output_at_line_start = buf[n - 1] == '\n';
+      if (n < size)
+	{
+	  output_truncated = true;
+	  if (!output_at_line_start)
+	    putc ('\n', out);
+	  fprintf (out, ngettext ("\\ Output truncated after %jd byte\n",
+				  "\\ Output truncated after %jd bytes\n",
+				  output_limit),
+		   output_limit);
+	}
+    }
+  return ferror (out) ? -1 : size;
+}
+
+/* Close the stream COOKIE.  This is the close function of the limited
+   standard output stream.  */
+
+static int
+close_limited_output (void *cookie)
+{
+  return fclose (cookie);
+}
+
+/* Arrange for standard output to be truncated after LIMIT bytes.
+   Call this before anything is output.  */
+
+void
+limit_output (intmax_t limit)
+{
+  output_bytes_left = output_limit = limit;
+  FILE *f = fopencookie (stdout, "w",
+			 (cookie_io_functions_t) {
+			   .write = write_limited_output,
+			   .close = close_limited_output });
+  if (! (f && setvbuf (f, ximalloc (LIMITED_OUTPUT_BUFSIZE), _IOFBF,
+			LIMITED_OUTPUT_BUFSIZE) == 0))
+    xalloc_die ();
+  stdout = f;
+}
+
+/* Return true if output that the limited stream has not yet seen might
+   reach the limit, so that it is worth flushing to find out.  */
+
+bool
+output_limit_near (void)
+{
+  return output_bytes_left < LIMITED_OUTPUT_BUFSIZE;
+}
+
+#else
+
+void
+start_async_output (idx_t buffer_size)
+{
+}
+
+void
+limit_output (intmax_t limit)
+{
+}
+
+bool
+output_limit_near (void)
+{
+  return false;
+}
+
+#endif